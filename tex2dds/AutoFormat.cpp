@@ -0,0 +1,361 @@
+#include "pch.h"
+
+#include <iostream>
+#include <sstream>
+#include <cmath>
+#include <limits>
+#include <DirectXPackedVector.h>
+
+#include "AutoFormat.hpp"
+
+using namespace DirectX;
+using namespace DirectX::PackedVector;
+
+// One step of an 8-bit channel, texels closer than that count as equal
+constexpr float AUTO_EPSILON = 1.0f / 255.0f;
+
+// Largest deviation from unit length of a texel that still reads as a normal, about three 8-bit steps
+constexpr float AUTO_NORMAL_TOLERANCE = 0.025f;
+
+// Smallest combined variance of X and Y a normal map has, so flat or saturated colour isn't taken for one
+constexpr double AUTO_NORMAL_MIN_VARIANCE = 0.001;
+
+struct SContentStats
+{
+    float alphaMin = 1.0f;
+    size_t alphaPartial = 0;
+
+    float colorMin = std::numeric_limits<float>::max();
+    float colorMax = -std::numeric_limits<float>::max();
+
+    // Largest |r - g| or |g - b|
+    float chroma = 0.0f;
+
+    // Largest distance from unit length and smallest z of rgb * 2 - 1
+    float normalError = 0.0f;
+    float normalZ = 1.0f;
+
+    // Sums of x, y and their squares for the spread of the normals
+    double normalSum[2] = {};
+    double normalSquares[2] = {};
+    size_t normalTexels = 0;
+
+    // Error of BC1 with bounding box endpoints, over texels that stay opaque
+    double bc1SSE = 0.0;
+    size_t bc1Texels = 0;
+
+    void Merge( const SContentStats &other )
+    {
+        alphaMin = std::min( alphaMin, other.alphaMin );
+        alphaPartial += other.alphaPartial;
+        colorMin = std::min( colorMin, other.colorMin );
+        colorMax = std::max( colorMax, other.colorMax );
+        chroma = std::max( chroma, other.chroma );
+        normalError = std::max( normalError, other.normalError );
+        normalZ = std::min( normalZ, other.normalZ );
+        for ( size_t c = 0; c < 2; ++c ) {
+            normalSum[c] += other.normalSum[c];
+            normalSquares[c] += other.normalSquares[c];
+        }
+        normalTexels += other.normalTexels;
+        bc1SSE += other.bc1SSE;
+        bc1Texels += other.bc1Texels;
+    }
+
+    double NormalVariance() const
+    {
+        if ( normalTexels == 0 ) return 0.0;
+
+        double variance = 0.0;
+        for ( size_t c = 0; c < 2; ++c ) {
+            double mean = normalSum[c] / normalTexels;
+            variance += normalSquares[c] / normalTexels - mean * mean;
+        }
+        return variance;
+    }
+};
+
+bool _CanAnalyze( DXGI_FORMAT format )
+{
+    switch ( MakeLinear( format ) ) {
+        case DXGI_FORMAT_R8G8B8A8_UNORM:
+        case DXGI_FORMAT_B8G8R8A8_UNORM:
+        case DXGI_FORMAT_R16G16B16A16_UNORM:
+        case DXGI_FORMAT_R16G16B16A16_FLOAT:
+        case DXGI_FORMAT_R32G32B32A32_FLOAT:
+        case DXGI_FORMAT_R32G32B32_FLOAT:
+        case DXGI_FORMAT_R16G16_FLOAT:
+        case DXGI_FORMAT_R32G32_FLOAT:
+        case DXGI_FORMAT_R16_FLOAT:
+        case DXGI_FORMAT_R32_FLOAT:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+// One row as RGBA with missing channels read as 0 and alpha as 1. sRGB values stay encoded, BC1 fits those too.
+static void _ReadRow( const Image &image, size_t y, XMVECTOR *row )
+{
+    auto pixels = image.pixels + y * image.rowPitch;
+
+    switch ( MakeLinear( image.format ) ) {
+        case DXGI_FORMAT_R8G8B8A8_UNORM:
+            for ( size_t x = 0; x < image.width; ++x ) {
+                row[x] = XMLoadUByteN4( reinterpret_cast<const XMUBYTEN4 *>( pixels ) + x );
+            }
+            break;
+
+        case DXGI_FORMAT_B8G8R8A8_UNORM:
+            for ( size_t x = 0; x < image.width; ++x ) {
+                row[x] = XMLoadColor( reinterpret_cast<const XMCOLOR *>( pixels ) + x );
+            }
+            break;
+
+        case DXGI_FORMAT_R16G16B16A16_UNORM:
+            for ( size_t x = 0; x < image.width; ++x ) {
+                row[x] = XMLoadUShortN4( reinterpret_cast<const XMUSHORTN4 *>( pixels ) + x );
+            }
+            break;
+
+        case DXGI_FORMAT_R16G16B16A16_FLOAT:
+            for ( size_t x = 0; x < image.width; ++x ) {
+                row[x] = XMLoadHalf4( reinterpret_cast<const XMHALF4 *>( pixels ) + x );
+            }
+            break;
+
+        case DXGI_FORMAT_R32G32B32A32_FLOAT:
+            for ( size_t x = 0; x < image.width; ++x ) {
+                row[x] = XMLoadFloat4( reinterpret_cast<const XMFLOAT4 *>( pixels ) + x );
+            }
+            break;
+
+        case DXGI_FORMAT_R32G32B32_FLOAT:
+            for ( size_t x = 0; x < image.width; ++x ) {
+                row[x] = XMVectorSetW( XMLoadFloat3( reinterpret_cast<const XMFLOAT3 *>( pixels ) + x ), 1.0f );
+            }
+            break;
+
+        case DXGI_FORMAT_R16G16_FLOAT:
+            for ( size_t x = 0; x < image.width; ++x ) {
+                row[x] = XMVectorSetW( XMLoadHalf2( reinterpret_cast<const XMHALF2 *>( pixels ) + x ), 1.0f );
+            }
+            break;
+
+        case DXGI_FORMAT_R32G32_FLOAT:
+            for ( size_t x = 0; x < image.width; ++x ) {
+                row[x] = XMVectorSetW( XMLoadFloat2( reinterpret_cast<const XMFLOAT2 *>( pixels ) + x ), 1.0f );
+            }
+            break;
+
+        case DXGI_FORMAT_R16_FLOAT:
+            for ( size_t x = 0; x < image.width; ++x ) {
+                row[x] = XMVectorSet( XMConvertHalfToFloat( reinterpret_cast<const HALF *>( pixels )[x] ), 0.0f, 0.0f, 1.0f );
+            }
+            break;
+
+        default:
+            for ( size_t x = 0; x < image.width; ++x ) {
+                row[x] = XMVectorSet( reinterpret_cast<const float *>( pixels )[x], 0.0f, 0.0f, 1.0f );
+            }
+            break;
+    }
+}
+
+// Squared error of a 4x4 block encoded as BC1 between its bounding box corners, quantized to 565. Blocks with
+// texels below the alpha threshold use the 3-colour mode and drop those texels, as the encoder does.
+void _EstimateBC1( const XMVECTOR *block, SContentStats &stats )
+{
+    XMVECTOR lo = XMVectorReplicate( std::numeric_limits<float>::max() );
+    XMVECTOR hi = XMVectorReplicate( -std::numeric_limits<float>::max() );
+    bool punchThrough = false;
+
+    for ( size_t i = 0; i < 16; ++i ) {
+        if ( XMVectorGetW( block[i] ) < 0.5f ) {
+            punchThrough = true;
+            continue;
+        }
+        lo = XMVectorMin( lo, block[i] );
+        hi = XMVectorMax( hi, block[i] );
+    }
+    if ( XMVectorGetX( lo ) > XMVectorGetX( hi ) ) return;
+
+    const XMVECTOR scale = XMVectorSet( 31.0f, 63.0f, 31.0f, 1.0f );
+    lo = XMVectorDivide( XMVectorRound( XMVectorMultiply( XMVectorSaturate( lo ), scale ) ), scale );
+    hi = XMVectorDivide( XMVectorRound( XMVectorMultiply( XMVectorSaturate( hi ), scale ) ), scale );
+
+    XMVECTOR palette[4] = { lo, hi };
+    size_t entries = 4;
+    if ( punchThrough ) {
+        palette[2] = XMVectorLerp( lo, hi, 0.5f );
+        entries = 3;
+    }
+    else {
+        palette[2] = XMVectorLerp( lo, hi, 1.0f / 3.0f );
+        palette[3] = XMVectorLerp( lo, hi, 2.0f / 3.0f );
+    }
+
+    for ( size_t i = 0; i < 16; ++i ) {
+        if ( XMVectorGetW( block[i] ) < 0.5f ) continue;
+
+        float best = std::numeric_limits<float>::max();
+        for ( size_t k = 0; k < entries; ++k ) {
+            best = std::min( best, XMVectorGetX( XMVector3LengthSq( XMVectorSubtract( block[i], palette[k] ) ) ) );
+        }
+        stats.bc1SSE += best;
+        ++stats.bc1Texels;
+    }
+}
+
+void _AnalyzeBlock( const XMVECTOR *block, bool colour, SContentStats &stats )
+{
+    for ( size_t i = 0; i < 16; ++i ) {
+        XMFLOAT4 v;
+        XMStoreFloat4( &v, block[i] );
+
+        stats.alphaMin = std::min( stats.alphaMin, v.w );
+        if ( v.w > AUTO_EPSILON && v.w < 1.0f - AUTO_EPSILON ) ++stats.alphaPartial;
+
+        stats.colorMin = std::min( { stats.colorMin, v.x, v.y, v.z } );
+        stats.colorMax = std::max( { stats.colorMax, v.x, v.y, v.z } );
+        stats.chroma = std::max( { stats.chroma, std::abs( v.x - v.y ), std::abs( v.y - v.z ) } );
+
+        auto normal = XMVectorMultiplyAdd( block[i], XMVectorReplicate( 2.0f ), XMVectorReplicate( -1.0f ) );
+        stats.normalError = std::max( stats.normalError, std::abs( XMVectorGetX( XMVector3Length( normal ) ) - 1.0f ) );
+        stats.normalZ = std::min( stats.normalZ, XMVectorGetZ( normal ) );
+
+        float x = XMVectorGetX( normal );
+        float y = XMVectorGetY( normal );
+        stats.normalSum[0] += x;
+        stats.normalSum[1] += y;
+        stats.normalSquares[0] += double( x ) * x;
+        stats.normalSquares[1] += double( y ) * y;
+        ++stats.normalTexels;
+    }
+
+    if ( colour ) {
+        _EstimateBC1( block, stats );
+    }
+}
+
+void _PrintChoice( DXGI_FORMAT format, const char *reason )
+{
+    Progress() << "Auto format: " << LookupByValue( format, g_pFormats ) << " (" << reason << ")" << std::endl;
+}
+
+HRESULT ChooseAutoFormat( const ScratchImage &image, DXGI_FORMAT autoFormat, float maxRMSE, DXGI_FORMAT &format )
+{
+    format = autoFormat;
+
+    const auto &metadata = image.GetMetadata();
+    auto dataType = FormatDataType( metadata.format );
+    size_t channels = BitsPerPixel( metadata.format ) / std::max<size_t>( BitsPerColor( metadata.format ), 1 );
+
+    // One or two normalized channels always fit BC4 or BC5, which keep more endpoint precision than BC1
+    if ( ( dataType == FORMAT_TYPE_UNORM || dataType == FORMAT_TYPE_SNORM ) && channels <= 2 ) {
+        bool snorm = dataType == FORMAT_TYPE_SNORM;
+        if ( channels == 1 ) {
+            format = snorm ? DXGI_FORMAT_BC4_SNORM : DXGI_FORMAT_BC4_UNORM;
+        }
+        else {
+            format = snorm ? DXGI_FORMAT_BC5_SNORM : DXGI_FORMAT_BC5_UNORM;
+        }
+        _PrintChoice( format, channels == 1 ? "one channel" : "two channels" );
+        return 0;
+    }
+
+    if ( !_CanAnalyze( metadata.format ) ) {
+        _PrintChoice( format, "not analyzed" );
+        return S_FALSE;
+    }
+
+    bool colour = channels >= 3;
+
+    SContentStats stats;
+    for ( size_t item = 0; item < metadata.arraySize; ++item ) {
+        const auto &top = *image.GetImage( 0, item, 0 );
+
+        // Rows of blocks are analyzed in parallel and merged in order
+        const int blockRows = int( ( top.height + 3 ) / 4 );
+        std::vector<SContentStats> rowStats( blockRows );
+
+        #pragma omp parallel for schedule( dynamic )
+        for ( int by = 0; by < blockRows; ++by ) {
+            std::vector<XMVECTOR> rows( top.width * 4 );
+            for ( size_t py = 0; py < 4; ++py ) {
+                _ReadRow( top, std::min( size_t( by ) * 4 + py, top.height - 1 ), &rows[py * top.width] );
+            }
+
+            // Partial blocks replicate their edge texels
+            XMVECTOR block[16];
+            for ( size_t bx = 0; bx < top.width; bx += 4 ) {
+                for ( size_t py = 0; py < 4; ++py ) {
+                    for ( size_t px = 0; px < 4; ++px ) {
+                        block[py * 4 + px] = rows[py * top.width + std::min( bx + px, top.width - 1 )];
+                    }
+                }
+                _AnalyzeBlock( block, colour, rowStats[by] );
+            }
+        }
+
+        for ( const auto &row : rowStats ) {
+            stats.Merge( row );
+        }
+    }
+
+    bool srgb = IsSRGB( autoFormat );
+    bool opaque = stats.alphaMin >= 1.0f - AUTO_EPSILON;
+    float bc1RMSE = stats.bc1Texels ? float( std::sqrt( stats.bc1SSE / ( stats.bc1Texels * 3 ) ) ) : 0.0f;
+
+    // Only BC6H keeps values outside [0, 1], and it has no alpha
+    if ( stats.colorMax > 1.0f + AUTO_EPSILON || stats.colorMin < -AUTO_EPSILON ) {
+        if ( !opaque ) {
+            std::cerr << "AUTO format can't keep HDR colour with alpha, set a format!" << std::endl;
+            return E_FAIL;
+        }
+
+        format = stats.colorMin < 0.0f ? DXGI_FORMAT_BC6H_SF16 : DXGI_FORMAT_BC6H_UF16;
+        _PrintChoice( format, "HDR" );
+        return 0;
+    }
+
+    if ( !colour ) {
+        format = channels == 1 ? DXGI_FORMAT_BC4_UNORM : DXGI_FORMAT_BC5_UNORM;
+        _PrintChoice( format, channels == 1 ? "one channel" : "two channels" );
+        return 0;
+    }
+
+    if ( stats.alphaPartial > 0 ) {
+        format = srgb ? DXGI_FORMAT_BC7_UNORM_SRGB : DXGI_FORMAT_BC7_UNORM;
+        _PrintChoice( format, "translucent alpha" );
+        return 0;
+    }
+
+    if ( !srgb && opaque && stats.chroma <= AUTO_EPSILON ) {
+        format = DXGI_FORMAT_BC4_UNORM;
+        _PrintChoice( format, "greyscale, read from R" );
+        return 0;
+    }
+
+    bool unitLength = stats.normalError <= AUTO_NORMAL_TOLERANCE && stats.normalZ >= -AUTO_EPSILON;
+    if ( !srgb && opaque && unitLength && stats.NormalVariance() >= AUTO_NORMAL_MIN_VARIANCE ) {
+        format = DXGI_FORMAT_BC5_UNORM;
+        _PrintChoice( format, "normal map, Z rebuilt from XY" );
+        return 0;
+    }
+
+    std::ostringstream reason;
+    reason << ( opaque ? "opaque" : "1-bit alpha" ) << ", BC1 RMSE " << bc1RMSE;
+
+    if ( bc1RMSE <= maxRMSE ) {
+        format = srgb ? DXGI_FORMAT_BC1_UNORM_SRGB : DXGI_FORMAT_BC1_UNORM;
+    }
+    else {
+        format = srgb ? DXGI_FORMAT_BC7_UNORM_SRGB : DXGI_FORMAT_BC7_UNORM;
+        reason << " > " << maxRMSE;
+    }
+    _PrintChoice( format, reason.str().c_str() );
+
+    return 0;
+}
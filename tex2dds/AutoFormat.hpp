@@ -0,0 +1,14 @@
+#pragma once
+
+#include "TexUtils.hpp"
+
+// Picks the BC format of an AUTO spec from one pass over the top level of every image in its mip chain.
+// autoFormat is the stand-in the chain was built for: BC7_UNORM for AUTO, which may keep greyscale in R (BC4)
+// and normal maps as XY (BC5), or BC7_UNORM_SRGB for AUTO_SRGB, which always keeps RGB(A). BC1 is chosen when
+// its estimated RMSE stays within maxRMSE. S_FALSE keeps autoFormat for formats it doesn't read.
+HRESULT ChooseAutoFormat(
+    const DirectX::ScratchImage &image,
+    DXGI_FORMAT autoFormat,
+    float maxRMSE,
+    DXGI_FORMAT &format
+);
@@ -0,0 +1,164 @@
+#include "pch.h"
+
+#include <iostream>
+
+#include "Backend.hpp"
+
+using namespace DirectX;
+
+// DirectXTex's multithreaded CPU encoders, which cover every BC format
+class CCPUCompressor : public CCompressor
+{
+public:
+    CCPUCompressor( BLOCK_LAYOUT layout ) :
+        m_layout( layout )
+    {
+    }
+
+    HRESULT Compress( DXGI_FORMAT format, const Image *images, size_t nimages, const TexMetadata &metadata, ScratchImage &result ) override
+    {
+        if ( m_layout == BLOCK_LAYOUT_LINEAR ) {
+            return DirectX::Compress( images, nimages, metadata, format, TEX_COMPRESS_PARALLEL, TEX_THRESHOLD_DEFAULT, result );
+        }
+
+        auto cdata = metadata;
+        cdata.format = format;
+        HRESULT hr = result.Initialize( cdata );
+        if ( FAILED( hr ) ) {
+            return hr;
+        }
+
+        // Blocks are encoded independently, so the reordered images encode to the same bytes
+        for ( size_t i = 0; i < nimages; ++i ) {
+            ScratchImage column;
+            hr = ToBlockColumn( images[i], m_layout, column );
+            if ( FAILED( hr ) ) {
+                return hr;
+            }
+
+            ScratchImage compressed;
+            hr = DirectX::Compress( *column.GetImages(), format, TEX_COMPRESS_PARALLEL, TEX_THRESHOLD_DEFAULT, compressed );
+            if ( FAILED( hr ) ) {
+                return hr;
+            }
+
+            FromBlockColumn( *compressed.GetImages(), m_layout, result.GetImages()[i] );
+        }
+
+        return 0;
+    }
+
+protected:
+    BLOCK_LAYOUT m_layout;
+};
+
+// DirectCompute BC6H/BC7 encoders. Columns of blocks would exceed the texture height limit, so images stay row-linear.
+class CGPUCompressor : public CCompressor
+{
+public:
+    CGPUCompressor( ID3D11Device *pDevice ) :
+        m_pDevice( pDevice )
+    {
+    }
+
+    HRESULT Compress( DXGI_FORMAT format, const Image *images, size_t nimages, const TexMetadata &metadata, ScratchImage &result ) override
+    {
+        // Jobs share the device's immediate context, also across registries adopting the same device
+        static std::mutex s_gpuMutex;
+        std::lock_guard<std::mutex> lock( s_gpuMutex );
+
+        return DirectX::Compress( m_pDevice.Get(), images, nimages, metadata, format, TEX_COMPRESS_PARALLEL, TEX_ALPHA_WEIGHT_DEFAULT, result );
+    }
+
+protected:
+    Microsoft::WRL::ComPtr<ID3D11Device> m_pDevice;
+};
+
+bool _PrefersGPU( DXGI_FORMAT format )
+{
+    auto typeless = MakeTypeless( format );
+    return typeless == DXGI_FORMAT_BC6H_TYPELESS || typeless == DXGI_FORMAT_BC7_TYPELESS;
+}
+
+CBackendRegistry::CBackendRegistry( ID3D11Device *pDevice ) :
+    m_backend( pDevice ? BACKEND_GPU : BACKEND_CPU ),
+    m_pDevice( pDevice )
+{
+    if ( pDevice ) {
+        m_pGPU = std::make_unique<CGPUCompressor>( pDevice );
+    }
+}
+
+void CBackendRegistry::Register( DXGI_FORMAT format, std::shared_ptr<CCompressor> pCompressor )
+{
+    std::lock_guard lock( m_mutex );
+    m_registered[format] = std::move( pCompressor );
+}
+
+CCompressor *CBackendRegistry::Lookup( DXGI_FORMAT format )
+{
+    std::lock_guard lock( m_mutex );
+
+    auto it = m_registered.find( format );
+    if ( it != m_registered.end() ) return it->second.get();
+
+    if ( _PrefersGPU( format ) && m_backend != BACKEND_CPU ) {
+        if ( !m_pGPU && !m_gpuFailed ) {
+            if ( CreateDevice( m_adapter, m_pDevice.ReleaseAndGetAddressOf() ) ) {
+                m_pGPU = std::make_unique<CGPUCompressor>( m_pDevice.Get() );
+            }
+            else {
+                m_gpuFailed = true;
+                std::cerr << "Failed to create a GPU device" << ( m_backend == BACKEND_AUTO ? ", compressing BC6H/BC7 on the CPU" : "!" ) << std::endl;
+            }
+        }
+
+        if ( m_pGPU ) return m_pGPU.get();
+        if ( m_backend == BACKEND_GPU ) return nullptr;
+    }
+
+    if ( !m_pCPU ) {
+        m_pCPU = std::make_unique<CCPUCompressor>( m_layout );
+    }
+    return m_pCPU.get();
+}
+
+HRESULT CBackendRegistry::Compress( DXGI_FORMAT format, const Image *images, size_t nimages, const TexMetadata &metadata, ScratchImage &result )
+{
+    auto pCompressor = Lookup( format );
+    if ( !pCompressor ) {
+        std::cerr << "No GPU backend for " << LookupByValue( format, g_pFormats ) << "!" << std::endl;
+        return E_FAIL;
+    }
+
+    return pCompressor->Compress( format, images, nimages, metadata, result );
+}
+
+std::string CBackendRegistry::GetCacheTag( DXGI_FORMAT format )
+{
+    std::lock_guard lock( m_mutex );
+
+    if ( m_registered.count( format ) ) return "registered";
+    if ( !_PrefersGPU( format ) ) return "";
+
+    if ( m_backend == BACKEND_CPU ) return "cpu";
+    if ( m_backend == BACKEND_GPU || m_pGPU ) return "gpu";
+    if ( m_gpuFailed ) return "cpu";
+
+    // AUTO before the first BC6H/BC7 job: an adapter probe tells the hosts apart without creating the device
+    if ( !m_adapterProbed ) {
+        m_hasAdapter = HasAdapter( m_adapter );
+        m_adapterProbed = true;
+    }
+    return m_hasAdapter ? "gpu" : "cpu";
+}
+
+bool ParseBackend( const std::string &value, BACKEND_KIND &backend )
+{
+    if ( value == "auto" ) backend = BACKEND_AUTO;
+    else if ( value == "cpu" ) backend = BACKEND_CPU;
+    else if ( value == "gpu" ) backend = BACKEND_GPU;
+    else return false;
+
+    return true;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <wrl\client.h>
+#include <mutex>
+#include <map>
+
+#include "TexUtils.hpp"
+#include "BlockLinear.hpp"
+
+enum BACKEND_KIND
+{
+    BACKEND_AUTO,   // BC6H/BC7 on the GPU when a device can be created, on the CPU otherwise
+    BACKEND_CPU,    // Never touches D3D
+    BACKEND_GPU     // BC6H/BC7 fail without a device
+};
+
+constexpr BACKEND_KIND BACKEND_DEFAULT = BACKEND_AUTO;
+
+// Encodes uncompressed images to one or more BC formats
+class CCompressor
+{
+public:
+    virtual ~CCompressor() = default;
+
+    virtual HRESULT Compress( DXGI_FORMAT format, const DirectX::Image *images, size_t nimages, const DirectX::TexMetadata &metadata, DirectX::ScratchImage &result ) = 0;
+};
+
+// Maps every output format to the compressor that encodes it. The built-in backends are created on first
+// use, so runs that never write BC6H/BC7 don't load D3D or enumerate adapters.
+class CBackendRegistry
+{
+public:
+    CBackendRegistry( BACKEND_KIND backend = BACKEND_DEFAULT, int adapter = 0 ) :
+        m_backend( backend ),
+        m_adapter( adapter )
+    {
+    }
+
+    // The CPU encoders read their blocks in layout order
+    CBackendRegistry( BACKEND_KIND backend, BLOCK_LAYOUT layout ) :
+        m_backend( backend ),
+        m_layout( layout )
+    {
+    }
+
+    // GPU formats compress on pDevice, which may be shared with the host. Without a device everything
+    // compresses on the CPU, as CConverter( nullptr ) always meant.
+    CBackendRegistry( ID3D11Device *pDevice );
+
+    // Routes format to pCompressor instead of the built-in backends
+    void Register( DXGI_FORMAT format, std::shared_ptr<CCompressor> pCompressor );
+
+    HRESULT Compress( DXGI_FORMAT format, const DirectX::Image *images, size_t nimages, const DirectX::TexMetadata &metadata, DirectX::ScratchImage &result );
+
+    // Layouts other than linear encode a block column copy of every image, which doubles its footprint
+    BLOCK_LAYOUT GetLayout() const { return m_layout; }
+
+    // Names the encoder of format for the cache key, since CPU and GPU BC6H/BC7 bytes differ.
+    // Empty for formats the built-in CPU encoder always writes. Never creates the device.
+    std::string GetCacheTag( DXGI_FORMAT format );
+
+protected:
+    CCompressor *Lookup( DXGI_FORMAT format );
+
+    BACKEND_KIND m_backend;
+    int m_adapter = 0;
+    BLOCK_LAYOUT m_layout = BLOCK_LAYOUT_LINEAR;
+
+    std::mutex m_mutex;
+    std::map<DXGI_FORMAT, std::shared_ptr<CCompressor>> m_registered;
+    std::unique_ptr<CCompressor> m_pCPU;
+    std::unique_ptr<CCompressor> m_pGPU;
+    Microsoft::WRL::ComPtr<ID3D11Device> m_pDevice;
+    bool m_gpuFailed = false;
+    bool m_adapterProbed = false;
+    bool m_hasAdapter = false;
+};
+
+// Parses --backend values
+bool ParseBackend( const std::string &value, BACKEND_KIND &backend );
@@ -0,0 +1,150 @@
+#include "pch.h"
+
+#include <iostream>
+#include <chrono>
+
+#include "Benchmark.hpp"
+#include "Backend.hpp"
+
+using namespace DirectX;
+
+struct SBenchmarkCase
+{
+    DXGI_FORMAT format;
+    DXGI_FORMAT source;
+    std::vector<std::pair<size_t, size_t>> sizes;
+    int runs;
+};
+
+// Gradients under hashed noise, so blocks are neither flat nor random. Odd sizes exercise partial blocks.
+void _FillSynthetic( const Image &image )
+{
+    for ( size_t y = 0; y < image.height; ++y ) {
+        auto row = image.pixels + y * image.rowPitch;
+
+        for ( size_t x = 0; x < image.width; ++x ) {
+            uint32_t hash = uint32_t( x * 73856093u ) ^ uint32_t( y * 19349663u );
+            hash = ( hash ^ ( hash >> 13 ) ) * 0x5bd1e995u;
+            float noise = float( hash >> 24 ) / 255.0f;
+
+            float r = float( x ) / image.width;
+            float g = float( y ) / image.height;
+            float b = 0.75f * noise + 0.25f * r;
+            float a = ( ( x ^ y ) & 32 ) ? 1.0f : 0.5f * noise;
+
+            if ( image.format == DXGI_FORMAT_R32G32B32A32_FLOAT ) {
+                // HDR values above 1 for the BC6H encoder
+                auto pixel = reinterpret_cast<float *>( row ) + x * 4;
+                pixel[0] = r * 4.0f;
+                pixel[1] = g * 2.0f;
+                pixel[2] = b;
+                pixel[3] = 1.0f;
+            }
+            else {
+                auto pixel = row + x * 4;
+                pixel[0] = uint8_t( r * 255.0f );
+                pixel[1] = uint8_t( g * 255.0f );
+                pixel[2] = uint8_t( b * 255.0f );
+                pixel[3] = uint8_t( a * 255.0f );
+            }
+        }
+    }
+}
+
+// Best of runs, to keep scheduler noise out of the comparison
+HRESULT _TimeCompress( CBackendRegistry &backends, DXGI_FORMAT format, const ScratchImage &source, int runs, double &seconds, ScratchImage &result )
+{
+    seconds = 0.0;
+
+    for ( int run = 0; run < runs; ++run ) {
+        auto start = std::chrono::steady_clock::now();
+        HRESULT hr = backends.Compress( format, source.GetImages(), source.GetImageCount(), source.GetMetadata(), result );
+        double elapsed = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+        if ( FAILED( hr ) ) {
+            return hr;
+        }
+
+        if ( run == 0 || elapsed < seconds ) seconds = elapsed;
+    }
+
+    return 0;
+}
+
+HRESULT BenchmarkBlockLayouts( bool verbose )
+{
+    // The BC6H/BC7 CPU encoders are orders of magnitude slower, so they get smaller sizes and a single run
+    const SBenchmarkCase cases[] = {
+        { DXGI_FORMAT_BC1_UNORM, DXGI_FORMAT_R8G8B8A8_UNORM, { { 256, 256 }, { 1024, 1024 }, { 4096, 4096 }, { 16384, 64 }, { 1023, 1021 } }, 3 },
+        { DXGI_FORMAT_BC3_UNORM, DXGI_FORMAT_R8G8B8A8_UNORM, { { 256, 256 }, { 1024, 1024 }, { 4096, 4096 }, { 16384, 64 }, { 1023, 1021 } }, 3 },
+        { DXGI_FORMAT_BC4_UNORM, DXGI_FORMAT_R8G8B8A8_UNORM, { { 256, 256 }, { 1024, 1024 }, { 4096, 4096 }, { 16384, 64 }, { 1023, 1021 } }, 3 },
+        { DXGI_FORMAT_BC5_UNORM, DXGI_FORMAT_R8G8B8A8_UNORM, { { 256, 256 }, { 1024, 1024 }, { 4096, 4096 }, { 16384, 64 }, { 1023, 1021 } }, 3 },
+        { DXGI_FORMAT_BC7_UNORM, DXGI_FORMAT_R8G8B8A8_UNORM, { { 256, 256 }, { 1024, 1024 }, { 4096, 64 } }, 1 },
+        { DXGI_FORMAT_BC6H_UF16, DXGI_FORMAT_R32G32B32A32_FLOAT, { { 256, 256 }, { 1024, 1024 }, { 4096, 64 } }, 1 },
+    };
+    const BLOCK_LAYOUT layouts[] = { BLOCK_LAYOUT_LINEAR, BLOCK_LAYOUT_TILED, BLOCK_LAYOUT_MORTON };
+
+    auto results = nlohmann::json::array();
+    HRESULT mismatch = 0;
+
+    for ( const auto &test : cases ) {
+        for ( auto [width, height] : test.sizes ) {
+            ScratchImage source;
+            HRESULT hr = source.Initialize2D( test.source, width, height, 1, 1 );
+            if ( FAILED( hr ) ) {
+                std::cerr << "Could not create benchmark image!" << std::endl;
+                return hr;
+            }
+            _FillSynthetic( *source.GetImages() );
+
+            ScratchImage reference;
+            double linearSeconds = 0.0;
+
+            for ( auto layout : layouts ) {
+                CBackendRegistry backends( BACKEND_CPU, layout );
+
+                ScratchImage compressed;
+                double seconds;
+                hr = _TimeCompress( backends, test.format, source, test.runs, seconds, compressed );
+                if ( FAILED( hr ) ) {
+                    std::cerr << "Failed to compress benchmark image!" << std::endl;
+                    return hr;
+                }
+
+                bool identical = true;
+                if ( layout == BLOCK_LAYOUT_LINEAR ) {
+                    linearSeconds = seconds;
+                    reference = std::move( compressed );
+                }
+                else {
+                    identical = compressed.GetPixelsSize() == reference.GetPixelsSize() && memcmp( compressed.GetPixels(), reference.GetPixels(), reference.GetPixelsSize() ) == 0;
+                    if ( !identical ) mismatch = E_FAIL;
+                }
+
+                nlohmann::json result;
+                result["format"] = LookupByValue( test.format, g_pFormats );
+                result["width"] = width;
+                result["height"] = height;
+                result["layout"] = GetBlockLayoutName( layout );
+                result["seconds"] = seconds;
+                result["mpixels_per_second"] = seconds > 0.0 ? width * height / seconds / 1e6 : 0.0;
+                result["speedup"] = seconds > 0.0 ? linearSeconds / seconds : 1.0;
+                result["identical"] = identical;
+                results.push_back( result );
+
+                if ( verbose ) {
+                    std::cerr << result["format"].get<std::string>() << " " << width << "x" << height << " " << GetBlockLayoutName( layout ) << ": " << seconds << " s" << std::endl;
+                }
+            }
+        }
+    }
+
+    nlohmann::json benchmark;
+    benchmark["results"] = results;
+    std::cout << benchmark.dump( 4 ) << std::endl;
+
+    if ( FAILED( mismatch ) ) {
+        std::cerr << "Block layouts encoded to different bytes!" << std::endl;
+    }
+
+    return mismatch;
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include "BlockLinear.hpp"
+
+// Times the CPU encoders on synthetic images of several formats and sizes in every block layout and prints
+// the results as JSON to stdout. Fails if a layout encodes to different bytes than the row-linear image.
+HRESULT BenchmarkBlockLayouts( bool verbose = false );
@@ -0,0 +1,132 @@
+#include "pch.h"
+
+#include "BlockLinear.hpp"
+
+using namespace DirectX;
+
+constexpr size_t MORTON_TILE_BLOCKS = 8;
+
+// Pixel a partial block repeats at position i when only n of its 4 rows or columns exist, as DirectXTex does
+size_t _PartialSource( size_t i, size_t n )
+{
+    static const size_t s_source[] = { 0, 0, 0, 1 };
+    while ( i >= n ) i = s_source[i];
+    return i;
+}
+
+// Position of every row-major block in the column. Tiles are row-major, blocks within a tile follow the
+// Z-curve, and blocks past the image edge are skipped, so positions stay dense.
+void _MortonPositions( size_t blocksWide, size_t blocksHigh, std::vector<uint32_t> &positions )
+{
+    positions.resize( blocksWide * blocksHigh );
+
+    uint32_t position = 0;
+    for ( size_t ty = 0; ty < blocksHigh; ty += MORTON_TILE_BLOCKS ) {
+        for ( size_t tx = 0; tx < blocksWide; tx += MORTON_TILE_BLOCKS ) {
+            for ( size_t code = 0; code < MORTON_TILE_BLOCKS * MORTON_TILE_BLOCKS; ++code ) {
+                size_t bx = tx + ( ( code & 1 ) | ( ( code >> 1 ) & 2 ) | ( ( code >> 2 ) & 4 ) );
+                size_t by = ty + ( ( ( code >> 1 ) & 1 ) | ( ( code >> 2 ) & 2 ) | ( ( code >> 3 ) & 4 ) );
+                if ( bx >= blocksWide || by >= blocksHigh ) continue;
+
+                positions[by * blocksWide + bx] = position++;
+            }
+        }
+    }
+}
+
+HRESULT ToBlockColumn( const Image &src, BLOCK_LAYOUT layout, ScratchImage &column )
+{
+    if ( IsCompressed( src.format ) || IsPlanar( src.format ) || BitsPerPixel( src.format ) % 8 != 0 ) {
+        return E_INVALIDARG;
+    }
+
+    size_t blocksWide = ( src.width + 3 ) / 4;
+    size_t blocksHigh = ( src.height + 3 ) / 4;
+
+    HRESULT hr = column.Initialize2D( src.format, 4, blocksWide * blocksHigh * 4, 1, 1 );
+    if ( FAILED( hr ) ) {
+        return hr;
+    }
+
+    std::vector<uint32_t> positions;
+    if ( layout == BLOCK_LAYOUT_MORTON ) {
+        _MortonPositions( blocksWide, blocksHigh, positions );
+    }
+
+    auto bytesPerPixel = BitsPerPixel( src.format ) / 8;
+    auto blockRowBytes = 4 * bytesPerPixel;
+    auto pColumn = column.GetPixels();
+
+    // Each band of source rows is read once, front to back
+    #pragma omp parallel for schedule( static )
+    for ( int by = 0; by < int( blocksHigh ); ++by ) {
+        size_t rows = std::min<size_t>( 4, src.height - by * 4 );
+
+        for ( size_t bx = 0; bx < blocksWide; ++bx ) {
+            size_t index = by * blocksWide + bx;
+            size_t position = positions.empty() ? index : positions[index];
+            size_t columns = std::min<size_t>( 4, src.width - bx * 4 );
+
+            auto pBlock = pColumn + position * 4 * blockRowBytes;
+            for ( size_t py = 0; py < 4; ++py ) {
+                auto srcRow = src.pixels + ( by * 4 + _PartialSource( py, rows ) ) * src.rowPitch + bx * blockRowBytes;
+                auto dstRow = pBlock + py * blockRowBytes;
+
+                if ( columns == 4 ) {
+                    memcpy( dstRow, srcRow, blockRowBytes );
+                    continue;
+                }
+
+                for ( size_t px = 0; px < 4; ++px ) {
+                    memcpy( dstRow + px * bytesPerPixel, srcRow + _PartialSource( px, columns ) * bytesPerPixel, bytesPerPixel );
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+void FromBlockColumn( const Image &column, BLOCK_LAYOUT layout, const Image &dst )
+{
+    size_t blocksWide = ( dst.width + 3 ) / 4;
+    size_t blocksHigh = ( dst.height + 3 ) / 4;
+    size_t blockBytes = column.rowPitch;
+
+    // Blocks already are in row order, only the row pitch can differ
+    if ( layout != BLOCK_LAYOUT_MORTON ) {
+        for ( size_t by = 0; by < blocksHigh; ++by ) {
+            memcpy( dst.pixels + by * dst.rowPitch, column.pixels + by * blocksWide * blockBytes, blocksWide * blockBytes );
+        }
+        return;
+    }
+
+    std::vector<uint32_t> positions;
+    _MortonPositions( blocksWide, blocksHigh, positions );
+
+    for ( size_t by = 0; by < blocksHigh; ++by ) {
+        auto dstRow = dst.pixels + by * dst.rowPitch;
+        for ( size_t bx = 0; bx < blocksWide; ++bx ) {
+            memcpy( dstRow + bx * blockBytes, column.pixels + positions[by * blocksWide + bx] * blockBytes, blockBytes );
+        }
+    }
+}
+
+bool ParseBlockLayout( const std::string &value, BLOCK_LAYOUT &layout )
+{
+    if ( value == "linear" ) layout = BLOCK_LAYOUT_LINEAR;
+    else if ( value == "tiled" ) layout = BLOCK_LAYOUT_TILED;
+    else if ( value == "morton" ) layout = BLOCK_LAYOUT_MORTON;
+    else return false;
+
+    return true;
+}
+
+const char *GetBlockLayoutName( BLOCK_LAYOUT layout )
+{
+    switch ( layout ) {
+        case BLOCK_LAYOUT_TILED: return "tiled";
+        case BLOCK_LAYOUT_MORTON: return "morton";
+        default: return "linear";
+    }
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "TexUtils.hpp"
+
+// Order in which the pixels of an uncompressed image reach the block encoders
+enum BLOCK_LAYOUT
+{
+    BLOCK_LAYOUT_LINEAR,    // Row-linear image, each block is gathered from four rows
+    BLOCK_LAYOUT_TILED,     // Each block's 16 pixels contiguous, blocks in row order
+    BLOCK_LAYOUT_MORTON     // Each block's 16 pixels contiguous, blocks in Z-order within 8x8-block tiles
+};
+
+// Copies src to a 4-pixel-wide column of blocks in layout order, partial blocks padded the way DirectXTex
+// pads them. Encoding the column yields the same blocks as encoding src, each read from one contiguous run.
+HRESULT ToBlockColumn( const DirectX::Image &src, BLOCK_LAYOUT layout, DirectX::ScratchImage &column );
+
+// Scatters the encoded blocks of a column made by ToBlockColumn into the row-major blocks of dst
+void FromBlockColumn( const DirectX::Image &column, BLOCK_LAYOUT layout, const DirectX::Image &dst );
+
+// Parses --block-layout values
+bool ParseBlockLayout( const std::string &value, BLOCK_LAYOUT &layout );
+const char *GetBlockLayoutName( BLOCK_LAYOUT layout );
@@ -0,0 +1,202 @@
+#include "pch.h"
+
+#include <iostream>
+#include <compressapi.h>
+
+#include "BlockRDO.hpp"
+
+#pragma comment( lib, "Cabinet.lib" )
+
+using namespace DirectX;
+
+// Approximate LZ cost in bits of a block that repeats a recent one versus a fresh one
+constexpr float RDO_MATCH_BITS = 24.0f;
+constexpr size_t RDO_WINDOW = 32;
+constexpr size_t RDO_BAND_ROWS = 16;
+constexpr size_t BLOCK_VALUES = 16 * 4;
+
+// Reads every 4x4 block as 64 floats on a 0-255 scale, replicating edge pixels of partial blocks
+void _GatherBlocks( const Image &image, std::vector<float> &blocks )
+{
+    size_t blocksWide = ( image.width + 3 ) / 4;
+    size_t blocksHigh = ( image.height + 3 ) / 4;
+    blocks.resize( blocksWide * blocksHigh * BLOCK_VALUES );
+
+    auto pOut = blocks.data();
+    for ( size_t by = 0; by < blocksHigh; ++by ) {
+        for ( size_t bx = 0; bx < blocksWide; ++bx ) {
+            for ( size_t py = 0; py < 4; ++py ) {
+                size_t y = std::min( by * 4 + py, image.height - 1 );
+                auto row = reinterpret_cast<const float *>( image.pixels + y * image.rowPitch );
+
+                for ( size_t px = 0; px < 4; ++px ) {
+                    size_t x = std::min( bx * 4 + px, image.width - 1 );
+                    for ( size_t c = 0; c < 4; ++c ) {
+                        *pOut++ = row[x * 4 + c] * 255.0f;
+                    }
+                }
+            }
+        }
+    }
+}
+
+float _BlockSSE( const float *a, const float *b )
+{
+    float sse = 0.0f;
+    for ( size_t i = 0; i < BLOCK_VALUES; ++i ) {
+        float d = a[i] - b[i];
+        sse += d * d;
+    }
+    return sse;
+}
+
+HRESULT _ToFloatImage( const ScratchImage &image, ScratchImage &floatImage )
+{
+    if ( IsCompressed( image.GetMetadata().format ) ) {
+        return Decompress( image.GetImages(), image.GetImageCount(), image.GetMetadata(), DXGI_FORMAT_R32G32B32A32_FLOAT, floatImage );
+    }
+
+    if ( image.GetMetadata().format == DXGI_FORMAT_R32G32B32A32_FLOAT ) {
+        auto mdata = image.GetMetadata();
+        HRESULT hr = floatImage.Initialize( mdata );
+        if ( FAILED( hr ) ) return hr;
+        memcpy( floatImage.GetPixels(), image.GetPixels(), image.GetPixelsSize() );
+        return 0;
+    }
+
+    return Convert( image.GetImages(), image.GetImageCount(), image.GetMetadata(), DXGI_FORMAT_R32G32B32A32_FLOAT, TEX_FILTER_DEFAULT, TEX_THRESHOLD_DEFAULT, floatImage );
+}
+
+// Greedy rate-distortion pass over one band of block rows. A block is swapped for a copy of one of the
+// previous RDO_WINDOW blocks in the stream when the added error costs less than lambda times the bits an
+// LZ coder saves by matching it, so the added SSE per block stays below lambda * (blockBits - RDO_MATCH_BITS).
+void _OptimizeBand( uint8_t *pBlocks, size_t blockBytes, size_t first, size_t last, const std::vector<float> &source, const std::vector<float> &decoded, float lambda, SRDOStats &stats )
+{
+    const float literalBits = blockBytes * 8.0f;
+
+    // Index of the decoded block each output block currently reproduces
+    std::vector<size_t> origin( last - first );
+
+    for ( size_t i = first; i < last; ++i ) {
+        auto pSource = source.data() + i * BLOCK_VALUES;
+        float baseError = _BlockSSE( pSource, decoded.data() + i * BLOCK_VALUES );
+
+        float bestCost = baseError + lambda * literalBits;
+        float bestError = baseError;
+        size_t bestCandidate = i;
+
+        for ( size_t j = i > first + RDO_WINDOW ? i - RDO_WINDOW : first; j < i; ++j ) {
+            auto pCandidate = pBlocks + j * blockBytes;
+
+            // An identical earlier block already makes this one a match for free
+            if ( memcmp( pCandidate, pBlocks + i * blockBytes, blockBytes ) == 0 ) {
+                bestCost = baseError + lambda * RDO_MATCH_BITS;
+                bestError = baseError;
+                bestCandidate = i;
+                break;
+            }
+
+            float error = _BlockSSE( pSource, decoded.data() + origin[j - first] * BLOCK_VALUES );
+            float cost = error + lambda * RDO_MATCH_BITS;
+            if ( cost < bestCost ) {
+                bestCost = cost;
+                bestError = error;
+                bestCandidate = j;
+            }
+        }
+
+        if ( bestCandidate != i ) {
+            memcpy( pBlocks + i * blockBytes, pBlocks + bestCandidate * blockBytes, blockBytes );
+            origin[i - first] = origin[bestCandidate - first];
+            ++stats.reusedBlocks;
+        }
+        else {
+            origin[i - first] = i;
+        }
+
+        stats.sseBefore += baseError;
+        stats.sseAfter += bestError;
+    }
+
+    stats.blocks += last - first;
+    stats.values += ( last - first ) * BLOCK_VALUES;
+}
+
+HRESULT OptimizeBlocksRDO( const ScratchImage &mipImage, ScratchImage &compressedImage, float lambda, SRDOStats &stats )
+{
+    auto format = compressedImage.GetMetadata().format;
+    if ( !IsCompressed( format ) ) {
+        std::cerr << "RDO requires a block compressed format!" << std::endl;
+        return E_INVALIDARG;
+    }
+
+    auto blockBytes = BitsPerPixel( format ) * 16 / 8;
+
+    ScratchImage sourceFloat;
+    HRESULT hr = _ToFloatImage( mipImage, sourceFloat );
+    if ( FAILED( hr ) ) {
+        std::cerr << "Failed to convert source for RDO!" << std::endl;
+        return hr;
+    }
+
+    ScratchImage decodedFloat;
+    hr = _ToFloatImage( compressedImage, decodedFloat );
+    if ( FAILED( hr ) ) {
+        std::cerr << "Failed to decompress blocks for RDO!" << std::endl;
+        return hr;
+    }
+
+    std::vector<float> source;
+    std::vector<float> decoded;
+
+    for ( size_t n = 0; n < compressedImage.GetImageCount(); ++n ) {
+        const auto &compressed = compressedImage.GetImages()[n];
+
+        _GatherBlocks( sourceFloat.GetImages()[n], source );
+        _GatherBlocks( decodedFloat.GetImages()[n], decoded );
+
+        size_t blocksWide = ( compressed.width + 3 ) / 4;
+        size_t blocksHigh = ( compressed.height + 3 ) / 4;
+
+        // Bands are independent, so they run on the OpenMP team of the job at the cost of no matches across band edges
+        std::vector<SRDOStats> bandStats( ( blocksHigh + RDO_BAND_ROWS - 1 ) / RDO_BAND_ROWS );
+
+        #pragma omp parallel for schedule( dynamic )
+        for ( int band = 0; band < int( bandStats.size() ); ++band ) {
+            size_t first = size_t( band ) * RDO_BAND_ROWS * blocksWide;
+            size_t last = std::min( ( size_t( band ) + 1 ) * RDO_BAND_ROWS, blocksHigh ) * blocksWide;
+
+            _OptimizeBand( compressed.pixels, blockBytes, first, last, source, decoded, lambda, bandStats[band] );
+        }
+
+        for ( const auto &band : bandStats ) {
+            stats.blocks += band.blocks;
+            stats.reusedBlocks += band.reusedBlocks;
+            stats.sseBefore += band.sseBefore;
+            stats.sseAfter += band.sseAfter;
+            stats.values += band.values;
+        }
+    }
+
+    return 0;
+}
+
+size_t EstimateLZSize( const ScratchImage &image )
+{
+    COMPRESSOR_HANDLE hCompressor = nullptr;
+    if ( !CreateCompressor( COMPRESS_ALGORITHM_XPRESS_HUFF | COMPRESS_RAW, nullptr, &hCompressor ) ) {
+        return 0;
+    }
+
+    // First call only reports the required buffer size
+    SIZE_T compressedSize = 0;
+    ::Compress( hCompressor, image.GetPixels(), image.GetPixelsSize(), nullptr, 0, &compressedSize );
+
+    std::vector<uint8_t> buffer( compressedSize );
+    if ( !::Compress( hCompressor, image.GetPixels(), image.GetPixelsSize(), buffer.data(), buffer.size(), &compressedSize ) ) {
+        compressedSize = 0;
+    }
+
+    CloseCompressor( hCompressor );
+    return compressedSize;
+}
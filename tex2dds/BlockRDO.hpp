@@ -0,0 +1,30 @@
+#pragma once
+
+#include "TexUtils.hpp"
+
+struct SRDOStats
+{
+    size_t blocks = 0;
+    size_t reusedBlocks = 0;
+    double sseBefore = 0.0;
+    double sseAfter = 0.0;
+    size_t values = 0;
+
+    double PSNRBefore() const { return _PSNR( sseBefore ); }
+    double PSNRAfter() const { return _PSNR( sseAfter ); }
+
+private:
+    double _PSNR( double sse ) const {
+        if ( values == 0 || sse <= 0.0 ) return 99.0;
+        return 10.0 * std::log10( 255.0 * 255.0 / ( sse / values ) );
+    }
+};
+
+HRESULT OptimizeBlocksRDO(
+    const DirectX::ScratchImage &mipImage,
+    DirectX::ScratchImage &compressedImage,
+    float lambda,
+    SRDOStats &stats
+);
+
+size_t EstimateLZSize( const DirectX::ScratchImage &image );
@@ -1,7 +1,12 @@
 #include "pch.h"
 #include "CTex2DDS.hpp"
+#include "Prefetch.hpp"
+#include "Pages.hpp"
 
 #include <iostream>
+#include <charconv>
+#include <set>
+#include <filesystem>
 
 using namespace DirectX;
 
@@ -30,6 +35,67 @@ DXGI_FORMAT ParseFormat( const nlohmann::json &data, const std::string &ctx ) {
     return result;
 }
 
+// AUTO and AUTO_SRGB map to the BC7 format that stands in until the content is analyzed
+DXGI_FORMAT ParseAutoFormat( const nlohmann::json &data )
+{
+    if ( !data.is_string() ) return DXGI_FORMAT_UNKNOWN;
+
+    auto format = data.get<std::string>();
+
+    if ( _stricmp( format.c_str(), "AUTO" ) == 0 )      return DXGI_FORMAT_BC7_UNORM;
+    if ( _stricmp( format.c_str(), "AUTO_SRGB" ) == 0 ) return DXGI_FORMAT_BC7_UNORM_SRGB;
+    return DXGI_FORMAT_UNKNOWN;
+}
+
+float ParseAutoMaxRMSE( const nlohmann::json &data, DXGI_FORMAT autoFormat, const std::string &ctx )
+{
+    if ( !data.is_number() || data.get<float>() <= 0.0f ) throw std::runtime_error( "'auto_max_rmse' must be a positive number for " + ctx );
+    if ( autoFormat == DXGI_FORMAT_UNKNOWN ) throw std::runtime_error( "'auto_max_rmse' requires format AUTO or AUTO_SRGB for " + ctx );
+    return data.get<float>();
+}
+
+bool ParsePremultiplyAlpha( const nlohmann::json &data, const std::string &ctx )
+{
+    if ( data.is_null() ) return false;
+    if ( !data.is_boolean() ) throw std::runtime_error( "'premultiply_alpha' must be a boolean for " + ctx );
+    return data.get<bool>();
+}
+
+float ParseRDOLambda( const nlohmann::json &data, DXGI_FORMAT format, const std::string &ctx )
+{
+    if ( data.is_null() ) return 0.0f;
+    if ( !data.is_number() || data.get<float>() < 0.0f ) throw std::runtime_error( "'rdo_lambda' must be a non-negative number for " + ctx );
+    if ( !DirectX::IsCompressed( format ) ) throw std::runtime_error( "'rdo_lambda' requires a BC format for " + ctx );
+    return data.get<float>();
+}
+
+MIP_FILTER ParseMipFilter( const nlohmann::json &data, const std::string &ctx )
+{
+    if ( data.is_null() ) return MIP_FILTER_DEFAULT;
+    if ( !data.is_string() ) throw std::runtime_error( "'mip_filter' must be a string for " + ctx );
+
+    auto filter = data.get<std::string>();
+
+    if ( filter == "default" ) return MIP_FILTER_DEFAULT;
+    if ( filter == "box" )     return MIP_FILTER_BOX;
+    throw std::runtime_error( "Unknown mip_filter '" + filter + "' for " + ctx );
+}
+
+RESIZE_FILTER ParseResizeFilter( const nlohmann::json &data, const std::string &ctx )
+{
+    if ( data.is_null() ) return RESIZE_FILTER_DEFAULT;
+    if ( !data.is_string() ) throw std::runtime_error( "'resize_filter' must be a string for " + ctx );
+
+    auto filter = data.get<std::string>();
+
+    if ( filter == "default" )  return RESIZE_FILTER_DEFAULT;
+    if ( filter == "box" )      return RESIZE_FILTER_BOX;
+    if ( filter == "triangle" ) return RESIZE_FILTER_TRIANGLE;
+    if ( filter == "lanczos3" ) return RESIZE_FILTER_LANCZOS3;
+    if ( filter == "mitchell" ) return RESIZE_FILTER_MITCHELL;
+    throw std::runtime_error( "Unknown resize_filter '" + filter + "' for " + ctx );
+}
+
 std::pair<int, int> ParseResolution( const nlohmann::json &data, const std::string &ctx )
 {
     if ( !data.is_array() ) throw std::runtime_error( "'resolution' must be an array for " + ctx );
@@ -38,6 +104,59 @@ std::pair<int, int> ParseResolution( const nlohmann::json &data, const std::stri
     return { resolution[0], resolution[1] };
 }
 
+TEX_LAYOUT ParseLayout( const nlohmann::json &data, const std::string &ctx )
+{
+    if ( data.is_null() ) return TEX_LAYOUT_SINGLE;
+    if ( !data.is_string() ) throw std::runtime_error( "'type' must be a string for " + ctx );
+
+    auto layout = data.get<std::string>();
+
+    if ( layout == "texture" ) return TEX_LAYOUT_SINGLE;
+    if ( layout == "array" )   return TEX_LAYOUT_ARRAY;
+    if ( layout == "atlas" )   return TEX_LAYOUT_ATLAS;
+    throw std::runtime_error( "Unknown type '" + layout + "' for " + ctx );
+}
+
+size_t ParseMipLevels( const nlohmann::json &data, const std::string &ctx )
+{
+    if ( data.is_null() ) return 1;
+    if ( !data.is_number_integer() || data.get<int>() < 1 ) throw std::runtime_error( "'mip_levels' must be a positive integer for " + ctx );
+    return data.get<size_t>();
+}
+
+SPageLayout ParsePages( nlohmann::json data, DXGI_FORMAT format, float rdoLambda, const std::string &ctx )
+{
+    if ( !data.is_object() ) throw std::runtime_error( "'pages' must be an object for " + ctx );
+    if ( !DirectX::IsCompressed( format ) ) throw std::runtime_error( "'pages' requires a BC format for " + ctx );
+    if ( rdoLambda > 0.0f ) throw std::runtime_error( "'pages' can't be combined with 'rdo_lambda' for " + ctx );
+
+    SPageLayout pages;
+
+    auto size = data["size"];
+    if ( !size.is_number_integer() || size.get<int>() < 4 || ( size.get<int>() & ( size.get<int>() - 1 ) ) != 0 ) {
+        throw std::runtime_error( "'pages.size' must be a power of two of at least 4 for " + ctx );
+    }
+    pages.size = size.get<size_t>();
+
+    // Padded pages stay whole blocks
+    auto border = data["border"];
+    if ( !border.is_null() ) {
+        if ( !border.is_number_integer() || border.get<int>() < 0 || border.get<size_t>() > pages.size / 2 || border.get<int>() % 2 != 0 ) {
+            throw std::runtime_error( "'pages.border' must be an even integer from 0 to half of 'pages.size' for " + ctx );
+        }
+        pages.border = border.get<size_t>();
+    }
+
+    auto address = data["address"];
+    if ( !address.is_null() ) {
+        if ( !address.is_string() ) throw std::runtime_error( "'pages.address' must be a string for " + ctx );
+        if ( address.get<std::string>() == "clamp" ) pages.wrap = false;
+        else if ( address.get<std::string>() != "wrap" ) throw std::runtime_error( "Unknown pages.address '" + address.get<std::string>() + "' for " + ctx );
+    }
+
+    return pages;
+}
+
 CTex2DDS::CTex2DDS( nlohmann::json data ) {
     // output_path
     if ( !data["output_path"].is_string() ) throw std::runtime_error( "'output_path' must be a string!" );
@@ -46,37 +165,183 @@ CTex2DDS::CTex2DDS( nlohmann::json data ) {
 
     m_srgb = ParseSRGB( data["srgb"], outputPath );
 
-    m_format = ParseFormat( data["format"], outputPath );
+    m_autoFormat = ParseAutoFormat( data["format"] );
+    m_format = IsAutoFormat() ? m_autoFormat : ParseFormat( data["format"], outputPath );
+
+    if ( !data["auto_max_rmse"].is_null() ) {
+        m_autoMaxRMSE = ParseAutoMaxRMSE( data["auto_max_rmse"], m_autoFormat, outputPath );
+    }
+
+    m_premultiplyAlpha = ParsePremultiplyAlpha( data["premultiply_alpha"], outputPath );
+
+    m_rdoLambda = ParseRDOLambda( data["rdo_lambda"], m_format, outputPath );
+
+    m_resizeFilter = ParseResizeFilter( data["resize_filter"], outputPath );
+
+    m_mipFilter = ParseMipFilter( data["mip_filter"], outputPath );
+
+    m_layout = ParseLayout( data["type"], outputPath );
 
-    auto resolution = ParseResolution( data["resolution"], outputPath );
+    if ( !data["pages"].is_null() ) {
+        if ( m_layout != TEX_LAYOUT_SINGLE ) throw std::runtime_error( "'pages' is only supported for single textures for " + outputPath );
+        m_pages = ParsePages( data["pages"], m_format, m_rdoLambda, outputPath );
+    }
+
+    if ( m_layout == TEX_LAYOUT_SINGLE ) {
+        auto resolution = ParseResolution( data["resolution"], outputPath );
+        m_width = resolution.first;
+        m_height = resolution.second;
+
+        ParseChannels( data["channels"], outputPath );
+        return;
+    }
+
+    // Array and atlas members share the group's format, and its srgb, premultiply_alpha and resize_filter unless overridden
+    m_width = -1;
+    m_height = -1;
+
+    if ( m_layout == TEX_LAYOUT_ATLAS ) {
+        m_mipLevels = ParseMipLevels( data["mip_levels"], outputPath );
+    }
+
+    if ( !data["members"].is_array() || data["members"].empty() ) throw std::runtime_error( "'members' must be a non-empty array for " + outputPath );
+
+    auto members = data["members"].get<std::vector<nlohmann::json>>();
+    m_members.reserve( members.size() );
+
+    // Names key the sidecar entries, so a repeated one would hide a member
+    std::set<std::string> names;
+    for ( auto &member : members ) {
+        m_members.emplace_back( std::make_unique<CTex2DDS>( member, *this, m_members.size() ) );
+        if ( !names.insert( m_members.back()->GetName() ).second ) {
+            throw std::runtime_error( "Duplicate member name '" + m_members.back()->GetName() + "' for " + outputPath );
+        }
+
+        // The DDS header carries one alpha mode for the whole group
+        if ( m_members.back()->m_premultiplyAlpha != m_members[0]->m_premultiplyAlpha ) {
+            throw std::runtime_error( "Members must agree on 'premultiply_alpha' for " + outputPath );
+        }
+    }
+}
+
+CTex2DDS::CTex2DDS( nlohmann::json data, const CTex2DDS &group, size_t index ) {
+    auto groupPath = std::string( group.m_szOutoutPath.begin(), group.m_szOutoutPath.end() );
+
+    if ( !data.is_object() ) throw std::runtime_error( "'members' must contain objects for " + groupPath );
+
+    // name
+    if ( !data["name"].is_null() && !data["name"].is_string() ) throw std::runtime_error( "'members.name' must be a string for " + groupPath );
+    if ( group.m_layout == TEX_LAYOUT_ATLAS && data["name"].is_null() ) throw std::runtime_error( "'members.name' is required for atlas " + groupPath );
+    m_name = data["name"].is_null() ? std::to_string( index ) : data["name"].get<std::string>();
+
+    auto ctx = groupPath + "[" + m_name + "]";
+    m_szOutoutPath = std::wstring( ctx.begin(), ctx.end() );
+
+    if ( !data["type"].is_null() ) throw std::runtime_error( "Members can't be nested groups for " + ctx );
+    if ( !data["format"].is_null() ) throw std::runtime_error( "Members inherit 'format' from their group for " + ctx );
+    if ( !data["auto_max_rmse"].is_null() ) throw std::runtime_error( "Members inherit 'auto_max_rmse' from their group for " + ctx );
+    if ( !data["mip_filter"].is_null() ) throw std::runtime_error( "Members inherit 'mip_filter' from their group for " + ctx );
+
+    m_format = group.m_format;
+    m_autoFormat = group.m_autoFormat;
+    m_autoMaxRMSE = group.m_autoMaxRMSE;
+    m_srgb = data["srgb"].is_null() ? group.m_srgb : ParseSRGB( data["srgb"], ctx );
+    m_premultiplyAlpha = data["premultiply_alpha"].is_null() ? group.m_premultiplyAlpha : ParsePremultiplyAlpha( data["premultiply_alpha"], ctx );
+    m_resizeFilter = data["resize_filter"].is_null() ? group.m_resizeFilter : ParseResizeFilter( data["resize_filter"], ctx );
+    m_mipFilter = group.m_mipFilter;
+
+    auto resolution = ParseResolution( data["resolution"], ctx );
     m_width = resolution.first;
     m_height = resolution.second;
 
+    ParseChannels( data["channels"], ctx );
+}
+
+// [~]<r|g|b|a|0|1|h>[*scale][+bias|-bias]..., an uppercase channel toggles the ~, so ~G reads green as is
+void ParseSwizzle( const std::string &src, ChannelSwizzle &channel, const std::string &ctx ) {
+    const std::string error = "'channels.src' must be [~]<r|g|b|a|R|G|B|A|0|1|h>, uppercase inverting, followed by optional *scale and +bias terms for " + ctx;
+
+    std::string_view view( src );
 
+    if ( !view.empty() && view.front() == '~' ) {
+        channel.invert = true;
+        view.remove_prefix( 1 );
+    }
+    if ( view.empty() ) throw std::runtime_error( error );
+
+    char swizzle = view.front();
+    view.remove_prefix( 1 );
+
+    if ( std::string_view( "RGBA" ).find( swizzle ) != std::string_view::npos ) {
+        channel.invert = !channel.invert;
+        swizzle = static_cast<char>( std::tolower( swizzle ) );
+    }
+    if ( std::string_view( "rgba01h" ).find( swizzle ) == std::string_view::npos ) throw std::runtime_error( error );
+    channel.swizzle = swizzle;
+
+    while ( !view.empty() ) {
+        char op = view.front();
+        view.remove_prefix( 1 );
+
+        float value;
+        auto [end, ec] = std::from_chars( view.data(), view.data() + view.size(), value );
+        if ( ec != std::errc() ) throw std::runtime_error( error );
+        view.remove_prefix( end - view.data() );
+
+        switch ( op ) {
+            case '*': channel.scale *= value; channel.bias *= value; break;
+            case '+': channel.bias += value; break;
+            case '-': channel.bias -= value; break;
+            default: throw std::runtime_error( error );
+        }
+    }
+}
+
+void CTex2DDS::ParseChannels( const nlohmann::json &data, const std::string &outputPath ) {
     // channels
-    if ( !data["channels"].is_array() ) throw std::runtime_error( "'channels' must be an array for " + outputPath  );
+    if ( !data.is_array() ) throw std::runtime_error( "'channels' must be an array for " + outputPath  );
 
-    auto channels = data["channels"].get<std::vector<nlohmann::json>>();
+    auto channels = data.get<std::vector<nlohmann::json>>();
     m_channels.reserve( channels.size() );
 
     for ( const auto &i : channels ) {
         if ( !i["file"].is_null() && !i["file"].is_string() ) throw std::runtime_error( "'channels.file' must be null or a string for " + outputPath  );
-        if ( !i["src"].is_string() ) throw std::runtime_error( "'channels.src' must be a single character for " + outputPath );
+        if ( !i["src"].is_string() ) throw std::runtime_error( "'channels.src' must be a string for " + outputPath );
 
         auto src = i["src"].get<std::string>();
-        if ( src.length() != 1 ) throw std::runtime_error( "'channels.src' must be a single character for " + outputPath  );
 
         if ( i["file"].is_null() ) {
-            m_channels.emplace_back( nullptr, src[0] );
+            m_channels.emplace_back( nullptr, 'r' );
         }
         else {
             auto temp = i["file"].get<std::string>();
-            m_channels.emplace_back( std::wstring( temp.begin(), temp.end() ), src[0] );
+            m_channels.emplace_back( std::wstring( temp.begin(), temp.end() ), 'r' );
         }
+
+        ParseSwizzle( src, m_channels.back(), outputPath );
     }
+
+    if ( m_premultiplyAlpha && m_channels.size() != 4 ) throw std::runtime_error( "'premultiply_alpha' requires 4 channels for " + outputPath );
 }
 
-HRESULT CTex2DDS::LoadTextures( bool verbose ) {
+HRESULT CTex2DDS::LoadTextures( bool verbose, CPrefetcher *pPrefetcher ) {
+    // A previous run may have resolved the stand-in
+    if ( IsAutoFormat() ) {
+        m_format = m_autoFormat;
+    }
+
+    if ( IsGroup() ) {
+        for ( auto &member : m_members ) {
+            HRESULT hr = member->LoadTextures( verbose, pPrefetcher );
+            if ( FAILED( hr ) ) {
+                std::wcerr << "Failed to load member: " << member->GetOutFile() << std::endl;
+                return hr;
+            }
+        }
+
+        return 0;
+    }
+
     for ( const auto &i : m_channels ) {
         if ( i.szFile.has_value() ) {
             std::wstring file = i.szFile.value();
@@ -85,15 +350,33 @@ HRESULT CTex2DDS::LoadTextures( bool verbose ) {
                 auto [it, inserted] = m_textureMap.emplace( file, std::make_unique<ScratchImage>() );
                 auto &pInputImage = it->second;
 
-                std::cout << "Loading image..." << std::endl;
-                HRESULT hr = LoadImageWithSRGB( file.c_str(), m_srgb, m_format, pInputImage, verbose );
+                // Caller-held sources shadow files of the same name
+                const SMemorySource *pSource = nullptr;
+                if ( m_pSources && m_pSources->contains( file ) ) {
+                    pSource = &m_pSources->at( file );
+                }
+
+                std::vector<uint8_t> data;
+                bool prefetched = !pSource && pPrefetcher && pPrefetcher->Take( file, data ) == S_OK;
+
+                Progress() << "Loading image..." << std::endl;
+                HRESULT hr;
+                if ( pSource && pSource->pImage ) {
+                    hr = LoadImageWithSRGB( *pSource->pImage, m_srgb, pInputImage, verbose );
+                }
+                else if ( pSource ) {
+                    hr = LoadImageWithSRGB( file.c_str(), m_srgb, m_width, m_height, pInputImage, verbose, pSource->pData, pSource->size );
+                }
+                else {
+                    hr = LoadImageWithSRGB( file.c_str(), m_srgb, m_width, m_height, pInputImage, verbose, prefetched ? data.data() : nullptr, data.size() );
+                }
                 if ( FAILED( hr ) ) {
                     std::wcerr << "Failed to load image: " << file << std::endl;
                     return hr;
                 }
 
-                std::cout << "Resizing image..." << std::endl;
-                hr = ResizeImage( m_width, m_height, pInputImage, m_format );
+                Progress() << "Resizing image..." << std::endl;
+                hr = ResizeImage( m_width, m_height, pInputImage, m_format, m_resizeFilter );
                 if ( FAILED( hr ) ) {
                     std::wcerr << "Failed to resize image: " << file << std::endl;
                     return hr;
@@ -105,4 +388,265 @@ HRESULT CTex2DDS::LoadTextures( bool verbose ) {
     if ( m_textureMap.empty() ) return E_FAIL;
 
     return 0;
-}
\ No newline at end of file
+}
+
+const char *CTex2DDS::GetFormatName() {
+    if ( IsAutoFormat() ) {
+        return IsSRGB( m_autoFormat ) ? "AUTO_SRGB" : "AUTO";
+    }
+
+    return LookupByValue( m_format, g_pFormats );
+}
+
+void CTex2DDS::SetSources( std::shared_ptr<const SourceMap> pSources ) {
+    for ( auto &member : m_members ) {
+        member->SetSources( pSources );
+    }
+
+    m_pSources = pSources;
+}
+
+void CTex2DDS::UnloadTextures() {
+    for ( auto &member : m_members ) {
+        member->UnloadTextures();
+    }
+
+    m_textureMap.clear();
+}
+
+// Pixels of every level and array item of the predicted output
+static uint64_t _GetChainPixels( const TexMetadata &predicted ) {
+    uint64_t pixels = 0;
+    for ( size_t mip = 0; mip < predicted.mipLevels; ++mip ) {
+        pixels += uint64_t( std::max<size_t>( predicted.width >> mip, 1 ) ) * std::max<size_t>( predicted.height >> mip, 1 );
+    }
+    return pixels * predicted.arraySize;
+}
+
+uint64_t CTex2DDS::EstimateOutputMemory( size_t channelBytes, const TexMetadata &predicted ) {
+    uint64_t pixels = uint64_t( predicted.width ) * predicted.height * predicted.arraySize;
+    uint64_t chainPixels = _GetChainPixels( predicted );
+
+    // Pages repeat their borders, so they compress more texels than the chain holds
+    uint64_t compressedPixels = IsPaged() ? ComputePagedPixels( predicted, m_pages ) : chainPixels;
+
+    // Extracted slices, combiner image, mip chain and compressed chain
+    uint64_t slices = pixels * m_channels.size() * channelBytes;
+    uint64_t combiner = slices;
+    uint64_t mipChain = chainPixels * m_channels.size() * channelBytes;
+    uint64_t compressed = compressedPixels * BitsPerPixel( predicted.format ) / 8;
+
+    return slices + combiner + mipChain + compressed;
+}
+
+uint64_t CTex2DDS::EstimateMemory() {
+    TexMetadata predicted;
+    if ( FAILED( PredictOutput( predicted ) ) ) return 0;
+
+    return EstimateMemory( predicted );
+}
+
+uint64_t CTex2DDS::EstimateMemory( const TexMetadata &predicted ) {
+    if ( IsGroup() ) {
+        // Members stay resident until the group image is assembled, which is about the size of all their outputs
+        uint64_t total = 0;
+        for ( auto &member : m_members ) {
+            TexMetadata memberPredicted;
+            if ( FAILED( member->PredictOutput( memberPredicted ) ) ) continue;
+
+            uint64_t estimate = member->EstimateMemory( memberPredicted );
+            total += estimate + member->EstimateOutputMemory( 1, memberPredicted );
+        }
+        return total;
+    }
+
+    uint64_t total = 0;
+    size_t channelBytes = 1;
+
+    std::set<std::wstring> files;
+    for ( const auto &i : m_channels ) {
+        if ( !i.szFile.has_value() || !files.insert( i.szFile.value() ).second ) continue;
+
+        TexMetadata metadata;
+        if ( FAILED( GetImageHeader( i.szFile.value().c_str(), metadata ) ) ) continue;
+
+        // Decoded source plus its resized copy
+        uint64_t bytesPerPixel = BitsPerPixel( metadata.format ) / 8;
+        total += uint64_t( metadata.width ) * metadata.height * bytesPerPixel;
+        total += uint64_t( predicted.width ) * predicted.height * bytesPerPixel;
+
+        channelBytes = std::max<size_t>( channelBytes, BitsPerColor( metadata.format ) / 8 );
+    }
+
+    return total + EstimateOutputMemory( channelBytes, predicted );
+}
+
+HRESULT CTex2DDS::EstimateCost( uint64_t &cost ) {
+    TexMetadata predicted;
+    HRESULT hr = PredictOutput( predicted );
+    if ( FAILED( hr ) ) return hr;
+
+    cost = EstimateCost( predicted );
+    return 0;
+}
+
+uint64_t CTex2DDS::EstimateCost( const TexMetadata &predicted ) {
+    // Pixels of the output chain or its padded pages, BC6H/BC7 encode several times slower than the other BC formats
+    uint64_t cost = IsPaged() ? ComputePagedPixels( predicted, m_pages ) : _GetChainPixels( predicted );
+
+    auto typeless = MakeTypeless( predicted.format );
+    if ( typeless == DXGI_FORMAT_BC6H_TYPELESS || typeless == DXGI_FORMAT_BC7_TYPELESS ) {
+        cost *= 4;
+    }
+
+    return cost;
+}
+
+uint64_t CTex2DDS::GetOutputPixels() {
+    if ( IsGroup() ) {
+        uint64_t total = 0;
+        for ( auto &member : m_members ) {
+            total += member->GetOutputPixels();
+        }
+        return total;
+    }
+
+    size_t width, height;
+    GetOutputSize( width, height );
+
+    return uint64_t( width ) * height;
+}
+
+void CTex2DDS::GetOutputSize( size_t &width, size_t &height ) {
+    width = m_width;
+    height = m_height;
+
+    if ( m_width == -1 || m_height == -1 ) {
+        TexMetadata metadata = {};
+        for ( const auto &i : m_channels ) {
+            if ( i.szFile.has_value() && SUCCEEDED( GetImageHeader( i.szFile.value().c_str(), metadata ) ) ) break;
+        }
+        if ( m_width == -1 ) width = metadata.width;
+        if ( m_height == -1 ) height = metadata.height;
+    }
+}
+
+HRESULT CTex2DDS::PredictOutput( TexMetadata &metadata ) {
+    metadata = {};
+    metadata.depth = 1;
+    metadata.arraySize = 1;
+    metadata.format = m_format;
+    metadata.dimension = TEX_DIMENSION_TEXTURE2D;
+
+    auto &single = IsGroup() ? *m_members[0].get() : *this;
+    if ( single.m_premultiplyAlpha ) {
+        metadata.SetAlphaMode( TEX_ALPHA_MODE_PREMULTIPLIED );
+    }
+
+    if ( m_layout == TEX_LAYOUT_ATLAS ) {
+        std::vector<std::pair<size_t, size_t>> sizes( m_members.size() );
+        for ( size_t i = 0; i < m_members.size(); ++i ) {
+            m_members[i]->GetOutputSize( sizes[i].first, sizes[i].second );
+            if ( sizes[i].first == 0 || sizes[i].second == 0 ) return E_FAIL;
+        }
+
+        std::vector<std::pair<size_t, size_t>> offsets;
+        metadata.mipLevels = ClampAtlasMipLevels( sizes, m_mipLevels );
+        PackAtlasRects( sizes, size_t( 4 ) << ( metadata.mipLevels - 1 ), metadata.width, metadata.height, offsets );
+        return 0;
+    }
+
+    single.GetOutputSize( metadata.width, metadata.height );
+    if ( metadata.width == 0 || metadata.height == 0 ) return E_FAIL;
+
+    if ( m_layout == TEX_LAYOUT_ARRAY ) {
+        metadata.arraySize = m_members.size();
+    }
+
+    // Full chain down to 1x1, as GenerateMipMapChain builds it
+    metadata.mipLevels = 1;
+    while ( ( std::max( metadata.width, metadata.height ) >> metadata.mipLevels ) > 0 ) ++metadata.mipLevels;
+
+    return 0;
+}
+
+std::vector<std::wstring> CTex2DDS::GetOutputFiles() {
+    std::vector<std::wstring> files = { m_szOutoutPath };
+
+    if ( IsGroup() || IsPaged() ) {
+        files.push_back( std::filesystem::path( m_szOutoutPath ).replace_extension( ".json" ).wstring() );
+    }
+
+    return files;
+}
+
+std::set<std::wstring> CTex2DDS::GetSourceFiles() {
+    std::set<std::wstring> files;
+
+    for ( auto &member : m_members ) {
+        files.merge( member->GetSourceFiles() );
+    }
+
+    for ( const auto &i : m_channels ) {
+        if ( i.szFile.has_value() ) {
+            files.insert( i.szFile.value() );
+        }
+    }
+
+    return files;
+}
+
+nlohmann::json CTex2DDS::GetCanonicalSpec( const std::function<std::string( const std::wstring & )> &fileId ) {
+    nlohmann::json spec;
+    spec["format"] = GetFormatName();
+    if ( IsAutoFormat() ) {
+        spec["auto_max_rmse"] = m_autoMaxRMSE;
+    }
+    spec["srgb"] = int( m_srgb );
+    spec["resolution"] = { m_width, m_height };
+    spec["premultiply_alpha"] = m_premultiplyAlpha;
+    spec["rdo_lambda"] = m_rdoLambda;
+    spec["resize_filter"] = int( m_resizeFilter );
+    if ( m_mipFilter != MIP_FILTER_DEFAULT ) {
+        spec["mip_filter"] = int( m_mipFilter );
+    }
+    spec["type"] = int( m_layout );
+    spec["mip_levels"] = m_mipLevels;
+    spec["name"] = m_name;
+    if ( IsPaged() ) {
+        spec["pages"] = { { "size", m_pages.size }, { "border", m_pages.border }, { "wrap", m_pages.wrap } };
+    }
+
+    if ( IsGroup() ) {
+        // The sidecar names the texture file
+        spec["texture"] = std::filesystem::path( m_szOutoutPath ).filename().string();
+
+        auto &members = spec["members"] = nlohmann::json::array();
+        for ( auto &member : m_members ) {
+            members.push_back( member->GetCanonicalSpec( fileId ) );
+        }
+        return spec;
+    }
+
+    // Channels without a file read the first loaded source, which is the first in path order
+    std::wstring defaultFile;
+    for ( const auto &i : m_channels ) {
+        if ( i.szFile.has_value() && ( defaultFile.empty() || i.szFile.value() < defaultFile ) ) {
+            defaultFile = i.szFile.value();
+        }
+    }
+
+    auto &channels = spec["channels"] = nlohmann::json::array();
+    for ( const auto &i : m_channels ) {
+        auto file = i.szFile.has_value() ? i.szFile.value() : defaultFile;
+        channels.push_back( {
+            { "file", file.empty() ? "" : fileId( file ) },
+            { "swizzle", std::string( 1, i.swizzle ) },
+            { "invert", i.invert },
+            { "scale", i.scale },
+            { "bias", i.bias }
+        } );
+    }
+
+    return spec;
+}
@@ -2,31 +2,124 @@
 
 #include "TexUtils.hpp"
 
+#include <set>
+#include <functional>
+
+class CPrefetcher;
+
+// A source held by the caller: the bytes of an encoded file, or decoded pixels
+struct SMemorySource
+{
+    const uint8_t *pData = nullptr;
+    size_t size = 0;
+    const DirectX::Image *pImage = nullptr;
+};
+
+enum TEX_LAYOUT
+{
+    TEX_LAYOUT_SINGLE,
+    TEX_LAYOUT_ARRAY,
+    TEX_LAYOUT_ATLAS
+};
+
+// Virtual-texture output: every mip level is cut into size x size pages with border texels on each side
+struct SPageLayout
+{
+    size_t size = 0;
+    size_t border = 0;
+    bool wrap = true;   // Texels past the level edges wrap around, or clamp to the edge
+
+    size_t GetPaddedSize() const { return size + 2 * border; }
+};
+
 class CTex2DDS
 {
 public:
-    CTex2DDS( SRGB_INPUT srgb, DXGI_FORMAT format, std::vector<ChannelSwizzle> channels, int width, int height, const wchar_t *outputPath ) :
+    typedef std::map<std::wstring, SMemorySource> SourceMap;
+
+    // Receives an output file's contents instead of it being written
+    typedef std::function<HRESULT( const std::wstring &file, const uint8_t *data, size_t size )> OutputCallback;
+
+    CTex2DDS( SRGB_INPUT srgb, DXGI_FORMAT format, std::vector<ChannelSwizzle> channels, int width, int height, const wchar_t *outputPath, bool premultiplyAlpha = false ) :
         m_srgb( srgb ),
         m_format( format ),
         m_channels( channels ),
         m_width( width ),
         m_height( height ),
-        m_szOutoutPath( outputPath )
+        m_szOutoutPath( outputPath ),
+        m_premultiplyAlpha( premultiplyAlpha )
     {
     }
 
     CTex2DDS( nlohmann::json data );
+    CTex2DDS( nlohmann::json data, const CTex2DDS &group, size_t index );
+
+    // Sources already read by pPrefetcher are decoded from memory
+    HRESULT LoadTextures( bool verbose = false, CPrefetcher *pPrefetcher = nullptr );
+    void UnloadTextures();
+
+    // Channel files found in sources are read from there, for this spec and its members
+    void SetSources( std::shared_ptr<const SourceMap> pSources );
+
+    void SetOutputCallback( OutputCallback output ) { m_output = std::move( output ); }
+    const OutputCallback &GetOutputCallback() { return m_output; }
 
-    HRESULT LoadTextures( bool verbose = false );
+    // Upper bound of the image data resident while this spec is loaded and processed, from file headers only
+    uint64_t EstimateMemory();
+    uint64_t EstimateMemory( const DirectX::TexMetadata &predicted );
+
+    // Relative conversion cost of the predicted output. Source-sized resolutions read file headers, so
+    // this fails rather than guessing when they can't be read.
+    HRESULT EstimateCost( uint64_t &cost );
+    uint64_t EstimateCost( const DirectX::TexMetadata &predicted );
+
+    // Top-level output pixels of the spec and its members, resolving source-sized resolutions from headers
+    uint64_t GetOutputPixels();
+
+    // Top-level size of a single texture, resolving source-sized resolutions from headers
+    void GetOutputSize( size_t &width, size_t &height );
+
+    // DDS layout from headers only. AUTO specs predict their BC7 stand-in, the largest candidate.
+    HRESULT PredictOutput( DirectX::TexMetadata &metadata );
+
+    // DDS output, plus the sidecar for groups. Paged specs write the page file and its index instead.
+    std::vector<std::wstring> GetOutputFiles();
+
+    // Every source file read by this spec and its members
+    std::set<std::wstring> GetSourceFiles();
+
+    // Everything that determines the output except paths, with source files replaced by fileId( file )
+    nlohmann::json GetCanonicalSpec( const std::function<std::string( const std::wstring & )> &fileId );
 
     const SRGB_INPUT GetInputSRGB() { return m_srgb; }
     const DXGI_FORMAT GetOutputFormat() { return m_format; }
-    const size_t GetChannelCount() { return m_channels.size(); }
+
+    // As written in the spec
+    const char *GetFormatName();
+
+    // AUTO and AUTO_SRGB specs are packed and mipped for a BC7 stand-in until the pipeline picks their format
+    const bool IsAutoFormat() { return m_autoFormat != DXGI_FORMAT_UNKNOWN; }
+    const DXGI_FORMAT GetAutoFormat() { return m_autoFormat; }
+    const float GetAutoMaxRMSE() { return m_autoMaxRMSE; }
+    void ResolveOutputFormat( DXGI_FORMAT format ) { m_format = format; }
+    const size_t GetChannelCount() { return IsGroup() ? m_members[0]->GetChannelCount() : m_channels.size(); }
     const auto &GetChannelMap() { return m_textureMap; }
     const std::wstring GetOutFile() { return m_szOutoutPath; }
 
     const int GetWidth() { return m_width; }
     const int GetHeight() { return m_height; }
+    const bool GetPremultiplyAlpha() { return m_premultiplyAlpha; }
+    const float GetRDOLambda() { return m_rdoLambda; }
+    const RESIZE_FILTER GetResizeFilter() { return m_resizeFilter; }
+    const MIP_FILTER GetMipFilter() { return m_mipFilter; }
+
+    const TEX_LAYOUT GetLayout() { return m_layout; }
+    const bool IsGroup() { return m_layout != TEX_LAYOUT_SINGLE; }
+    const auto &GetMembers() { return m_members; }
+    const std::string &GetName() { return m_name; }
+    const size_t GetMipLevels() { return m_mipLevels; }
+    const bool IsPaged() { return m_pages.size > 0; }
+    const SPageLayout &GetPages() { return m_pages; }
 
     const std::unique_ptr<DirectX::ScratchImage> &GetTexture( size_t n ) {
         const auto &file = m_channels[n].szFile;
@@ -38,16 +131,36 @@ public:
         return m_textureMap[file.value()];
     }
 
-    const char GetSwizzle( size_t n ) {
-        return m_channels[n].swizzle;
+    const ChannelSwizzle &GetChannel( size_t n ) {
+        return m_channels[n];
     }
 
+    const auto &GetChannels() { return m_channels; }
+
 protected:
+    void ParseChannels( const nlohmann::json &data, const std::string &outputPath );
+    uint64_t EstimateOutputMemory( size_t channelBytes, const DirectX::TexMetadata &predicted );
+
     SRGB_INPUT m_srgb;
     DXGI_FORMAT m_format;
+    DXGI_FORMAT m_autoFormat = DXGI_FORMAT_UNKNOWN;
+    float m_autoMaxRMSE = 0.02f;
     std::vector<ChannelSwizzle> m_channels;
     std::map<std::wstring, std::unique_ptr<DirectX::ScratchImage>> m_textureMap;
     int m_width;
     int m_height;
     std::wstring m_szOutoutPath;
+    bool m_premultiplyAlpha = false;
+    float m_rdoLambda = 0.0f;
+    RESIZE_FILTER m_resizeFilter = RESIZE_FILTER_DEFAULT;
+    MIP_FILTER m_mipFilter = MIP_FILTER_DEFAULT;
+
+    TEX_LAYOUT m_layout = TEX_LAYOUT_SINGLE;
+    std::vector<std::unique_ptr<CTex2DDS>> m_members;
+    std::string m_name;
+    size_t m_mipLevels = 0;
+    SPageLayout m_pages;
+
+    std::shared_ptr<const SourceMap> m_pSources;
+    OutputCallback m_output;
 };
\ No newline at end of file
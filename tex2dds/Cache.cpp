@@ -0,0 +1,159 @@
+#include "pch.h"
+
+#include <iostream>
+
+#include "Cache.hpp"
+#include "Hash.hpp"
+
+using namespace DirectX;
+
+HRESULT CTextureCache::HashSource( const std::wstring &file, std::string &digest )
+{
+    std::error_code ec;
+    auto size = std::filesystem::file_size( file, ec );
+    if ( ec ) return HRESULT_FROM_WIN32( ERROR_FILE_NOT_FOUND );
+    auto time = std::filesystem::last_write_time( file, ec );
+    if ( ec ) return HRESULT_FROM_WIN32( ERROR_FILE_NOT_FOUND );
+
+    {
+        std::lock_guard lock( m_mutex );
+        auto it = m_sources.find( file );
+        if ( it != m_sources.end() && std::get<0>( it->second ) == size && std::get<1>( it->second ) == time ) {
+            digest = std::get<2>( it->second );
+            return 0;
+        }
+    }
+
+    HRESULT hr = HashFile( file, digest );
+    if ( FAILED( hr ) ) return hr;
+
+    std::lock_guard lock( m_mutex );
+    m_sources[file] = { size, time, digest };
+    return 0;
+}
+
+HRESULT CTextureCache::ComputeKey( CTex2DDS &spec, const std::string &options, std::string &key )
+{
+    HRESULT hr = 0;
+
+    {
+        std::lock_guard lock( m_mutex );
+        if ( m_toolDigest.empty() ) {
+            wchar_t path[MAX_PATH];
+            DWORD length = GetModuleFileNameW( nullptr, path, MAX_PATH );
+            if ( length == 0 || length == MAX_PATH ) return HRESULT_FROM_WIN32( GetLastError() );
+
+            hr = HashFile( std::wstring( path, length ), m_toolDigest );
+            if ( FAILED( hr ) ) return hr;
+        }
+    }
+
+    auto canonical = spec.GetCanonicalSpec( [&]( const std::wstring &file ) {
+        std::string digest;
+        HRESULT fileHr = HashSource( file, digest );
+        if ( FAILED( fileHr ) ) {
+            std::wcerr << "Failed to hash source: " << file << std::endl;
+            hr = fileHr;
+        }
+        return digest;
+    } );
+    if ( FAILED( hr ) ) return hr;
+
+    CSHA256 hash;
+    hash.Update( m_toolDigest + "\n" );
+    hash.Update( options + "\n" );
+    hash.Update( canonical.dump() );
+    return hash.Finish( key );
+}
+
+std::filesystem::path CTextureCache::GetEntryPath( const std::string &key )
+{
+    return std::filesystem::path( m_directory ) / key.substr( 0, 2 ) / key;
+}
+
+// Cached copies are named by their position in GetOutputFiles
+std::filesystem::path _EntryFile( const std::filesystem::path &entry, size_t index, const std::wstring &output )
+{
+    return entry / ( std::to_wstring( index ) + std::filesystem::path( output ).extension().wstring() );
+}
+
+HRESULT CTextureCache::Fetch( CTex2DDS &spec, const std::string &options, std::string &key )
+{
+    key.clear();
+
+    // A spec whose key can't be computed is converted and not stored
+    std::string digest;
+    HRESULT hr = ComputeKey( spec, options, digest );
+    if ( FAILED( hr ) ) {
+        ++m_misses;
+        return S_FALSE;
+    }
+    key = digest;
+
+    auto entry = GetEntryPath( key );
+    auto outputs = spec.GetOutputFiles();
+
+    std::error_code ec;
+    if ( !std::filesystem::is_directory( entry, ec ) ) {
+        ++m_misses;
+        return S_FALSE;
+    }
+
+    // CopyFile clones blocks instead of copying data where the volume supports it (ReFS, Dev Drive)
+    for ( size_t i = 0; i < outputs.size(); ++i ) {
+        if ( !CopyFileW( _EntryFile( entry, i, outputs[i] ).wstring().c_str(), outputs[i].c_str(), FALSE ) ) {
+            std::wcerr << "Failed to copy cached output: " << outputs[i] << std::endl;
+            ++m_misses;
+            return S_FALSE;
+        }
+    }
+
+    key.clear();
+    ++m_hits;
+    WProgress() << spec.GetOutFile() << " (cached)" << std::endl;
+    return 0;
+}
+
+HRESULT CTextureCache::Store( CTex2DDS &spec, const std::string &key )
+{
+    auto entry = GetEntryPath( key );
+    auto outputs = spec.GetOutputFiles();
+
+    std::error_code ec;
+    if ( std::filesystem::is_directory( entry, ec ) ) return S_FALSE;
+
+    // Filled under a private name, then renamed, so readers never see a partial entry
+    auto staging = entry;
+    staging += L".tmp" + std::to_wstring( GetCurrentProcessId() ) + L"." + std::to_wstring( GetCurrentThreadId() );
+
+    std::filesystem::create_directories( staging, ec );
+    if ( ec ) {
+        std::cerr << "Failed to create cache entry: " << ec.message() << std::endl;
+        return E_FAIL;
+    }
+
+    for ( size_t i = 0; i < outputs.size(); ++i ) {
+        if ( !CopyFileW( outputs[i].c_str(), _EntryFile( staging, i, outputs[i] ).wstring().c_str(), FALSE ) ) {
+            HRESULT hr = HRESULT_FROM_WIN32( GetLastError() );
+            std::wcerr << "Failed to copy output to cache: " << outputs[i] << std::endl;
+            std::filesystem::remove_all( staging, ec );
+            return hr;
+        }
+    }
+
+    // Losing the race to another store of the same key is fine, both entries have the same content
+    if ( !MoveFileExW( staging.wstring().c_str(), entry.wstring().c_str(), 0 ) ) {
+        std::filesystem::remove_all( staging, ec );
+        return S_FALSE;
+    }
+
+    ++m_stored;
+    return 0;
+}
+
+void CTextureCache::PrintReport()
+{
+    if ( !IsEnabled() ) return;
+
+    std::cerr << "Cache: " << m_hits << " hits, " << m_misses << " misses, " << m_stored << " stored" << std::endl;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <tuple>
+
+#include "CTex2DDS.hpp"
+
+// Content-addressed store of converted outputs, shareable between checkouts and machines through a
+// local or network directory. Entries are keyed by the SHA-256 of the canonical spec, the contents of
+// its sources and the tex2dds executable, so a changed source, spec or tool build never hits.
+class CTextureCache
+{
+public:
+    // An empty directory disables the cache
+    CTextureCache( const std::wstring &directory ) :
+        m_directory( directory )
+    {
+    }
+
+    bool IsEnabled() const { return !m_directory.empty(); }
+
+    // Copies the cached outputs of the spec into place and returns S_OK on a hit, S_FALSE on a miss.
+    // options covers settings outside the spec that change the output. On a miss key is set for Store.
+    HRESULT Fetch( CTex2DDS &spec, const std::string &options, std::string &key );
+
+    // Adds the spec's saved outputs under key. Concurrent stores of the same key keep the first one.
+    HRESULT Store( CTex2DDS &spec, const std::string &key );
+
+    // SHA-256 of everything the outputs depend on, also what the completion journal is keyed by
+    HRESULT ComputeKey( CTex2DDS &spec, const std::string &options, std::string &key );
+
+    void PrintReport();
+    size_t GetHits() const { return m_hits; }
+    size_t GetMisses() const { return m_misses; }
+
+protected:
+    HRESULT HashSource( const std::wstring &file, std::string &digest );
+    std::filesystem::path GetEntryPath( const std::string &key );
+
+    std::wstring m_directory;
+    std::string m_toolDigest;
+
+    // Source digests by path, size and write time, as sources are shared by many specs
+    std::mutex m_mutex;
+    std::map<std::wstring, std::tuple<uintmax_t, std::filesystem::file_time_type, std::string>> m_sources;
+
+    std::atomic<size_t> m_hits = 0;
+    std::atomic<size_t> m_misses = 0;
+    std::atomic<size_t> m_stored = 0;
+};
@@ -0,0 +1,56 @@
+#include "pch.h"
+
+#include <iostream>
+#include <thread>
+#include <omp.h>
+
+#include "Concurrency.hpp"
+
+CConcurrency::CConcurrency( size_t threads, bool affinity ) :
+    m_threads( threads ),
+    m_affinity( affinity )
+{
+    if ( m_threads == 0 ) {
+        m_threads = std::max<size_t>( 1, std::thread::hardware_concurrency() );
+    }
+
+    // Affinity masks cover a single processor group
+    if ( m_affinity && m_threads > sizeof( DWORD_PTR ) * 8 ) {
+        std::cerr << "WARNING! Thread affinity only covers the first " << sizeof( DWORD_PTR ) * 8 << " cores!" << std::endl;
+    }
+}
+
+size_t CConcurrency::GetJobWorkers( size_t jobs ) const
+{
+    return std::clamp<size_t>( jobs, 1, m_threads );
+}
+
+CConcurrency::CJobScope CConcurrency::BeginJob( size_t queuedJobs )
+{
+    size_t active = ++m_activeJobs;
+    size_t sharing = std::min( m_threads, active + queuedJobs );
+    size_t threads = std::max<size_t>( 1, m_threads / std::max<size_t>( 1, sharing ) );
+
+    omp_set_num_threads( int( threads ) );
+
+    return CJobScope( *this, threads );
+}
+
+void CConcurrency::PinWorker( size_t worker, size_t workers ) const
+{
+    if ( !m_affinity || workers == 0 ) return;
+
+    const size_t maxCores = sizeof( DWORD_PTR ) * 8;
+    size_t cores = std::min( m_threads, maxCores );
+    size_t perWorker = std::max<size_t>( 1, cores / workers );
+    size_t first = ( worker * perWorker ) % cores;
+
+    DWORD_PTR mask = 0;
+    for ( size_t i = 0; i < perWorker && first + i < cores; ++i ) {
+        mask |= DWORD_PTR( 1 ) << ( first + i );
+    }
+
+    if ( !SetThreadAffinityMask( GetCurrentThread(), mask ) ) {
+        std::cerr << "WARNING! Failed to set thread affinity for worker " << worker << "!" << std::endl;
+    }
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <atomic>
+#include <algorithm>
+
+// Splits the thread budget between concurrent jobs and the OpenMP teams DirectXTex runs inside each job.
+// Many queued jobs get one thread each, the last few (or a single huge one) get the whole budget.
+class CConcurrency
+{
+public:
+    class CJobScope
+    {
+    public:
+        CJobScope( CConcurrency &concurrency, size_t threads ) :
+            m_concurrency( concurrency ),
+            m_threads( threads )
+        {
+        }
+        CJobScope( const CJobScope & ) = delete;
+        ~CJobScope() { --m_concurrency.m_activeJobs; }
+
+        size_t GetThreads() const { return m_threads; }
+
+    private:
+        CConcurrency &m_concurrency;
+        size_t m_threads;
+    };
+
+    // threads = 0 uses every core
+    CConcurrency( size_t threads = 0, bool affinity = false );
+
+    size_t GetThreads() const { return m_threads; }
+
+    // Number of job-level workers for a queue of jobs
+    size_t GetJobWorkers( size_t jobs ) const;
+
+    // Called on the worker thread as a job starts. Sets the OpenMP team size for this thread from the
+    // jobs running now plus the queued ones that will start while this one runs.
+    CJobScope BeginJob( size_t queuedJobs );
+
+    // Pins worker to its own contiguous group of cores when affinity is enabled
+    void PinWorker( size_t worker, size_t workers ) const;
+
+protected:
+    size_t m_threads;
+    bool m_affinity;
+    std::atomic<size_t> m_activeJobs = 0;
+};
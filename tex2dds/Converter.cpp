@@ -0,0 +1,82 @@
+#include "pch.h"
+
+#include <iostream>
+
+#include "Converter.hpp"
+#include "Pipeline.hpp"
+
+using namespace DirectX;
+
+// WIC needs COM on the calling thread, hosts may or may not have it initialized
+class CComScope
+{
+public:
+    CComScope() : m_hr( CoInitializeEx( nullptr, COINIT_MULTITHREADED ) ) {}
+    ~CComScope() { if ( SUCCEEDED( m_hr ) ) CoUninitialize(); }
+
+    // A thread already in an apartment of the other kind still works
+    HRESULT GetResult() const { return m_hr == RPC_E_CHANGED_MODE ? S_OK : m_hr; }
+
+private:
+    HRESULT m_hr;
+};
+
+HRESULT CConverter::Convert( const nlohmann::json &spec, const CTex2DDS::SourceMap &sources, const CTex2DDS::OutputCallback &output, bool verbose )
+{
+    CComScope com;
+    if ( FAILED( com.GetResult() ) ) {
+        std::cerr << "Failed to init COM library!" << std::endl;
+        return com.GetResult();
+    }
+
+    std::unique_ptr<CTex2DDS> pSpec;
+    try {
+        pSpec = std::make_unique<CTex2DDS>( spec );
+    }
+    catch ( const std::exception &e ) {
+        std::cerr << "Error parsing json: " << e.what() << std::endl;
+        return E_INVALIDARG;
+    }
+
+    pSpec->SetSources( std::make_shared<const CTex2DDS::SourceMap>( sources ) );
+    pSpec->SetOutputCallback( output );
+
+    // Every call has its own batch, and caller-held sources never take the file-streaming tiled path
+    CSmallMipBatch batch( m_backends );
+    CTiledProcessor tiled( m_backends, 0 );
+    CMetrics metrics;
+
+    HRESULT hr = LoadTextures( tiled, *pSpec.get(), verbose );
+    if ( FAILED( hr ) ) {
+        std::cerr << "Failed loading textures!" << std::endl;
+        return hr;
+    }
+
+    hr = ProcessTextures( batch, m_backends, nullptr, tiled, metrics, *pSpec.get(), verbose );
+    if ( FAILED( hr ) ) {
+        std::cerr << "Failed processing textures!" << std::endl;
+        return hr;
+    }
+
+    return batch.Flush();
+}
+
+HRESULT CConverter::Convert( const nlohmann::json &spec, const CTex2DDS::SourceMap &sources, std::vector<uint8_t> &dds, bool verbose )
+{
+    size_t outputs = 0;
+    HRESULT hr = Convert( spec, sources, [&]( const std::wstring &, const uint8_t *data, size_t size ) -> HRESULT {
+        ++outputs;
+        dds.assign( data, data + size );
+        return 0;
+    }, verbose );
+    if ( FAILED( hr ) ) {
+        return hr;
+    }
+
+    if ( outputs != 1 ) {
+        std::cerr << "Only single texture specs convert to one buffer!" << std::endl;
+        return E_INVALIDARG;
+    }
+
+    return 0;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "CTex2DDS.hpp"
+#include "Backend.hpp"
+
+// In-process conversion for hosts that link tex2ddslib instead of running tex2dds.exe. Specs are the
+// same JSON objects the tool reads, their channel files may name caller-held sources, and outputs are
+// handed back instead of written. One converter can be shared by any number of threads.
+class CConverter
+{
+public:
+    // BC6H/BC7 compress on a device of its own, created on first use unless backend is BACKEND_CPU
+    CConverter( BACKEND_KIND backend = BACKEND_DEFAULT ) :
+        m_backends( backend )
+    {
+    }
+
+    // BC6H/BC7 compress on pDevice, which may be shared with the host, or on the CPU when it is null
+    CConverter( ID3D11Device *pDevice ) :
+        m_backends( pDevice )
+    {
+    }
+
+    // Hosts may route formats to their own encoders
+    CBackendRegistry &GetBackends() { return m_backends; }
+
+    // Runs a single texture, array or atlas spec. output receives the DDS, and the sidecar of groups,
+    // under their output_path names.
+    HRESULT Convert( const nlohmann::json &spec, const CTex2DDS::SourceMap &sources, const CTex2DDS::OutputCallback &output, bool verbose = false );
+
+    // Single texture specs, returning the DDS file contents
+    HRESULT Convert( const nlohmann::json &spec, const CTex2DDS::SourceMap &sources, std::vector<uint8_t> &dds, bool verbose = false );
+
+protected:
+    CBackendRegistry m_backends;
+};
@@ -0,0 +1,62 @@
+#include "pch.h"
+
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+
+#include "Hash.hpp"
+
+#pragma comment(lib, "Bcrypt.lib")
+
+CSHA256::CSHA256()
+{
+    m_status = BCryptOpenAlgorithmProvider( &m_hAlgorithm, BCRYPT_SHA256_ALGORITHM, nullptr, 0 );
+    if ( BCRYPT_SUCCESS( m_status ) ) {
+        m_status = BCryptCreateHash( m_hAlgorithm, &m_hHash, nullptr, 0, nullptr, 0, 0 );
+    }
+}
+
+CSHA256::~CSHA256()
+{
+    if ( m_hHash ) BCryptDestroyHash( m_hHash );
+    if ( m_hAlgorithm ) BCryptCloseAlgorithmProvider( m_hAlgorithm, 0 );
+}
+
+void CSHA256::Update( const void *data, size_t size )
+{
+    if ( !BCRYPT_SUCCESS( m_status ) ) return;
+    m_status = BCryptHashData( m_hHash, PUCHAR( data ), ULONG( size ), 0 );
+}
+
+HRESULT CSHA256::Finish( std::string &digest )
+{
+    UCHAR hash[32];
+    if ( BCRYPT_SUCCESS( m_status ) ) {
+        m_status = BCryptFinishHash( m_hHash, hash, sizeof( hash ), 0 );
+    }
+    if ( !BCRYPT_SUCCESS( m_status ) ) return HRESULT_FROM_NT( m_status );
+
+    std::ostringstream hex;
+    for ( auto byte : hash ) {
+        hex << std::hex << std::setw( 2 ) << std::setfill( '0' ) << int( byte );
+    }
+    digest = hex.str();
+
+    return 0;
+}
+
+HRESULT HashFile( const std::wstring &file, std::string &digest )
+{
+    std::ifstream stream( std::filesystem::path( file ), std::ios::binary );
+    if ( !stream ) return HRESULT_FROM_WIN32( ERROR_FILE_NOT_FOUND );
+
+    CSHA256 hash;
+    std::vector<char> buffer( 1 << 20 );
+    while ( stream ) {
+        stream.read( buffer.data(), buffer.size() );
+        hash.Update( buffer.data(), size_t( stream.gcount() ) );
+    }
+    if ( stream.bad() ) return E_FAIL;
+
+    return hash.Finish( digest );
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <bcrypt.h>
+
+// Incremental SHA-256 through CNG
+class CSHA256
+{
+public:
+    CSHA256();
+    ~CSHA256();
+
+    void Update( const void *data, size_t size );
+    void Update( const std::string &data ) { Update( data.data(), data.size() ); }
+
+    // Lowercase hex digest
+    HRESULT Finish( std::string &digest );
+
+protected:
+    BCRYPT_ALG_HANDLE m_hAlgorithm = nullptr;
+    BCRYPT_HASH_HANDLE m_hHash = nullptr;
+    NTSTATUS m_status = 0;
+};
+
+// Lowercase hex SHA-256 of the file's contents
+HRESULT HashFile( const std::wstring &file, std::string &digest );
@@ -0,0 +1,101 @@
+#include "pch.h"
+
+#include <iostream>
+
+#include "Journal.hpp"
+#include "Hash.hpp"
+
+HRESULT CJournal::Open( bool resume )
+{
+    std::error_code ec;
+    bool torn = false;
+
+    if ( resume && std::filesystem::exists( m_path, ec ) ) {
+        std::ifstream file( std::filesystem::path( m_path ), std::ios::in );
+        if ( !file ) {
+            std::wcerr << "Failed to open journal: " << m_path << std::endl;
+            return E_FAIL;
+        }
+
+        // The last line of a killed run may be cut short, it is skipped like any unreadable line
+        std::string line;
+        while ( std::getline( file, line ) ) {
+            torn = file.eof();
+
+            auto entry = nlohmann::json::parse( line, nullptr, false );
+            if ( entry.is_discarded() || !entry.is_object() || !entry["key"].is_string() || !entry["outputs"].is_object() ) continue;
+
+            auto &outputs = m_entries[entry["key"].get<std::string>()];
+            outputs.clear();
+            for ( const auto &[output, digest] : entry["outputs"].items() ) {
+                if ( digest.is_string() ) outputs[output] = digest.get<std::string>();
+            }
+        }
+    }
+
+    m_file.open( std::filesystem::path( m_path ), std::ios::app );
+    if ( !m_file ) {
+        std::wcerr << "Failed to open journal: " << m_path << std::endl;
+        return E_FAIL;
+    }
+
+    // Entries never continue a cut-short line
+    if ( torn ) m_file << std::endl;
+
+    return 0;
+}
+
+bool CJournal::IsComplete( CTex2DDS &spec, const std::string &key )
+{
+    auto it = m_entries.find( key );
+    if ( it == m_entries.end() ) return false;
+
+    auto outputs = spec.GetOutputFiles();
+    if ( outputs.size() != it->second.size() ) return false;
+
+    // Outputs that were edited, truncated or deleted since are converted again
+    for ( const auto &output : outputs ) {
+        auto recorded = it->second.find( std::filesystem::path( output ).string() );
+        if ( recorded == it->second.end() ) return false;
+
+        std::string digest;
+        if ( FAILED( HashFile( output, digest ) ) || digest != recorded->second ) return false;
+    }
+
+    ++m_resumed;
+    WProgress() << spec.GetOutFile() << " (journaled)" << std::endl;
+    return true;
+}
+
+HRESULT CJournal::Record( CTex2DDS &spec, const std::string &key )
+{
+    nlohmann::json entry;
+    entry["key"] = key;
+
+    auto &outputs = entry["outputs"] = nlohmann::json::object();
+    for ( const auto &output : spec.GetOutputFiles() ) {
+        std::string digest;
+        HRESULT hr = HashFile( output, digest );
+        if ( FAILED( hr ) ) {
+            std::wcerr << "Failed to hash output: " << output << std::endl;
+            return hr;
+        }
+
+        outputs[std::filesystem::path( output ).string()] = digest;
+    }
+
+    std::lock_guard lock( m_mutex );
+    m_file << entry.dump() << std::endl;
+    if ( !m_file ) {
+        std::wcerr << "Failed to write journal: " << m_path << std::endl;
+        return E_FAIL;
+    }
+
+    ++m_recorded;
+    return 0;
+}
+
+void CJournal::PrintReport()
+{
+    std::cerr << "Journal: " << m_resumed << " resumed, " << m_recorded << " recorded" << std::endl;
+}
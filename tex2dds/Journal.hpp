@@ -0,0 +1,44 @@
+#pragma once
+
+#include <atomic>
+#include <fstream>
+#include <map>
+#include <mutex>
+
+#include "CTex2DDS.hpp"
+#include "Cache.hpp"
+
+// Append-only record of completed jobs, one JSON line per job: its cache key and the SHA-256 of every output.
+// Lines are flushed as jobs finish, so a run that dies midway leaves an accurate journal to resume from.
+class CJournal
+{
+public:
+    CJournal( const std::wstring &path, CTextureCache &keys ) :
+        m_path( path ),
+        m_keys( keys )
+    {
+    }
+
+    // Reads the entries of earlier runs when resuming, then opens the journal for appending
+    HRESULT Open( bool resume );
+
+    HRESULT ComputeKey( CTex2DDS &spec, const std::string &options, std::string &key ) { return m_keys.ComputeKey( spec, options, key ); }
+
+    // Whether an earlier run completed key and all its outputs still have the recorded contents
+    bool IsComplete( CTex2DDS &spec, const std::string &key );
+
+    // Hashes the saved outputs of spec and appends its entry
+    HRESULT Record( CTex2DDS &spec, const std::string &key );
+
+    void PrintReport();
+
+protected:
+    std::wstring m_path;
+    CTextureCache &m_keys;
+
+    std::mutex m_mutex;
+    std::ofstream m_file;
+    std::map<std::string, std::map<std::string, std::string>> m_entries;
+    std::atomic<size_t> m_resumed = 0;
+    std::atomic<size_t> m_recorded = 0;
+};
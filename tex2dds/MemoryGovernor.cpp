@@ -0,0 +1,126 @@
+#include "pch.h"
+
+#include <iostream>
+#include <charconv>
+#include <psapi.h>
+
+#include "MemoryGovernor.hpp"
+
+#pragma comment( lib, "Psapi.lib" )
+
+CMemoryGovernor::CReservation &CMemoryGovernor::CReservation::operator=( CReservation &&other ) noexcept
+{
+    if ( this != &other ) {
+        Release();
+        m_pGovernor = other.m_pGovernor;
+        m_bytes = other.m_bytes;
+        other.m_pGovernor = nullptr;
+        other.m_bytes = 0;
+    }
+
+    return *this;
+}
+
+void CMemoryGovernor::CReservation::Release()
+{
+    if ( m_pGovernor ) {
+        m_pGovernor->Free( m_bytes );
+        m_pGovernor = nullptr;
+        m_bytes = 0;
+    }
+}
+
+CMemoryGovernor::CReservation CMemoryGovernor::Reserve( uint64_t bytes )
+{
+    std::unique_lock<std::mutex> lock( m_mutex );
+
+    auto ticket = m_nextTicket++;
+    m_released.wait( lock, [&] {
+        if ( ticket != m_servingTicket ) return false;
+        if ( m_budget == 0 || m_inUse == m_fixed ) return true;
+        return m_inUse + bytes <= m_budget;
+    } );
+
+    ++m_servingTicket;
+    m_inUse += bytes;
+    m_peak = std::max( m_peak, m_inUse );
+
+    // The next ticket may already fit
+    m_released.notify_all();
+
+    return CReservation( this, bytes );
+}
+
+bool CMemoryGovernor::TryReserve( uint64_t bytes, CReservation &reservation )
+{
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+
+        if ( m_nextTicket != m_servingTicket ) return false;
+        if ( m_budget > 0 && m_inUse > m_fixed && m_inUse + bytes > m_budget ) return false;
+
+        m_inUse += bytes;
+        m_peak = std::max( m_peak, m_inUse );
+    }
+
+    reservation = CReservation( this, bytes );
+    return true;
+}
+
+void CMemoryGovernor::ReserveFixed( uint64_t bytes )
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+
+    m_inUse += bytes;
+    m_fixed += bytes;
+    m_peak = std::max( m_peak, m_inUse );
+}
+
+void CMemoryGovernor::Free( uint64_t bytes )
+{
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        m_inUse -= bytes;
+    }
+
+    m_released.notify_all();
+}
+
+uint64_t CMemoryGovernor::GetPeak()
+{
+    std::lock_guard<std::mutex> lock( m_mutex );
+    return m_peak;
+}
+
+void CMemoryGovernor::PrintReport()
+{
+    const double mb = 1024.0 * 1024.0;
+
+    std::cerr << "Peak reserved image memory: " << GetPeak() / mb << " MB";
+    if ( m_budget > 0 ) {
+        std::cerr << " of " << m_budget / mb << " MB budget";
+    }
+
+    PROCESS_MEMORY_COUNTERS counters = {};
+    counters.cb = sizeof( counters );
+    if ( GetProcessMemoryInfo( GetCurrentProcess(), &counters, sizeof( counters ) ) ) {
+        std::cerr << ", peak working set: " << counters.PeakWorkingSetSize / mb << " MB";
+    }
+
+    std::cerr << std::endl;
+}
+
+uint64_t ParseByteSize( const std::string &value )
+{
+    uint64_t bytes = 0;
+    auto [end, ec] = std::from_chars( value.data(), value.data() + value.size(), bytes );
+    if ( ec != std::errc() ) return 0;
+
+    std::string suffix( end, value.data() + value.size() );
+    if ( suffix.empty() || suffix == "B" || suffix == "b" ) return bytes;
+    if ( suffix == "K" || suffix == "k" ) return bytes << 10;
+    if ( suffix == "M" || suffix == "m" ) return bytes << 20;
+    if ( suffix == "G" || suffix == "g" ) return bytes << 30;
+
+    return 0;
+}
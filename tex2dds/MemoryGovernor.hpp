@@ -0,0 +1,70 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+
+// Bounds the estimated image data resident across all in-flight jobs.
+// Reservations are granted in request order so a job never starves behind later ones.
+class CMemoryGovernor
+{
+public:
+    class CReservation
+    {
+    public:
+        CReservation() = default;
+        CReservation( CReservation &&other ) noexcept { *this = std::move( other ); }
+        CReservation &operator=( CReservation &&other ) noexcept;
+        ~CReservation() { Release(); }
+
+        void Release();
+        uint64_t GetBytes() const { return m_bytes; }
+
+    private:
+        friend class CMemoryGovernor;
+
+        CReservation( CMemoryGovernor *pGovernor, uint64_t bytes ) :
+            m_pGovernor( pGovernor ),
+            m_bytes( bytes )
+        {
+        }
+
+        CMemoryGovernor *m_pGovernor = nullptr;
+        uint64_t m_bytes = 0;
+    };
+
+    // A budget of 0 disables blocking, usage is still tracked for the peak report
+    CMemoryGovernor( uint64_t budget = 0 ) :
+        m_budget( budget )
+    {
+    }
+
+    // Blocks until bytes fit the budget. A job larger than the whole budget runs alone.
+    CReservation Reserve( uint64_t bytes );
+
+    // Admits without blocking when bytes fit and nobody is queued ahead
+    bool TryReserve( uint64_t bytes, CReservation &reservation );
+
+    // Usage held for the whole run, such as the small-mip batch. It doesn't stop an oversized job from running alone.
+    void ReserveFixed( uint64_t bytes );
+
+    uint64_t GetBudget() const { return m_budget; }
+    uint64_t GetPeak();
+
+    void PrintReport();
+
+protected:
+    void Free( uint64_t bytes );
+
+    uint64_t m_budget;
+    uint64_t m_inUse = 0;
+    uint64_t m_fixed = 0;
+    uint64_t m_peak = 0;
+    uint64_t m_nextTicket = 0;
+    uint64_t m_servingTicket = 0;
+    std::mutex m_mutex;
+    std::condition_variable m_released;
+};
+
+// Parses a byte count with an optional K, M or G suffix, returns 0 if invalid
+uint64_t ParseByteSize( const std::string &value );
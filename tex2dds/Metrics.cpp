@@ -0,0 +1,211 @@
+#include "pch.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <iomanip>
+#include <psapi.h>
+
+#include "Metrics.hpp"
+
+#pragma comment(lib, "Psapi.lib")
+
+using namespace DirectX;
+
+CMetrics::CStageTimer::~CStageTimer()
+{
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - m_start;
+    m_metrics.AddStage( m_stage, elapsed.count(), m_pixels );
+}
+
+void CMetrics::AddStage( const std::string &stage, double seconds, uint64_t pixels )
+{
+    std::lock_guard lock( m_mutex );
+    auto &entry = m_stages[stage];
+    entry.seconds += seconds;
+    entry.pixels += pixels;
+}
+
+void CMetrics::AddJob( CTex2DDS &spec, double seconds, bool cached )
+{
+    // Cached jobs only read their sources to hash them
+    uint64_t bytesRead = 0;
+    if ( !cached ) {
+        for ( const auto &file : spec.GetSourceFiles() ) {
+            std::error_code ec;
+            auto size = std::filesystem::file_size( file, ec );
+            if ( !ec ) bytesRead += size;
+        }
+    }
+
+    SJob job = { spec.GetOutputFiles(), spec.GetOutputFormat(), spec.GetOutputPixels(), seconds, cached };
+
+    std::lock_guard lock( m_mutex );
+    m_jobs.push_back( std::move( job ) );
+    m_bytesRead += bytesRead;
+}
+
+void CMetrics::SetCacheStats( size_t hits, size_t misses )
+{
+    std::lock_guard lock( m_mutex );
+    m_cacheHits = hits;
+    m_cacheMisses = misses;
+}
+
+uint64_t _PeakWorkingSet()
+{
+    PROCESS_MEMORY_COUNTERS counters = {};
+    counters.cb = sizeof( counters );
+    if ( !GetProcessMemoryInfo( GetCurrentProcess(), &counters, sizeof( counters ) ) ) return 0;
+    return counters.PeakWorkingSetSize;
+}
+
+nlohmann::json CMetrics::Summarize()
+{
+    std::lock_guard lock( m_mutex );
+
+    std::chrono::duration<double> wall = std::chrono::steady_clock::now() - m_start;
+
+    nlohmann::json summary;
+    summary["wall_seconds"] = wall.count();
+    summary["jobs"] = m_jobs.size();
+    summary["jobs_per_second"] = wall.count() > 0.0 ? m_jobs.size() / wall.count() : 0.0;
+
+    auto &stages = summary["stages"] = nlohmann::json::object();
+    for ( const auto &[name, stage] : m_stages ) {
+        stages[name] = {
+            { "seconds", stage.seconds },
+            { "megapixels", stage.pixels / 1e6 },
+            { "megapixels_per_second", stage.seconds > 0.0 ? stage.pixels / 1e6 / stage.seconds : 0.0 }
+        };
+    }
+
+    uint64_t bytesWritten = 0;
+    std::map<std::string, std::pair<size_t, double>> formats;
+    for ( const auto &job : m_jobs ) {
+        for ( const auto &file : job.outputs ) {
+            std::error_code ec;
+            auto size = std::filesystem::file_size( file, ec );
+            if ( !ec ) bytesWritten += size;
+        }
+
+        if ( job.cached ) continue;
+
+        auto &format = formats[LookupByValue( job.format, g_pFormats )];
+        ++format.first;
+        format.second += job.seconds;
+    }
+
+    auto &perFormat = summary["formats"] = nlohmann::json::object();
+    for ( const auto &[name, format] : formats ) {
+        perFormat[name] = { { "jobs", format.first }, { "seconds", format.second } };
+    }
+
+    std::vector<const SJob *> slowest;
+    for ( const auto &job : m_jobs ) {
+        if ( !job.cached ) slowest.push_back( &job );
+    }
+    std::sort( slowest.begin(), slowest.end(), []( const SJob *a, const SJob *b ) { return a->seconds > b->seconds; } );
+    slowest.resize( std::min( slowest.size(), m_slowest ) );
+
+    auto &slowestJobs = summary["slowest"] = nlohmann::json::array();
+    for ( const auto *job : slowest ) {
+        slowestJobs.push_back( {
+            { "output", std::filesystem::path( job->outputs[0] ).string() },
+            { "format", LookupByValue( job->format, g_pFormats ) },
+            { "megapixels", job->pixels / 1e6 },
+            { "seconds", job->seconds }
+        } );
+    }
+
+    size_t lookups = m_cacheHits + m_cacheMisses;
+    summary["cache"] = {
+        { "hits", m_cacheHits },
+        { "misses", m_cacheMisses },
+        { "hit_rate", lookups > 0 ? double( m_cacheHits ) / lookups : 0.0 }
+    };
+
+    summary["bytes_read"] = m_bytesRead;
+    summary["bytes_written"] = bytesWritten;
+    summary["peak_rss_bytes"] = _PeakWorkingSet();
+
+    return summary;
+}
+
+// Writes next to path and renames, so collectors never read a partial file
+HRESULT _WriteReplacing( const std::string &path, const std::string &contents )
+{
+    auto staging = path + ".tmp";
+    {
+        std::ofstream file( staging, std::ios::binary | std::ios::trunc );
+        if ( !file ) {
+            std::cerr << "Failed to open metrics file: " << path << std::endl;
+            return E_FAIL;
+        }
+        file << contents;
+        if ( !file.good() ) return E_FAIL;
+    }
+
+    std::error_code ec;
+    std::filesystem::rename( staging, path, ec );
+    if ( ec ) {
+        std::cerr << "Failed to write metrics file: " << path << std::endl;
+        return E_FAIL;
+    }
+
+    return 0;
+}
+
+void _WriteGauge( std::ostringstream &out, const std::string &name, const std::string &help, const std::vector<std::pair<std::string, double>> &samples )
+{
+    out << "# HELP tex2dds_" << name << " " << help << "\n";
+    out << "# TYPE tex2dds_" << name << " gauge\n";
+    for ( const auto &[labels, value] : samples ) {
+        out << "tex2dds_" << name << labels << " " << value << "\n";
+    }
+}
+
+HRESULT CMetrics::Write( const std::string &jsonPath, const std::string &prometheusPath )
+{
+    auto summary = Summarize();
+
+    if ( !jsonPath.empty() ) {
+        HRESULT hr = _WriteReplacing( jsonPath, summary.dump( 4 ) + "\n" );
+        if ( FAILED( hr ) ) return hr;
+    }
+
+    if ( prometheusPath.empty() ) return 0;
+
+    // Gauges describing the last run, for the node_exporter textfile collector
+    std::ostringstream out;
+    out << std::setprecision( 15 );
+    _WriteGauge( out, "last_run_timestamp_seconds", "Unix time the last run finished.",
+        { { "", double( std::chrono::duration_cast<std::chrono::seconds>( std::chrono::system_clock::now().time_since_epoch() ).count() ) } } );
+    _WriteGauge( out, "wall_seconds", "Wall time of the last run.", { { "", summary["wall_seconds"].get<double>() } } );
+    _WriteGauge( out, "jobs", "Jobs converted or fetched from the cache.", { { "", summary["jobs"].get<double>() } } );
+    _WriteGauge( out, "jobs_per_second", "Jobs per second of wall time.", { { "", summary["jobs_per_second"].get<double>() } } );
+
+    std::vector<std::pair<std::string, double>> stageSeconds, stageRates;
+    for ( const auto &[name, stage] : summary["stages"].items() ) {
+        auto labels = "{stage=\"" + name + "\"}";
+        stageSeconds.emplace_back( labels, stage["seconds"].get<double>() );
+        stageRates.emplace_back( labels, stage["megapixels_per_second"].get<double>() );
+    }
+    _WriteGauge( out, "stage_seconds", "Time spent in each stage, summed over workers.", stageSeconds );
+    _WriteGauge( out, "stage_megapixels_per_second", "Output megapixels per second of stage time.", stageRates );
+
+    std::vector<std::pair<std::string, double>> formatSeconds;
+    for ( const auto &[name, format] : summary["formats"].items() ) {
+        formatSeconds.emplace_back( "{format=\"" + name + "\"}", format["seconds"].get<double>() );
+    }
+    _WriteGauge( out, "format_seconds", "Job time per output format, summed over workers.", formatSeconds );
+
+    _WriteGauge( out, "cache_hits", "Specs fetched from the output cache.", { { "", summary["cache"]["hits"].get<double>() } } );
+    _WriteGauge( out, "cache_misses", "Specs converted after a cache lookup.", { { "", summary["cache"]["misses"].get<double>() } } );
+    _WriteGauge( out, "bytes_read", "Source bytes of converted specs.", { { "", summary["bytes_read"].get<double>() } } );
+    _WriteGauge( out, "bytes_written", "Output bytes of all specs.", { { "", summary["bytes_written"].get<double>() } } );
+    _WriteGauge( out, "peak_rss_bytes", "Peak working set of the process.", { { "", summary["peak_rss_bytes"].get<double>() } } );
+
+    return _WriteReplacing( prometheusPath, out.str() );
+}
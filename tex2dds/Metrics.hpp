@@ -0,0 +1,78 @@
+#pragma once
+
+#include <chrono>
+#include <mutex>
+
+#include "CTex2DDS.hpp"
+
+// Aggregates per-stage and per-job timings of a run and exports them as JSON and as a Prometheus textfile
+class CMetrics
+{
+public:
+    // Adds the elapsed time and the pixels it covered to a stage when it goes out of scope
+    class CStageTimer
+    {
+    public:
+        CStageTimer( CMetrics &metrics, const char *stage, uint64_t pixels = 0 ) :
+            m_metrics( metrics ),
+            m_stage( stage ),
+            m_pixels( pixels ),
+            m_start( std::chrono::steady_clock::now() )
+        {
+        }
+
+        ~CStageTimer();
+
+        void SetPixels( uint64_t pixels ) { m_pixels = pixels; }
+
+    private:
+        CMetrics &m_metrics;
+        const char *m_stage;
+        uint64_t m_pixels;
+        std::chrono::steady_clock::time_point m_start;
+    };
+
+    CMetrics( size_t slowest = 10 ) :
+        m_slowest( slowest ),
+        m_start( std::chrono::steady_clock::now() )
+    {
+    }
+
+    void AddStage( const std::string &stage, double seconds, uint64_t pixels );
+
+    // A converted or cache-fetched job, from taking it off the queue until ProcessTextures returned
+    void AddJob( CTex2DDS &spec, double seconds, bool cached );
+
+    void SetCacheStats( size_t hits, size_t misses );
+
+    // Either path may be empty. Outputs are measured here, once the batch has saved them.
+    HRESULT Write( const std::string &jsonPath, const std::string &prometheusPath );
+
+protected:
+    struct SStage
+    {
+        double seconds = 0.0;
+        uint64_t pixels = 0;
+    };
+
+    struct SJob
+    {
+        std::vector<std::wstring> outputs;
+        DXGI_FORMAT format;
+        uint64_t pixels;
+        double seconds;
+        bool cached;
+    };
+
+    nlohmann::json Summarize();
+
+    size_t m_slowest;
+    std::chrono::steady_clock::time_point m_start;
+
+    std::mutex m_mutex;
+    std::map<std::string, SStage> m_stages;
+    std::vector<SJob> m_jobs;
+    uint64_t m_bytesRead = 0;
+    size_t m_cacheHits = 0;
+    size_t m_cacheMisses = 0;
+};
@@ -0,0 +1,197 @@
+#include "pch.h"
+
+#include <iostream>
+
+#include "MipBatch.hpp"
+
+using namespace DirectX;
+
+// Copies src to (x, y) and fills the rest of its 4x4-aligned footprint by wrapping, like a partial block
+void _BlitPadded( const Image &src, const Image &dst, size_t x, size_t y )
+{
+    auto bytesPerPixel = BitsPerPixel( src.format ) / 8;
+    size_t paddedWidth = ( src.width + 3 ) / 4 * 4;
+    size_t paddedHeight = ( src.height + 3 ) / 4 * 4;
+
+    for ( size_t py = 0; py < paddedHeight; ++py ) {
+        auto srcRow = src.pixels + ( py % src.height ) * src.rowPitch;
+        auto dstRow = dst.pixels + ( y + py ) * dst.rowPitch + x * bytesPerPixel;
+
+        for ( size_t px = 0; px < paddedWidth; ++px ) {
+            memcpy( dstRow + px * bytesPerPixel, srcRow + ( px % src.width ) * bytesPerPixel, bytesPerPixel );
+        }
+    }
+}
+
+HRESULT CSmallMipBatch::Compress( DXGI_FORMAT format, std::unique_ptr<ScratchImage> &pMipMapImage, FinishCallback finish )
+{
+    const auto mdata = pMipMapImage->GetMetadata();
+
+    SPendingTexture pending;
+    pending.finish = finish;
+    pending.pCompressedImage = std::make_unique<ScratchImage>();
+
+    auto cdata = mdata;
+    cdata.format = format;
+    HRESULT hr = pending.pCompressedImage->Initialize( cdata );
+    if ( FAILED( hr ) ) {
+        std::cerr << "Could not create compressed image!" << std::endl;
+        return hr;
+    }
+
+    // Large levels of each array item are contiguous, so they go through a single Compress call per item
+    size_t largeLevels = 0;
+    while ( largeLevels < mdata.mipLevels ) {
+        const auto *pImage = pMipMapImage->GetImage( largeLevels, 0, 0 );
+        if ( std::max( pImage->width, pImage->height ) < SMALL_MIP_SIZE ) break;
+        ++largeLevels;
+    }
+
+    if ( largeLevels > 0 ) {
+        auto ldata = mdata;
+        ldata.arraySize = 1;
+        ldata.mipLevels = largeLevels;
+
+        for ( size_t item = 0; item < mdata.arraySize; ++item ) {
+            auto index = mdata.ComputeIndex( 0, item, 0 );
+
+            ScratchImage compressed;
+            hr = m_backends.Compress( format, pMipMapImage->GetImages() + index, largeLevels, ldata, compressed );
+            if ( FAILED( hr ) ) {
+                return hr;
+            }
+
+            memcpy( pending.pCompressedImage->GetImages()[index].pixels, compressed.GetPixels(), compressed.GetPixelsSize() );
+        }
+    }
+
+    size_t blocks = 0;
+    for ( size_t item = 0; item < mdata.arraySize; ++item ) {
+        for ( size_t mip = largeLevels; mip < mdata.mipLevels; ++mip ) {
+            auto index = mdata.ComputeIndex( mip, item, 0 );
+            const auto &image = pMipMapImage->GetImages()[index];
+
+            auto &source = pending.sources.emplace_back( std::make_unique<ScratchImage>() );
+            hr = source->InitializeFromImage( image );
+            if ( FAILED( hr ) ) {
+                return hr;
+            }
+
+            pending.imageIndices.push_back( index );
+            blocks += ( ( image.width + 3 ) / 4 ) * ( ( image.height + 3 ) / 4 );
+        }
+    }
+
+    // The full-size chain isn't needed past this point
+    pMipMapImage.reset();
+
+    if ( pending.sources.empty() ) {
+        return pending.finish( pending.pCompressedImage );
+    }
+
+    GroupKey key = { format, mdata.format };
+    SPendingGroup flushGroup;
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+
+        auto &group = m_groups[key];
+        group.bytes += pending.pCompressedImage->GetPixelsSize();
+        group.textures.emplace_back( std::move( pending ) );
+        group.blocks += blocks;
+
+        if ( group.blocks < m_maxBlocks && group.bytes < m_maxPendingBytes ) {
+            return 0;
+        }
+
+        flushGroup = std::move( group );
+        m_groups.erase( key );
+    }
+
+    return FlushGroup( key, flushGroup );
+}
+
+HRESULT CSmallMipBatch::Flush()
+{
+    std::map<GroupKey, SPendingGroup> groups;
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        groups.swap( m_groups );
+    }
+
+    HRESULT result = 0;
+    for ( auto &[key, group] : groups ) {
+        HRESULT hr = FlushGroup( key, group );
+        if ( FAILED( hr ) && SUCCEEDED( result ) ) result = hr;
+    }
+
+    return result;
+}
+
+HRESULT CSmallMipBatch::FlushGroup( GroupKey key, SPendingGroup &group )
+{
+    auto [format, sourceFormat] = key;
+
+    // Lay every queued mip out on one block-aligned sheet
+    std::vector<std::pair<size_t, size_t>> sizes;
+    for ( const auto &texture : group.textures ) {
+        for ( const auto &source : texture.sources ) {
+            sizes.emplace_back( source->GetMetadata().width, source->GetMetadata().height );
+        }
+    }
+
+    size_t width, height;
+    std::vector<std::pair<size_t, size_t>> offsets;
+    PackAtlasRects( sizes, 4, width, height, offsets );
+
+    ScratchImage sheet;
+    HRESULT hr = sheet.Initialize2D( sourceFormat, width, height, 1, 1 );
+    if ( FAILED( hr ) ) {
+        std::cerr << "Could not create small mip sheet!" << std::endl;
+        return hr;
+    }
+    memset( sheet.GetPixels(), 0, sheet.GetPixelsSize() );
+
+    size_t n = 0;
+    for ( const auto &texture : group.textures ) {
+        for ( const auto &source : texture.sources ) {
+            _BlitPadded( *source->GetImages(), *sheet.GetImages(), offsets[n].first, offsets[n].second );
+            ++n;
+        }
+    }
+
+    // One parallel sweep over every small block in the batch
+    ScratchImage compressedSheet;
+    hr = m_backends.Compress( format, sheet.GetImages(), 1, sheet.GetMetadata(), compressedSheet );
+    if ( FAILED( hr ) ) {
+        std::cerr << "Failed to compress small mip sheet!" << std::endl;
+        return hr;
+    }
+
+    // Scatter the blocks back into each texture
+    auto blockBytes = BitsPerPixel( format ) * 16 / 8;
+    const auto &compressed = *compressedSheet.GetImages();
+
+    n = 0;
+    for ( auto &texture : group.textures ) {
+        for ( auto index : texture.imageIndices ) {
+            const auto &dst = texture.pCompressedImage->GetImages()[index];
+            size_t blocksWide = ( dst.width + 3 ) / 4;
+            size_t blocksHigh = ( dst.height + 3 ) / 4;
+            size_t blockX = offsets[n].first / 4;
+            size_t blockY = offsets[n].second / 4;
+
+            for ( size_t by = 0; by < blocksHigh; ++by ) {
+                memcpy( dst.pixels + by * dst.rowPitch, compressed.pixels + ( blockY + by ) * compressed.rowPitch + blockX * blockBytes, blocksWide * blockBytes );
+            }
+            ++n;
+        }
+    }
+
+    HRESULT result = 0;
+    for ( auto &texture : group.textures ) {
+        hr = texture.finish( texture.pCompressedImage );
+        if ( FAILED( hr ) && SUCCEEDED( result ) ) result = hr;
+    }
+
+    return result;
+}
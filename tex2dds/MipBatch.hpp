@@ -0,0 +1,56 @@
+#pragma once
+
+#include "Backend.hpp"
+
+#include <functional>
+#include <mutex>
+
+// Mips smaller than this on both axes are deferred and compressed together with those of other textures
+constexpr size_t SMALL_MIP_SIZE = 64;
+
+class CSmallMipBatch
+{
+public:
+    typedef std::function<HRESULT( std::unique_ptr<DirectX::ScratchImage> &pCompressedImage )> FinishCallback;
+
+    // A group is flushed once it queues maxBlocks small-mip blocks or holds maxPendingBytes of compressed large levels
+    CSmallMipBatch( CBackendRegistry &backends, size_t maxBlocks = 16384, size_t maxPendingBytes = 256 << 20 ) :
+        m_backends( backends ),
+        m_maxBlocks( maxBlocks ),
+        m_maxPendingBytes( maxPendingBytes )
+    {
+    }
+
+    // Compresses the large levels now and queues the small ones. finish runs once every level is compressed,
+    // which may be during a later Compress or Flush call.
+    HRESULT Compress( DXGI_FORMAT format, std::unique_ptr<DirectX::ScratchImage> &pMipMapImage, FinishCallback finish );
+
+    HRESULT Flush();
+
+protected:
+    struct SPendingTexture
+    {
+        std::unique_ptr<DirectX::ScratchImage> pCompressedImage;
+        std::vector<size_t> imageIndices;
+        std::vector<std::unique_ptr<DirectX::ScratchImage>> sources;
+        FinishCallback finish;
+    };
+
+    struct SPendingGroup
+    {
+        std::vector<SPendingTexture> textures;
+        size_t blocks = 0;
+        size_t bytes = 0;
+    };
+
+    // Keyed by compressed format and uncompressed source format
+    typedef std::pair<DXGI_FORMAT, DXGI_FORMAT> GroupKey;
+
+    HRESULT FlushGroup( GroupKey key, SPendingGroup &group );
+
+    CBackendRegistry &m_backends;
+    size_t m_maxBlocks;
+    size_t m_maxPendingBytes;
+    std::mutex m_mutex;
+    std::map<GroupKey, SPendingGroup> m_groups;
+};
@@ -0,0 +1,212 @@
+#include "pch.h"
+
+#include <iostream>
+#include <fstream>
+
+#include "Pages.hpp"
+
+using namespace DirectX;
+
+// Pages are cut and compressed this many rows at a time, which also keeps GPU batches within the texture size limit
+constexpr size_t PAGE_CHUNK_ROWS = 16384;
+
+size_t ComputePageLevels( const TexMetadata &metadata, const SPageLayout &pages, std::vector<SPageLevel> &levels )
+{
+    levels.clear();
+
+    size_t count = 0;
+    for ( size_t mip = 0; mip < metadata.mipLevels; ++mip ) {
+        SPageLevel level;
+        level.width = std::max<size_t>( metadata.width >> mip, 1 );
+        level.height = std::max<size_t>( metadata.height >> mip, 1 );
+        level.pagesX = ( level.width + pages.size - 1 ) / pages.size;
+        level.pagesY = ( level.height + pages.size - 1 ) / pages.size;
+        level.firstPage = count;
+
+        count += level.pagesX * level.pagesY;
+        levels.push_back( level );
+    }
+
+    return count;
+}
+
+uint64_t ComputePagedPixels( const TexMetadata &metadata, const SPageLayout &pages )
+{
+    std::vector<SPageLevel> levels;
+    uint64_t padded = pages.GetPaddedSize();
+    return ComputePageLevels( metadata, pages, levels ) * padded * padded * metadata.arraySize;
+}
+
+size_t ComputePageBytes( DXGI_FORMAT format, const SPageLayout &pages )
+{
+    size_t blocks = pages.GetPaddedSize() / 4;
+    return blocks * blocks * BitsPerPixel( format ) * 16 / 8;
+}
+
+ptrdiff_t _AddressTexel( ptrdiff_t v, size_t size, bool wrap )
+{
+    if ( wrap ) return ( v % ptrdiff_t( size ) + ptrdiff_t( size ) ) % ptrdiff_t( size );
+    return std::clamp<ptrdiff_t>( v, 0, ptrdiff_t( size ) - 1 );
+}
+
+// Copies the page with its border to rows [y, y + padded) of the chunk image
+void _CutPage( const Image &level, const SPageLayout &pages, size_t pageX, size_t pageY, const Image &chunk, size_t y )
+{
+    auto bytesPerPixel = BitsPerPixel( level.format ) / 8;
+    auto padded = pages.GetPaddedSize();
+    ptrdiff_t x0 = ptrdiff_t( pageX * pages.size ) - ptrdiff_t( pages.border );
+    ptrdiff_t y0 = ptrdiff_t( pageY * pages.size ) - ptrdiff_t( pages.border );
+
+    // Texels inside the level are one run per row, only the border and overhang are addressed one by one
+    size_t first = size_t( std::clamp<ptrdiff_t>( -x0, 0, ptrdiff_t( padded ) ) );
+    size_t last = size_t( std::clamp<ptrdiff_t>( ptrdiff_t( level.width ) - x0, ptrdiff_t( first ), ptrdiff_t( padded ) ) );
+
+    for ( size_t py = 0; py < padded; ++py ) {
+        auto srcRow = level.pixels + _AddressTexel( y0 + ptrdiff_t( py ), level.height, pages.wrap ) * level.rowPitch;
+        auto dstRow = chunk.pixels + ( y + py ) * chunk.rowPitch;
+
+        if ( last > first ) {
+            memcpy( dstRow + first * bytesPerPixel, srcRow + ( x0 + ptrdiff_t( first ) ) * bytesPerPixel, ( last - first ) * bytesPerPixel );
+        }
+
+        for ( size_t px = 0; px < padded; ++px ) {
+            if ( px >= first && px < last ) continue;
+            memcpy( dstRow + px * bytesPerPixel, srcRow + _AddressTexel( x0 + ptrdiff_t( px ), level.width, pages.wrap ) * bytesPerPixel, bytesPerPixel );
+        }
+    }
+}
+
+HRESULT _WritePageIndex( CTex2DDS &spec, DXGI_FORMAT format, const std::vector<SPageLevel> &levels, size_t pageCount, size_t pageBytes )
+{
+    const auto &pages = spec.GetPages();
+    auto outFile = std::filesystem::path( spec.GetOutFile() );
+
+    nlohmann::json index;
+    index["pages"] = outFile.filename().string();
+    index["format"] = LookupByValue( format, g_pFormats );
+    index["width"] = levels[0].width;
+    index["height"] = levels[0].height;
+    index["mip_levels"] = levels.size();
+    index["page_size"] = pages.size;
+    index["border"] = pages.border;
+    index["address"] = pages.wrap ? "wrap" : "clamp";
+    index["page_bytes"] = pageBytes;
+    index["page_count"] = pageCount;
+
+    // Page n of the file starts at n * page_bytes
+    auto &entries = index["levels"] = nlohmann::json::array();
+    for ( const auto &level : levels ) {
+        entries.push_back( {
+            { "width", level.width },
+            { "height", level.height },
+            { "pages_x", level.pagesX },
+            { "pages_y", level.pagesY },
+            { "first_page", level.firstPage }
+        } );
+    }
+
+    const auto &output = spec.GetOutputCallback();
+    if ( output ) {
+        auto contents = index.dump( 4 ) + "\n";
+        return output( outFile.replace_extension( ".json" ).wstring(), reinterpret_cast<const uint8_t *>( contents.data() ), contents.size() );
+    }
+
+    std::ofstream file( outFile.replace_extension( ".json" ) );
+    if ( !file ) {
+        std::cerr << "Failed to open page index file!" << std::endl;
+        return E_FAIL;
+    }
+
+    file << index.dump( 4 ) << std::endl;
+    return 0;
+}
+
+HRESULT WritePages( CBackendRegistry &backends, CTex2DDS &spec, DXGI_FORMAT format, const ScratchImage &mipChain )
+{
+    const auto &pages = spec.GetPages();
+    const auto &mdata = mipChain.GetMetadata();
+
+    std::vector<SPageLevel> levels;
+    size_t pageCount = ComputePageLevels( mdata, pages, levels );
+    size_t pageBytes = ComputePageBytes( format, pages );
+    size_t padded = pages.GetPaddedSize();
+
+    // Every page in file order, as ( level, x, y )
+    std::vector<std::tuple<size_t, size_t, size_t>> order;
+    order.reserve( pageCount );
+    for ( size_t mip = 0; mip < levels.size(); ++mip ) {
+        for ( size_t y = 0; y < levels[mip].pagesY; ++y ) {
+            for ( size_t x = 0; x < levels[mip].pagesX; ++x ) {
+                order.emplace_back( mip, x, y );
+            }
+        }
+    }
+
+    const auto &output = spec.GetOutputCallback();
+    std::vector<uint8_t> contents;
+    std::ofstream file;
+    if ( output ) {
+        contents.reserve( pageCount * pageBytes );
+    }
+    else {
+        file.open( std::filesystem::path( spec.GetOutFile() ), std::ios::binary | std::ios::trunc );
+        if ( !file ) {
+            std::cerr << "Failed to open page file!" << std::endl;
+            return E_FAIL;
+        }
+    }
+
+    Progress() << "Compressing " << pageCount << " pages..." << std::endl;
+
+    // Pages are stacked into one column per chunk. They are whole blocks, so each compresses on its own,
+    // and the compressed column is already the pages in file order.
+    size_t chunkPages = std::max<size_t>( 1, PAGE_CHUNK_ROWS / padded );
+    for ( size_t first = 0; first < pageCount; first += chunkPages ) {
+        size_t count = std::min( chunkPages, pageCount - first );
+
+        ScratchImage chunk;
+        HRESULT hr = chunk.Initialize2D( mdata.format, padded, padded * count, 1, 1 );
+        if ( FAILED( hr ) ) {
+            std::cerr << "Could not create page image!" << std::endl;
+            return hr;
+        }
+
+        #pragma omp parallel for schedule( dynamic )
+        for ( int i = 0; i < int( count ); ++i ) {
+            auto [mip, x, y] = order[first + i];
+            _CutPage( *mipChain.GetImage( mip, 0, 0 ), pages, x, y, *chunk.GetImages(), i * padded );
+        }
+
+        ScratchImage compressed;
+        hr = backends.Compress( format, chunk.GetImages(), 1, chunk.GetMetadata(), compressed );
+        if ( FAILED( hr ) ) {
+            std::cerr << "Failed to compress pages!" << std::endl;
+            return hr;
+        }
+
+        auto pPixels = compressed.GetPixels();
+        if ( output ) {
+            contents.insert( contents.end(), pPixels, pPixels + count * pageBytes );
+        }
+        else if ( !file.write( reinterpret_cast<const char *>( pPixels ), count * pageBytes ) ) {
+            std::cerr << "Failed to write page file!" << std::endl;
+            return E_FAIL;
+        }
+    }
+
+    if ( output ) {
+        HRESULT hr = output( spec.GetOutFile(), contents.data(), contents.size() );
+        if ( FAILED( hr ) ) {
+            return hr;
+        }
+    }
+    else {
+        file.close();
+        if ( !file ) {
+            std::cerr << "Failed to write page file!" << std::endl;
+            return E_FAIL;
+        }
+    }
+
+    return _WritePageIndex( spec, format, levels, pageCount, pageBytes );
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "CTex2DDS.hpp"
+#include "Backend.hpp"
+
+// Pages of one mip level, numbered row by row from firstPage
+struct SPageLevel
+{
+    size_t width;
+    size_t height;
+    size_t pagesX;
+    size_t pagesY;
+    size_t firstPage;
+};
+
+// Every level of the chain described by metadata in page file order. Returns the total page count.
+size_t ComputePageLevels( const DirectX::TexMetadata &metadata, const SPageLayout &pages, std::vector<SPageLevel> &levels );
+
+// Texels of every padded page of the chain described by metadata, borders included
+uint64_t ComputePagedPixels( const DirectX::TexMetadata &metadata, const SPageLayout &pages );
+
+// Size of one compressed page, the stride of the page file
+size_t ComputePageBytes( DXGI_FORMAT format, const SPageLayout &pages );
+
+// Cuts every level of mipChain into the spec's padded pages, compresses them as independent images and
+// writes them back to back to the page file, with a JSON index next to it
+HRESULT WritePages( CBackendRegistry &backends, CTex2DDS &spec, DXGI_FORMAT format, const DirectX::ScratchImage &mipChain );
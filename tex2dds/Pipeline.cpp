@@ -0,0 +1,570 @@
+#include "pch.h"
+
+#include <iostream>
+#include <filesystem>
+#include <fstream>
+
+#include "Pipeline.hpp"
+#include "AutoFormat.hpp"
+#include "Pages.hpp"
+
+using namespace DirectX;
+
+HRESULT LoadTextures( CTiledProcessor &tiled, CTex2DDS &spec, bool verbose, CPrefetcher *pPrefetcher )
+{
+    WProgress() << spec.GetOutFile() << std::endl;
+
+    // Tiled specs never hold their sources, they are read band by band while processing
+    if ( tiled.Accepts( spec ) ) return 0;
+
+    return spec.LoadTextures( verbose, pPrefetcher );
+}
+
+HRESULT PackTextures( CTex2DDS &spec, std::unique_ptr<ScratchImage> &pCombinerImage, bool verbose = false )
+{
+    HRESULT hr;
+
+    auto channels = spec.GetChannelCount();
+    auto formatOut = spec.GetOutputFormat();
+
+
+    // Common layouts pack straight from the sources with a specialized kernel
+    std::vector<const ScratchImage *> sources;
+    sources.reserve( channels );
+    for ( size_t i = 0; i < channels; ++i ) {
+        sources.push_back( spec.GetTexture( i ).get() );
+    }
+
+    Progress() << "Packing channels..." << std::endl;
+    hr = PackChannels( sources, spec.GetChannels(), formatOut, spec.GetPremultiplyAlpha(), pCombinerImage, verbose );
+    if ( FAILED( hr ) ) {
+        std::cerr << "Failed to pack channels!" << std::endl;
+        return hr;
+    }
+    if ( hr == S_OK ) {
+        return 0;
+    }
+
+
+    // Split into red, green, blue and alpha
+    Progress() << "Extracting channels..." << std::endl;
+    std::vector<std::unique_ptr<ScratchImage>> slices;
+    slices.reserve( channels );
+    for ( size_t i = 0; i < channels; ++i ) {
+        auto &slice = slices.emplace_back( std::make_unique<ScratchImage>() );
+        hr = ExtractChannel( spec.GetTexture( i ), spec.GetChannel( i ), IsSRGB( formatOut ), slice );
+        if ( FAILED( hr ) ) {
+            std::cerr << "Failed to split channels!" << std::endl;
+            return hr;
+        }
+    }
+    // Split channels done
+
+
+    // Get slices and combine image
+    Progress() << "Combining channels..." << std::endl;
+    hr = CombineChannelSlices( slices, formatOut, spec.GetPremultiplyAlpha(), pCombinerImage, verbose );
+    if ( FAILED( hr ) ) {
+        std::cerr << "Failed to combine channel slices!" << std::endl;
+        return hr;
+    }
+    // Combine done (PMA is fused into the combine pass)
+
+    return 0;
+}
+
+HRESULT VerifyTextures( CTex2DDS &spec, std::unique_ptr<ScratchImage> &pMipMapImage, std::unique_ptr<ScratchImage> &pCompressedImage )
+{
+    HRESULT hr;
+
+    auto channels = spec.GetChannelCount();
+
+    // Decompression sanity check
+    auto pDecompressedImage = std::make_unique<ScratchImage>();
+    hr = Decompress( pCompressedImage->GetImages(), pCompressedImage->GetImageCount(), pCompressedImage->GetMetadata(), pMipMapImage->GetMetadata().format, *pDecompressedImage.get() );
+    if FAILED( hr ) {
+        std::cerr << "Failed to decompress texture for mip testing!" << std::endl;
+        return hr;
+    }
+
+    auto mips = pDecompressedImage->GetMetadata().mipLevels;
+
+    Progress() << "Last decompressed MIP channel values:";
+    for ( int i = 0; i < channels; ++i ) {
+        Progress() << " " << int( pDecompressedImage->GetImage( mips - 1, 0, 0 )->pixels[i] );
+    }
+    Progress() << std::endl;
+
+    PrintDebugMetadata( "Final", pCompressedImage->GetMetadata() );
+
+    float mse;
+    ComputeMSE( *pCompressedImage->GetImage( 0, 0, 0 ), *pMipMapImage->GetImage( 0, 0, 0 ), mse, nullptr );
+    Progress() << "RMSE = " << std::sqrt( mse / spec.GetChannelCount() ) << std::endl;
+
+    return 0;
+}
+
+HRESULT SaveTextures( CTex2DDS &spec, std::unique_ptr<ScratchImage> &pCompressedImage )
+{
+    Progress() << "Saving texture..." << std::endl;
+
+    const auto &output = spec.GetOutputCallback();
+    if ( output ) {
+        Blob blob;
+        HRESULT hr = SaveToDDSMemory( pCompressedImage->GetImages(), pCompressedImage->GetImageCount(), pCompressedImage->GetMetadata(), DDS_FLAGS_NONE, blob );
+        if ( FAILED( hr ) ) {
+            std::cerr << "Failed to save texture to memory!" << std::endl;
+            return hr;
+        }
+
+        return output( spec.GetOutFile(), static_cast<const uint8_t *>( blob.GetBufferPointer() ), blob.GetBufferSize() );
+    }
+
+    HRESULT hr = SaveToDDSFile( pCompressedImage->GetImages(), pCompressedImage->GetImageCount(), pCompressedImage->GetMetadata(), DDS_FLAGS_NONE, spec.GetOutFile().c_str() );
+    if FAILED( hr ) {
+        std::cerr << "Failed to save file!" << std::endl;
+        return hr;
+    }
+
+    return 0;
+}
+
+// Writes the group sidecar for the saved DDS, whose metadata it is given
+typedef std::function<HRESULT( const TexMetadata & )> SidecarWriter;
+
+HRESULT WriteGroupSidecar( CTex2DDS &spec, const TexMetadata &metadata, const std::vector<std::pair<size_t, size_t>> &offsets, const std::vector<std::pair<size_t, size_t>> &sizes )
+{
+    auto outFile = std::filesystem::path( spec.GetOutFile() );
+
+    nlohmann::json sidecar;
+    sidecar["texture"] = outFile.filename().string();
+    sidecar["type"] = spec.GetLayout() == TEX_LAYOUT_ARRAY ? "array" : "atlas";
+    sidecar["width"] = metadata.width;
+    sidecar["height"] = metadata.height;
+    sidecar["format"] = LookupByValue( metadata.format, g_pFormats );
+    sidecar["mip_levels"] = metadata.mipLevels;
+
+    auto &entries = sidecar["members"] = nlohmann::json::object();
+    const auto &members = spec.GetMembers();
+    for ( size_t i = 0; i < members.size(); ++i ) {
+        auto &entry = entries[members[i]->GetName()];
+
+        if ( spec.GetLayout() == TEX_LAYOUT_ARRAY ) {
+            entry["slice"] = i;
+            continue;
+        }
+
+        auto [x, y] = offsets[i];
+        auto [w, h] = sizes[i];
+        entry["x"] = x;
+        entry["y"] = y;
+        entry["width"] = w;
+        entry["height"] = h;
+        entry["uv"] = {
+            float( x ) / metadata.width,
+            float( y ) / metadata.height,
+            float( x + w ) / metadata.width,
+            float( y + h ) / metadata.height
+        };
+    }
+
+    const auto &output = spec.GetOutputCallback();
+    if ( output ) {
+        auto contents = sidecar.dump( 4 ) + "\n";
+        return output( outFile.replace_extension( ".json" ).wstring(), reinterpret_cast<const uint8_t *>( contents.data() ), contents.size() );
+    }
+
+    std::ofstream file( outFile.replace_extension( ".json" ) );
+    if ( !file ) {
+        std::cerr << "Failed to open sidecar file!" << std::endl;
+        return E_FAIL;
+    }
+
+    file << sidecar.dump( 4 ) << std::endl;
+    return 0;
+}
+
+// Runs fn for every member, in parallel unless verbose
+template<typename F>
+HRESULT ForEachMember( CTex2DDS &spec, bool verbose, F fn )
+{
+    const auto &members = spec.GetMembers();
+
+    if ( verbose ) {
+        for ( size_t i = 0; i < members.size(); ++i ) {
+            HRESULT hr = fn( i, *members[i].get() );
+            if ( FAILED( hr ) ) return hr;
+        }
+        return 0;
+    }
+
+    // Members share the OpenMP team this job was given, rather than a thread each
+    std::vector<HRESULT> results( members.size(), 0 );
+    #pragma omp parallel for schedule( dynamic )
+    for ( int i = 0; i < int( members.size() ); ++i ) {
+        // Exceptions can't leave the parallel region, so they become the member's result
+        try {
+            results[i] = fn( size_t( i ), *members[i].get() );
+        }
+        catch ( const std::bad_alloc & ) {
+            std::wcerr << "Out of memory building member: " << members[i]->GetOutFile() << std::endl;
+            results[i] = E_OUTOFMEMORY;
+        }
+        catch ( const std::exception &e ) {
+            std::cerr << e.what() << std::endl;
+            results[i] = E_FAIL;
+        }
+    }
+
+    for ( HRESULT hr : results ) {
+        if ( FAILED( hr ) ) return hr;
+    }
+
+    return 0;
+}
+
+// Packs and mips one array member
+HRESULT _BuildArraySlice( CTex2DDS &member, std::unique_ptr<ScratchImage> &pMipMapImage, bool verbose )
+{
+    auto pCombinerImage = std::make_unique<ScratchImage>();
+    HRESULT hr = PackTextures( member, pCombinerImage, verbose );
+    if ( FAILED( hr ) ) return hr;
+
+    hr = GenerateMipMapChain( member.GetOutputFormat(), member.GetMipFilter(), pCombinerImage, pMipMapImage, verbose );
+    if ( FAILED( hr ) ) {
+        std::cerr << "Failed to create mipmaps!" << std::endl;
+    }
+    return hr;
+}
+
+HRESULT ProcessTextureArray( CTex2DDS &spec, std::unique_ptr<ScratchImage> &pArrayImage, SidecarWriter &sidecar, bool verbose = false )
+{
+    TexMetadata arrayData;
+    HRESULT hr = spec.PredictOutput( arrayData );
+    if ( FAILED( hr ) ) {
+        std::cerr << "Could not predict array size!" << std::endl;
+        return hr;
+    }
+
+    // The first slice settles the uncompressed format, which depends on the loaded sources
+    auto pFirstImage = std::make_unique<ScratchImage>();
+    hr = _BuildArraySlice( *spec.GetMembers()[0].get(), pFirstImage, verbose );
+    if ( FAILED( hr ) ) {
+        std::cerr << "Failed to build array slices!" << std::endl;
+        return hr;
+    }
+
+    arrayData.format = pFirstImage->GetMetadata().format;
+    hr = pArrayImage->Initialize( arrayData );
+    if ( FAILED( hr ) ) {
+        std::cerr << "Could not create array image!" << std::endl;
+        return hr;
+    }
+
+    // Every slice is checked against the preallocated array, then copied into its own item
+    auto blitSlice = [&]( size_t i, CTex2DDS &member, const ScratchImage &mipMapImage ) -> HRESULT {
+        const auto &mdata = mipMapImage.GetMetadata();
+        if ( arrayData.width != mdata.width || arrayData.height != mdata.height || arrayData.format != mdata.format ||
+             arrayData.mipLevels != mdata.mipLevels || arrayData.GetAlphaMode() != mdata.GetAlphaMode() ) {
+            std::wcerr << "Array member doesn't match the other slices in size and format: " << member.GetOutFile() << std::endl;
+            return E_FAIL;
+        }
+
+        for ( size_t mip = 0; mip < mdata.mipLevels; ++mip ) {
+            HRESULT hr = BlitImage( *mipMapImage.GetImage( mip, 0, 0 ), *pArrayImage->GetImage( mip, i, 0 ), 0, 0 );
+            if ( FAILED( hr ) ) return hr;
+        }
+        return 0;
+    };
+
+    hr = blitSlice( 0, *spec.GetMembers()[0].get(), *pFirstImage.get() );
+    pFirstImage.reset();
+
+    // The remaining slices are packed and mipped in parallel
+    if ( SUCCEEDED( hr ) ) {
+        hr = ForEachMember( spec, verbose, [&]( size_t i, CTex2DDS &member ) -> HRESULT {
+            if ( i == 0 ) return 0;
+
+            auto pMipMapImage = std::make_unique<ScratchImage>();
+            HRESULT hr = _BuildArraySlice( member, pMipMapImage, verbose );
+            if ( FAILED( hr ) ) return hr;
+
+            return blitSlice( i, member, *pMipMapImage.get() );
+        } );
+    }
+    if ( FAILED( hr ) ) {
+        std::cerr << "Failed to build array slices!" << std::endl;
+        return hr;
+    }
+
+    sidecar = [&spec]( const TexMetadata &metadata ) { return WriteGroupSidecar( spec, metadata, {}, {} ); };
+    return 0;
+}
+
+HRESULT ProcessTextureAtlas( CTex2DDS &spec, std::unique_ptr<ScratchImage> &pAtlasImage, SidecarWriter &sidecar, bool verbose = false )
+{
+    const auto &members = spec.GetMembers();
+
+    std::vector<std::unique_ptr<ScratchImage>> combined( members.size() );
+    HRESULT hr = ForEachMember( spec, verbose, [&]( size_t i, CTex2DDS &member ) -> HRESULT {
+        combined[i] = std::make_unique<ScratchImage>();
+        return PackTextures( member, combined[i], verbose );
+    } );
+    if ( FAILED( hr ) ) {
+        std::cerr << "Failed to pack atlas members!" << std::endl;
+        return hr;
+    }
+
+    std::vector<std::pair<size_t, size_t>> sizes;
+    sizes.reserve( members.size() );
+    for ( size_t i = 0; i < members.size(); ++i ) {
+        const auto &mdata = combined[i]->GetMetadata();
+        if ( mdata.format != combined[0]->GetMetadata().format ) {
+            std::wcerr << "Atlas member doesn't match the other members in format: " << members[i]->GetOutFile() << std::endl;
+            return E_FAIL;
+        }
+        sizes.emplace_back( mdata.width, mdata.height );
+    }
+
+    // Rects stay block-aligned on every mip level, so the box filter never mixes members
+    auto mipLevels = ClampAtlasMipLevels( sizes, spec.GetMipLevels() );
+    size_t alignment = size_t( 4 ) << ( mipLevels - 1 );
+
+    size_t width, height;
+    std::vector<std::pair<size_t, size_t>> offsets;
+    PackAtlasRects( sizes, alignment, width, height, offsets );
+
+    auto pCombinerImage = std::make_unique<ScratchImage>();
+    auto mdata = combined[0]->GetMetadata();
+    mdata.width = width;
+    mdata.height = height;
+    hr = pCombinerImage->Initialize( mdata );
+    if ( FAILED( hr ) ) {
+        std::cerr << "Could not create atlas image!" << std::endl;
+        return hr;
+    }
+    memset( pCombinerImage->GetPixels(), 0, pCombinerImage->GetPixelsSize() );
+
+    for ( size_t i = 0; i < members.size(); ++i ) {
+        hr = BlitImage( *combined[i]->GetImage( 0, 0, 0 ), *pCombinerImage->GetImage( 0, 0, 0 ), offsets[i].first, offsets[i].second );
+        if ( FAILED( hr ) ) return hr;
+        combined[i].reset();
+    }
+
+    if ( verbose ) {
+        PrintDebugMetadata( "Atlas", pCombinerImage->GetMetadata() );
+    }
+
+    Progress() << "Generating mips..." << std::endl;
+    hr = GenerateMipMaps( pCombinerImage->GetImages(), pCombinerImage->GetImageCount(), pCombinerImage->GetMetadata(), TEX_FILTER_BOX | TEX_FILTER_FORCE_NON_WIC, mipLevels, *pAtlasImage.get() );
+    if ( FAILED( hr ) ) {
+        std::cerr << "Failed to create mipmaps!" << std::endl;
+        return hr;
+    }
+
+    sidecar = [&spec, offsets, sizes]( const TexMetadata &metadata ) { return WriteGroupSidecar( spec, metadata, offsets, sizes ); };
+    return 0;
+}
+
+HRESULT ProcessTextures( CSmallMipBatch &batch, CBackendRegistry &backends, CVerifier *pVerifier, CTiledProcessor &tiled, CMetrics &metrics, CTex2DDS &spec, bool verbose, SavedCallback saved )
+{
+    HRESULT hr;
+
+    WProgress() << spec.GetOutFile() << std::endl;
+
+    // Oversized sources stream straight to the DDS, the mip chain is never resident to sample or batch
+    if ( tiled.Accepts( spec ) ) {
+        if ( pVerifier ) {
+            std::cerr << "Skipping verification of tiled texture" << std::endl;
+        }
+
+        // Bands are compressed as they are read, so there is no whole image to analyze
+        if ( spec.IsAutoFormat() ) {
+            Progress() << "Auto format: " << LookupByValue( spec.GetOutputFormat(), g_pFormats ) << " (tiled, not analyzed)" << std::endl;
+        }
+
+        CMetrics::CStageTimer timer( metrics, "tiled", spec.GetOutputPixels() );
+        hr = tiled.Process( spec, verbose );
+        if ( FAILED( hr ) ) {
+            std::cerr << "Failed to process tiled texture!" << std::endl;
+            return hr;
+        }
+
+        return saved ? saved() : 0;
+    }
+
+    // Load all textures
+    hr = spec.LoadTextures( verbose );
+    if ( FAILED( hr ) ) {
+        std::cerr << "Failed loading textures!" << std::endl;
+        return hr;
+    }
+
+    auto formatOut = spec.GetOutputFormat();
+
+    auto pMipMapImage = std::make_unique<ScratchImage>();
+
+    // Groups describe their members in a sidecar, written once the DDS is saved
+    SidecarWriter sidecar;
+
+    switch ( spec.GetLayout() ) {
+        case TEX_LAYOUT_ARRAY: {
+            CMetrics::CStageTimer timer( metrics, "group", spec.GetOutputPixels() );
+            hr = ProcessTextureArray( spec, pMipMapImage, sidecar, verbose );
+            if ( FAILED( hr ) ) {
+                std::cerr << "Failed to build texture array!" << std::endl;
+                return hr;
+            }
+            break;
+        }
+
+        case TEX_LAYOUT_ATLAS: {
+            CMetrics::CStageTimer timer( metrics, "group", spec.GetOutputPixels() );
+            hr = ProcessTextureAtlas( spec, pMipMapImage, sidecar, verbose );
+            if ( FAILED( hr ) ) {
+                std::cerr << "Failed to build texture atlas!" << std::endl;
+                return hr;
+            }
+            break;
+        }
+
+        default: {
+            auto pCombinerImage = std::make_unique<ScratchImage>();
+            {
+                CMetrics::CStageTimer timer( metrics, "pack" );
+                hr = PackTextures( spec, pCombinerImage, verbose );
+                if ( FAILED( hr ) ) {
+                    return hr;
+                }
+                timer.SetPixels( pCombinerImage->GetMetadata().width * pCombinerImage->GetMetadata().height );
+            }
+
+            // Generate mipmaps
+            Progress() << "Generating mips..." << std::endl;
+            CMetrics::CStageTimer timer( metrics, "mips", pCombinerImage->GetMetadata().width * pCombinerImage->GetMetadata().height );
+            hr = GenerateMipMapChain( formatOut, spec.GetMipFilter(), pCombinerImage, pMipMapImage, verbose );
+            if ( FAILED( hr ) ) {
+                std::cerr << "Failed to create mipmaps!" << std::endl;
+                return hr;
+            }
+            // Generate mipmaps done
+            break;
+        }
+    }
+
+
+    // Every candidate shares the sRGB encoding of the BC7 stand-in the chain was built for
+    if ( spec.IsAutoFormat() ) {
+        const auto &mdata = pMipMapImage->GetMetadata();
+        CMetrics::CStageTimer timer( metrics, "analyze", uint64_t( mdata.width ) * mdata.height * mdata.arraySize );
+        hr = ChooseAutoFormat( *pMipMapImage.get(), spec.GetAutoFormat(), spec.GetAutoMaxRMSE(), formatOut );
+        if ( FAILED( hr ) ) {
+            std::cerr << "Failed to choose an output format!" << std::endl;
+            return hr;
+        }
+        spec.ResolveOutputFormat( formatOut );
+    }
+
+    // Pages come straight from the chain, there is no DDS to batch or verify
+    if ( spec.IsPaged() ) {
+        if ( pVerifier ) {
+            std::cerr << "Skipping verification of paged texture" << std::endl;
+        }
+
+        const auto &mdata = pMipMapImage->GetMetadata();
+        CMetrics::CStageTimer timer( metrics, "pages", ComputePagedPixels( mdata, spec.GetPages() ) );
+        hr = WritePages( backends, spec, formatOut, *pMipMapImage.get() );
+        if ( FAILED( hr ) ) {
+            std::cerr << "Failed to write pages!" << std::endl;
+            return hr;
+        }
+
+        return saved ? saved() : 0;
+    }
+
+    // Keep the source texels of the sampled blocks, the chain itself is released once compressed
+    auto pSamples = std::make_shared<SVerifySamples>();
+    if ( pVerifier ) {
+        hr = pVerifier->Sample( *pMipMapImage.get(), spec.GetOutFile(), *pSamples.get() );
+        if ( FAILED( hr ) ) {
+            std::cerr << "Failed to sample blocks for verification!" << std::endl;
+            return hr;
+        }
+    }
+
+    // Compress image
+    Progress() << "Compressing texture..." << std::endl;
+    const auto &top = *pMipMapImage->GetImage( 0, 0, 0 );
+    CMetrics::CStageTimer timer( metrics, "compress", uint64_t( top.width ) * top.height * pMipMapImage->GetMetadata().arraySize );
+
+    // Small mips join the shared batch, and the texture is saved once its batch is flushed.
+    // The verbose check and RDO need the full source chain, so those compress in one go.
+    if ( !verbose && spec.GetRDOLambda() == 0.0f ) {
+        hr = batch.Compress( formatOut, pMipMapImage, [&spec, pVerifier, pSamples, sidecar, saved]( std::unique_ptr<ScratchImage> &pCompressedImage ) {
+            if ( pVerifier ) {
+                HRESULT hr = pVerifier->Verify( *pSamples.get(), *pCompressedImage.get(), spec.GetOutFile() );
+                if ( FAILED( hr ) ) {
+                    return hr;
+                }
+            }
+
+            HRESULT hr = SaveTextures( spec, pCompressedImage );
+            if ( FAILED( hr ) ) {
+                return hr;
+            }
+
+            if ( sidecar ) {
+                hr = sidecar( pCompressedImage->GetMetadata() );
+                if ( FAILED( hr ) ) {
+                    return hr;
+                }
+            }
+
+            return saved ? saved() : 0;
+        } );
+        if FAILED( hr ) {
+            std::cerr << "Failed to compress texture!" << std::endl;
+            return hr;
+        }
+
+        return 0;
+    }
+
+    auto pCompressedImage = std::make_unique<ScratchImage>();
+    hr = CompressImage( backends, formatOut, spec.GetRDOLambda(), pMipMapImage, pCompressedImage, verbose );
+    if FAILED( hr ) {
+        std::cerr << "Failed to compress texture!" << std::endl;
+        return hr;
+    }
+    // Compress done
+
+    if ( verbose ) {
+        hr = VerifyTextures( spec, pMipMapImage, pCompressedImage );
+        if ( FAILED( hr ) ) {
+            return hr;
+        }
+    }
+
+    if ( pVerifier ) {
+        hr = pVerifier->Verify( *pSamples.get(), *pCompressedImage.get(), spec.GetOutFile() );
+        if ( FAILED( hr ) ) {
+            return hr;
+        }
+    }
+
+    hr = SaveTextures( spec, pCompressedImage );
+    if ( FAILED( hr ) ) {
+        return hr;
+    }
+
+    if ( sidecar ) {
+        hr = sidecar( pCompressedImage->GetMetadata() );
+        if ( FAILED( hr ) ) {
+            return hr;
+        }
+    }
+
+    if ( verbose ) Progress() << std::endl;
+
+    return saved ? saved() : 0;
+}
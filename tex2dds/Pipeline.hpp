@@ -0,0 +1,17 @@
+#pragma once
+
+#include "CTex2DDS.hpp"
+#include "MipBatch.hpp"
+#include "Verify.hpp"
+#include "Tiled.hpp"
+#include "Metrics.hpp"
+#include "Prefetch.hpp"
+
+// Decodes the sources of spec, unless the tiled path will stream them
+HRESULT LoadTextures( CTiledProcessor &tiled, CTex2DDS &spec, bool verbose = false, CPrefetcher *pPrefetcher = nullptr );
+
+// Called once all outputs of a spec are written, which for batched textures is when their group is flushed
+typedef std::function<HRESULT()> SavedCallback;
+
+// Packs, mips and compresses spec. Outputs go to its output callback, or to files once batch has compressed them.
+HRESULT ProcessTextures( CSmallMipBatch &batch, CBackendRegistry &backends, CVerifier *pVerifier, CTiledProcessor &tiled, CMetrics &metrics, CTex2DDS &spec, bool verbose = false, SavedCallback saved = nullptr );
@@ -0,0 +1,157 @@
+#include "pch.h"
+
+#include <iostream>
+
+#include "Prefetch.hpp"
+
+CPrefetcher::~CPrefetcher()
+{
+    for ( auto &[file, read] : m_reads ) {
+        CancelIoEx( read->hFile, nullptr );
+        Wait( *read.get() );
+    }
+}
+
+void CPrefetcher::Prefetch( const std::wstring &file )
+{
+    {
+        std::lock_guard lock( m_mutex );
+        if ( !m_requested.insert( file ).second ) return;
+        m_opening.insert( file );
+    }
+
+    // Opening and issuing reads can block on network storage, so only the bookkeeping is locked
+    auto read = std::make_unique<SRead>();
+    read->hFile = CreateFileW( file.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+        FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN, nullptr );
+
+    // Files that don't fit are left to the decoder
+    LARGE_INTEGER size = {};
+    bool reserved = false;
+    if ( read->hFile != INVALID_HANDLE_VALUE && GetFileSizeEx( read->hFile, &size ) ) {
+        std::lock_guard lock( m_mutex );
+        reserved = m_bytes + size_t( size.QuadPart ) <= m_maxBytes;
+        if ( reserved ) m_bytes += size_t( size.QuadPart );
+    }
+
+    if ( !reserved ) {
+        if ( read->hFile != INVALID_HANDLE_VALUE ) CloseHandle( read->hFile );
+
+        std::lock_guard lock( m_mutex );
+        m_opening.erase( file );
+        m_dropped.erase( file );
+        return;
+    }
+
+    read->data.resize( size_t( size.QuadPart ) );
+    read->requests.resize( ( read->data.size() + m_chunkBytes - 1 ) / m_chunkBytes );
+
+    for ( size_t i = 0; i < read->requests.size(); ++i ) {
+        uint64_t offset = uint64_t( i ) * m_chunkBytes;
+        auto &request = read->requests[i];
+        request = {};
+        request.Offset = DWORD( offset );
+        request.OffsetHigh = DWORD( offset >> 32 );
+        request.hEvent = CreateEventW( nullptr, TRUE, FALSE, nullptr );
+
+        auto chunk = DWORD( std::min<uint64_t>( m_chunkBytes, read->data.size() - offset ) );
+        if ( !request.hEvent || ( !ReadFile( read->hFile, read->data.data() + offset, chunk, nullptr, &request ) && GetLastError() != ERROR_IO_PENDING ) ) {
+            // Reads already issued still complete into the buffer, Wait collects them
+            read->failed = true;
+            read->requests.resize( i + ( request.hEvent ? 1 : 0 ) );
+            break;
+        }
+    }
+
+    // A job that already gave up on the file while it was being opened won't take it
+    bool dropped;
+    {
+        std::lock_guard lock( m_mutex );
+        m_opening.erase( file );
+        dropped = m_dropped.erase( file ) > 0;
+        if ( !dropped ) {
+            m_reads.emplace( file, std::move( read ) );
+            return;
+        }
+    }
+
+    CancelIoEx( read->hFile, nullptr );
+    Wait( *read.get() );
+
+    std::lock_guard lock( m_mutex );
+    m_bytes -= read->data.size();
+}
+
+HRESULT CPrefetcher::Wait( SRead &read )
+{
+    HRESULT hr = read.failed ? E_FAIL : S_OK;
+
+    for ( auto &request : read.requests ) {
+        DWORD bytes;
+        if ( !GetOverlappedResult( read.hFile, &request, &bytes, TRUE ) ) {
+            hr = HRESULT_FROM_WIN32( GetLastError() );
+        }
+        CloseHandle( request.hEvent );
+    }
+
+    CloseHandle( read.hFile );
+    read.requests.clear();
+    read.hFile = INVALID_HANDLE_VALUE;
+
+    return hr;
+}
+
+std::unique_ptr<CPrefetcher::SRead> CPrefetcher::Remove( const std::wstring &file )
+{
+    std::unique_ptr<SRead> read;
+    {
+        std::lock_guard lock( m_mutex );
+
+        // Later jobs reading the same file may prefetch it again
+        m_requested.erase( file );
+
+        auto it = m_reads.find( file );
+        if ( it == m_reads.end() ) {
+            if ( m_opening.count( file ) ) m_dropped.insert( file );
+            return nullptr;
+        }
+
+        read = std::move( it->second );
+        m_reads.erase( it );
+    }
+
+    if ( FAILED( Wait( *read.get() ) ) ) {
+        read->failed = true;
+    }
+
+    std::lock_guard lock( m_mutex );
+    m_bytes -= read->data.size();
+
+    return read;
+}
+
+HRESULT CPrefetcher::Take( const std::wstring &file, std::vector<uint8_t> &data )
+{
+    auto read = Remove( file );
+
+    // A failed read falls back to the decoder reading the file itself
+    if ( !read || read->failed ) return S_FALSE;
+
+    ++m_taken;
+    m_takenBytes += read->data.size();
+    data = std::move( read->data );
+
+    return 0;
+}
+
+void CPrefetcher::Discard( const std::wstring &file )
+{
+    Remove( file );
+}
+
+void CPrefetcher::PrintReport()
+{
+    if ( m_taken == 0 ) return;
+
+    std::cerr << "Prefetched " << m_taken << " source files (" << ( m_takenBytes >> 20 ) << " MiB)" << std::endl;
+}
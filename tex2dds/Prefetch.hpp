@@ -0,0 +1,58 @@
+#pragma once
+
+#include <map>
+#include <set>
+#include <mutex>
+#include <atomic>
+
+// Reads source files of upcoming jobs with overlapped I/O, so cold reads from network storage overlap
+// with the decode and compression of earlier jobs. The decoders take the buffers instead of the file.
+class CPrefetcher
+{
+public:
+    // Files are split into chunkBytes reads that are all in flight at once, up to maxBytes overall
+    CPrefetcher( size_t maxBytes = 256 << 20, size_t chunkBytes = 4 << 20 ) :
+        m_maxBytes( maxBytes ),
+        m_chunkBytes( chunkBytes )
+    {
+    }
+
+    ~CPrefetcher();
+
+    // Starts reading file unless it was requested before or would exceed the budget
+    void Prefetch( const std::wstring &file );
+
+    // Waits for the reads of file and hands over its contents. S_FALSE when it wasn't prefetched.
+    HRESULT Take( const std::wstring &file, std::vector<uint8_t> &data );
+
+    // Drops a prefetched file that won't be decoded, releasing its share of the budget
+    void Discard( const std::wstring &file );
+
+    void PrintReport();
+
+protected:
+    struct SRead
+    {
+        HANDLE hFile = INVALID_HANDLE_VALUE;
+        std::vector<uint8_t> data;
+        std::vector<OVERLAPPED> requests;
+        bool failed = false;
+    };
+
+    // Takes file out of the in-flight set once its reads completed
+    std::unique_ptr<SRead> Remove( const std::wstring &file );
+    HRESULT Wait( SRead &read );
+
+    size_t m_maxBytes;
+    size_t m_chunkBytes;
+
+    std::mutex m_mutex;
+    std::map<std::wstring, std::unique_ptr<SRead>> m_reads;
+    std::set<std::wstring> m_requested;
+    std::set<std::wstring> m_opening;
+    std::set<std::wstring> m_dropped;
+    size_t m_bytes = 0;
+
+    std::atomic<size_t> m_taken = 0;
+    std::atomic<uint64_t> m_takenBytes = 0;
+};
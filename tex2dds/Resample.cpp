@@ -0,0 +1,281 @@
+#include "pch.h"
+
+#include <cmath>
+#include <DirectXPackedVector.h>
+
+#include "Resample.hpp"
+
+using namespace DirectX;
+using namespace DirectX::PackedVector;
+
+float _FilterRadius( RESIZE_FILTER filter )
+{
+    switch ( filter ) {
+        case RESIZE_FILTER_BOX: return 0.5f;
+        case RESIZE_FILTER_TRIANGLE: return 1.0f;
+        case RESIZE_FILTER_LANCZOS3: return 3.0f;
+        default: return 2.0f;
+    }
+}
+
+float _Sinc( float x )
+{
+    if ( x == 0.0f ) return 1.0f;
+    x *= XM_PI;
+    return std::sin( x ) / x;
+}
+
+float _FilterWeight( RESIZE_FILTER filter, float x )
+{
+    float t = std::abs( x );
+
+    switch ( filter ) {
+        case RESIZE_FILTER_BOX:
+            return x >= -0.5f && x < 0.5f ? 1.0f : 0.0f;
+
+        case RESIZE_FILTER_TRIANGLE:
+            return std::max( 0.0f, 1.0f - t );
+
+        case RESIZE_FILTER_LANCZOS3:
+            return t < 3.0f ? _Sinc( x ) * _Sinc( x / 3.0f ) : 0.0f;
+
+        default: {
+            // Mitchell-Netravali with B = C = 1/3
+            const float B = 1.0f / 3.0f;
+            const float C = 1.0f / 3.0f;
+            if ( t < 1.0f ) {
+                return ( ( 12.0f - 9.0f * B - 6.0f * C ) * t * t * t + ( -18.0f + 12.0f * B + 6.0f * C ) * t * t + ( 6.0f - 2.0f * B ) ) / 6.0f;
+            }
+            if ( t < 2.0f ) {
+                return ( ( -B - 6.0f * C ) * t * t * t + ( 6.0f * B + 30.0f * C ) * t * t + ( -12.0f * B - 48.0f * C ) * t + ( 8.0f * B + 24.0f * C ) ) / 6.0f;
+            }
+            return 0.0f;
+        }
+    }
+}
+
+void BuildFilterTable( size_t srcSize, size_t dstSize, RESIZE_FILTER filter, SFilterTable &table )
+{
+    double ratio = double( srcSize ) / double( dstSize );
+    double scale = std::max( ratio, 1.0 );
+    double support = _FilterRadius( filter ) * scale;
+
+    table.taps = size_t( std::ceil( support * 2.0 ) ) + 1;
+    table.first.resize( dstSize );
+    table.count.resize( dstSize );
+    table.weights.assign( dstSize * table.taps, 0.0f );
+
+    for ( size_t i = 0; i < dstSize; ++i ) {
+        double center = ( i + 0.5 ) * ratio - 0.5;
+        auto lo = ptrdiff_t( std::ceil( center - support ) );
+        auto hi = ptrdiff_t( std::floor( center + support ) );
+
+        auto first = std::clamp<ptrdiff_t>( lo, 0, ptrdiff_t( srcSize ) - 1 );
+        auto last = std::clamp<ptrdiff_t>( hi, 0, ptrdiff_t( srcSize ) - 1 );
+        auto weights = &table.weights[i * table.taps];
+
+        float sum = 0.0f;
+        for ( ptrdiff_t j = lo; j <= hi; ++j ) {
+            float w = _FilterWeight( filter, float( ( j - center ) / scale ) );
+            weights[std::clamp( j, first, last ) - first] += w;
+            sum += w;
+        }
+
+        if ( sum != 0.0f ) {
+            for ( ptrdiff_t k = 0; k <= last - first; ++k ) {
+                weights[k] /= sum;
+            }
+        }
+
+        table.first[i] = size_t( first );
+        table.count[i] = size_t( last - first + 1 );
+    }
+}
+
+bool _CanResample( DXGI_FORMAT format )
+{
+    switch ( MakeLinear( format ) ) {
+        case DXGI_FORMAT_R8G8B8A8_UNORM:
+        case DXGI_FORMAT_B8G8R8A8_UNORM:
+        case DXGI_FORMAT_R16G16B16A16_UNORM:
+        case DXGI_FORMAT_R16G16B16A16_FLOAT:
+        case DXGI_FORMAT_R32G32B32A32_FLOAT:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+// One row as linear RGBA, premultiplied when colour is weighted by alpha
+static void _ReadRow( const Image &src, size_t y, bool weightAlpha, XMVECTOR *row )
+{
+    auto pixels = src.pixels + y * src.rowPitch;
+
+    switch ( MakeLinear( src.format ) ) {
+        case DXGI_FORMAT_R8G8B8A8_UNORM:
+        case DXGI_FORMAT_B8G8R8A8_UNORM: {
+            static const auto s_unorm = [] {
+                std::array<float, 256> table;
+                for ( size_t i = 0; i < table.size(); ++i ) table[i] = i / 255.0f;
+                return table;
+            }();
+
+            auto toLinear = IsSRGB( src.format ) ? SRGBToLinearTable() : s_unorm.data();
+            bool bgr = IsBGR( src.format );
+            for ( size_t x = 0; x < src.width; ++x ) {
+                auto texel = pixels + x * 4;
+                float r = toLinear[texel[bgr ? 2 : 0]];
+                float b = toLinear[texel[bgr ? 0 : 2]];
+                row[x] = XMVectorSet( r, toLinear[texel[1]], b, s_unorm[texel[3]] );
+            }
+            break;
+        }
+
+        case DXGI_FORMAT_R16G16B16A16_UNORM:
+            for ( size_t x = 0; x < src.width; ++x ) {
+                row[x] = XMLoadUShortN4( reinterpret_cast<const XMUSHORTN4 *>( pixels ) + x );
+            }
+            break;
+
+        case DXGI_FORMAT_R16G16B16A16_FLOAT:
+            for ( size_t x = 0; x < src.width; ++x ) {
+                row[x] = XMLoadHalf4( reinterpret_cast<const XMHALF4 *>( pixels ) + x );
+            }
+            break;
+
+        default:
+            for ( size_t x = 0; x < src.width; ++x ) {
+                row[x] = XMLoadFloat4( reinterpret_cast<const XMFLOAT4 *>( pixels ) + x );
+            }
+            break;
+    }
+
+    if ( weightAlpha ) {
+        for ( size_t x = 0; x < src.width; ++x ) {
+            row[x] = XMVectorSelect( row[x], XMVectorMultiply( row[x], XMVectorSplatW( row[x] ) ), g_XMSelect1110 );
+        }
+    }
+}
+
+void _WriteRow( const Image &dst, size_t y, bool weightAlpha, XMVECTOR *row )
+{
+    auto pixels = dst.pixels + y * dst.rowPitch;
+
+    if ( weightAlpha ) {
+        for ( size_t x = 0; x < dst.width; ++x ) {
+            float alpha = XMVectorGetW( row[x] );
+            if ( alpha > 0.0f ) {
+                row[x] = XMVectorSelect( row[x], XMVectorDivide( row[x], XMVectorReplicate( alpha ) ), g_XMSelect1110 );
+            }
+        }
+    }
+
+    switch ( MakeLinear( dst.format ) ) {
+        case DXGI_FORMAT_R8G8B8A8_UNORM:
+        case DXGI_FORMAT_B8G8R8A8_UNORM: {
+            bool srgb = IsSRGB( dst.format );
+            bool bgr = IsBGR( dst.format );
+            for ( size_t x = 0; x < dst.width; ++x ) {
+                auto texel = pixels + x * 4;
+                XMFLOAT4 v;
+                XMStoreFloat4( &v, XMVectorSaturate( row[x] ) );
+
+                auto encode = [srgb]( float c ) { return srgb ? LinearToSRGB8( c ) : static_cast<uint8_t>( c * 255.0f + 0.5f ); };
+                texel[bgr ? 2 : 0] = encode( v.x );
+                texel[1] = encode( v.y );
+                texel[bgr ? 0 : 2] = encode( v.z );
+                texel[3] = static_cast<uint8_t>( v.w * 255.0f + 0.5f );
+            }
+            break;
+        }
+
+        case DXGI_FORMAT_R16G16B16A16_UNORM:
+            for ( size_t x = 0; x < dst.width; ++x ) {
+                XMStoreUShortN4( reinterpret_cast<XMUSHORTN4 *>( pixels ) + x, row[x] );
+            }
+            break;
+
+        case DXGI_FORMAT_R16G16B16A16_FLOAT:
+            for ( size_t x = 0; x < dst.width; ++x ) {
+                XMStoreHalf4( reinterpret_cast<XMHALF4 *>( pixels ) + x, row[x] );
+            }
+            break;
+
+        default:
+            for ( size_t x = 0; x < dst.width; ++x ) {
+                XMStoreFloat4( reinterpret_cast<XMFLOAT4 *>( pixels ) + x, row[x] );
+            }
+            break;
+    }
+}
+
+HRESULT ResampleImage( const Image &src, size_t width, size_t height, RESIZE_FILTER filter, bool separateAlpha, ScratchImage &result )
+{
+    if ( !_CanResample( src.format ) || width == 0 || height == 0 ) return S_FALSE;
+
+    HRESULT hr = result.Initialize2D( src.format, width, height, 1, 1 );
+    if ( FAILED( hr ) ) {
+        return hr;
+    }
+
+    SFilterTable horizontal, vertical;
+    BuildFilterTable( src.width, width, filter, horizontal );
+    BuildFilterTable( src.height, height, filter, vertical );
+
+    bool weightAlpha = !separateAlpha;
+    const auto &dst = *result.GetImage( 0, 0, 0 );
+
+    // Each band filters the source rows its output rows need, so bands share nothing but the input
+    const size_t bandRows = 32;
+    const int bands = int( ( height + bandRows - 1 ) / bandRows );
+
+    #pragma omp parallel for schedule( dynamic )
+    for ( int band = 0; band < bands; ++band ) {
+        size_t firstRow = size_t( band ) * bandRows;
+        size_t lastRow = std::min( height, firstRow + bandRows );
+
+        size_t srcFirst = vertical.first[firstRow];
+        size_t srcLast = srcFirst;
+        for ( size_t y = firstRow; y < lastRow; ++y ) {
+            srcLast = std::max( srcLast, vertical.first[y] + vertical.count[y] );
+        }
+
+        std::vector<XMVECTOR> srcRow( src.width );
+        std::vector<XMVECTOR> filtered( ( srcLast - srcFirst ) * width );
+
+        for ( size_t sy = srcFirst; sy < srcLast; ++sy ) {
+            _ReadRow( src, sy, weightAlpha, srcRow.data() );
+
+            auto outRow = &filtered[( sy - srcFirst ) * width];
+            for ( size_t x = 0; x < width; ++x ) {
+                auto taps = &srcRow[horizontal.first[x]];
+                auto weights = &horizontal.weights[x * horizontal.taps];
+
+                XMVECTOR sum = XMVectorZero();
+                for ( size_t k = 0; k < horizontal.count[x]; ++k ) {
+                    sum = XMVectorMultiplyAdd( XMVectorReplicate( weights[k] ), taps[k], sum );
+                }
+                outRow[x] = sum;
+            }
+        }
+
+        std::vector<XMVECTOR> outRow( width );
+        for ( size_t y = firstRow; y < lastRow; ++y ) {
+            std::fill( outRow.begin(), outRow.end(), XMVectorZero() );
+
+            auto weights = &vertical.weights[y * vertical.taps];
+            for ( size_t k = 0; k < vertical.count[y]; ++k ) {
+                auto row = &filtered[( vertical.first[y] + k - srcFirst ) * width];
+                auto weight = XMVectorReplicate( weights[k] );
+                for ( size_t x = 0; x < width; ++x ) {
+                    outRow[x] = XMVectorMultiplyAdd( weight, row[x], outRow[x] );
+                }
+            }
+
+            _WriteRow( dst, y, weightAlpha, outRow.data() );
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "TexUtils.hpp"
+
+// Normalized source taps of every destination texel along one axis. Taps past the edges are clamped
+// onto the edge texel, so each window stays contiguous.
+struct SFilterTable
+{
+    size_t taps = 0;
+    std::vector<size_t> first;
+    std::vector<size_t> count;
+    std::vector<float> weights;
+};
+
+void BuildFilterTable( size_t srcSize, size_t dstSize, RESIZE_FILTER filter, SFilterTable &table );
+
+// Separable polyphase resize of an RGBA image through float rows. Weight tables are computed once per axis,
+// both passes run on DirectXMath vectors and bands of output rows run on the OpenMP team of the job.
+// Colour is weighted by alpha unless separateAlpha is set. S_FALSE for formats it doesn't read.
+HRESULT ResampleImage(
+    const DirectX::Image &src,
+    size_t width,
+    size_t height,
+    RESIZE_FILTER filter,
+    bool separateAlpha,
+    DirectX::ScratchImage &result
+);
@@ -0,0 +1,214 @@
+#include "pch.h"
+
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <charconv>
+#include <numeric>
+
+#include "Shard.hpp"
+
+bool ParseShard( const std::string &value, SShardOptions &shard )
+{
+    auto slash = value.find( '/' );
+    if ( slash == std::string::npos ) return false;
+
+    auto first = value.data();
+    auto last = value.data() + value.size();
+
+    auto [indexEnd, indexError] = std::from_chars( first, first + slash, shard.index );
+    if ( indexError != std::errc() || indexEnd != first + slash ) return false;
+
+    auto [countEnd, countError] = std::from_chars( first + slash + 1, last, shard.count );
+    if ( countError != std::errc() || countEnd != last ) return false;
+
+    return shard.count > 0 && shard.index < shard.count;
+}
+
+std::vector<size_t> AssignShard( const std::vector<uint64_t> &costs, size_t shard, size_t shards )
+{
+    std::vector<size_t> order( costs.size() );
+    std::iota( order.begin(), order.end(), 0 );
+    std::stable_sort( order.begin(), order.end(), [&]( size_t a, size_t b ) {
+        return costs[a] > costs[b];
+    } );
+
+    std::vector<uint64_t> loads( shards, 0 );
+    std::vector<size_t> assigned;
+
+    for ( auto job : order ) {
+        auto target = size_t( std::min_element( loads.begin(), loads.end() ) - loads.begin() );
+        loads[target] += std::max<uint64_t>( costs[job], 1 );
+
+        if ( target == shard ) {
+            assigned.push_back( job );
+        }
+    }
+
+    std::sort( assigned.begin(), assigned.end() );
+    return assigned;
+}
+
+std::string DefaultManifestPath( const SShardOptions &shard )
+{
+    return "tex2dds-shard-" + std::to_string( shard.index ) + "-of-" + std::to_string( shard.count ) + ".json";
+}
+
+HRESULT WriteShardManifest( const SShardOptions &shard, size_t jobs, const std::vector<SJobResult> &results )
+{
+    nlohmann::json manifest;
+    manifest["shard"] = shard.index;
+    manifest["shards"] = shard.count;
+    manifest["jobs"] = jobs;
+
+    uint64_t cost = 0;
+    auto &entries = manifest["results"] = nlohmann::json::array();
+    for ( const auto &result : results ) {
+        nlohmann::json entry;
+        entry["index"] = result.index;
+        entry["cost"] = result.cost;
+        entry["hr"] = result.hr;
+
+        auto &outputs = entry["outputs"] = nlohmann::json::array();
+        for ( const auto &output : result.outputs ) {
+            outputs.push_back( std::filesystem::path( output ).string() );
+        }
+
+        entries.push_back( entry );
+        cost += result.cost;
+    }
+    manifest["cost"] = cost;
+
+    auto path = shard.manifest.empty() ? DefaultManifestPath( shard ) : shard.manifest;
+    std::ofstream file( path );
+    if ( !file ) {
+        std::cerr << "Failed to open manifest file: " << path << std::endl;
+        return E_FAIL;
+    }
+
+    file << manifest.dump( 4 ) << std::endl;
+    return 0;
+}
+
+// Every field MergeShardManifests reads, with the type WriteShardManifest gives it
+static bool _IsManifestValid( const nlohmann::json &manifest )
+{
+    if ( !manifest.is_object() ) return false;
+    for ( const char *field : { "shard", "shards", "jobs", "cost" } ) {
+        if ( !manifest.contains( field ) || !manifest[field].is_number_unsigned() ) return false;
+    }
+    if ( !manifest.contains( "results" ) || !manifest["results"].is_array() ) return false;
+
+    for ( const auto &entry : manifest["results"] ) {
+        if ( !entry.is_object() ) return false;
+        if ( !entry.contains( "index" ) || !entry["index"].is_number_unsigned() ) return false;
+        if ( !entry.contains( "hr" ) || !entry["hr"].is_number_integer() ) return false;
+        if ( !entry.contains( "outputs" ) || !entry["outputs"].is_array() ) return false;
+        for ( const auto &output : entry["outputs"] ) {
+            if ( !output.is_string() ) return false;
+        }
+    }
+
+    return true;
+}
+
+HRESULT MergeShardManifests( const std::vector<std::string> &files )
+{
+    if ( files.empty() ) {
+        std::cerr << "No manifests to merge!" << std::endl;
+        return E_INVALIDARG;
+    }
+
+    size_t shards = 0;
+    size_t jobs = 0;
+    std::vector<bool> seenShards;
+    std::vector<int> seenJobs;
+    size_t problems = 0;
+    uint64_t totalCost = 0;
+    uint64_t maxCost = 0;
+
+    for ( const auto &path : files ) {
+        std::ifstream file( path );
+        if ( !file ) {
+            std::cerr << "Failed to open manifest file: " << path << std::endl;
+            return E_FAIL;
+        }
+
+        // A node killed mid-write leaves a truncated manifest, which is a problem of the run rather than an error
+        auto manifest = nlohmann::json::parse( file, nullptr, false );
+        if ( manifest.is_discarded() || !_IsManifestValid( manifest ) ) {
+            std::cerr << "Manifest " << path << " is malformed!" << std::endl;
+            ++problems;
+            continue;
+        }
+
+        if ( seenShards.empty() ) {
+            shards = manifest["shards"].get<size_t>();
+            jobs = manifest["jobs"].get<size_t>();
+            seenShards.resize( shards, false );
+            seenJobs.resize( jobs, 0 );
+        }
+        else if ( manifest["shards"].get<size_t>() != shards || manifest["jobs"].get<size_t>() != jobs ) {
+            std::cerr << "Manifest " << path << " comes from a different run!" << std::endl;
+            return E_FAIL;
+        }
+
+        auto shard = manifest["shard"].get<size_t>();
+        if ( shard >= shards || seenShards[shard] ) {
+            std::cerr << "Manifest " << path << " repeats or exceeds shard " << shard << "!" << std::endl;
+            return E_FAIL;
+        }
+        seenShards[shard] = true;
+
+        uint64_t shardCost = manifest["cost"].get<uint64_t>();
+        totalCost += shardCost;
+        maxCost = std::max( maxCost, shardCost );
+
+        for ( const auto &entry : manifest["results"] ) {
+            auto index = entry["index"].get<size_t>();
+            if ( index >= jobs ) {
+                std::cerr << "Job " << index << " is out of range in " << path << "!" << std::endl;
+                ++problems;
+                continue;
+            }
+            ++seenJobs[index];
+
+            if ( FAILED( entry["hr"].get<HRESULT>() ) ) {
+                std::cerr << "Job " << index << " failed in shard " << shard << "!" << std::endl;
+                ++problems;
+            }
+
+            for ( const auto &output : entry["outputs"] ) {
+                if ( !std::filesystem::exists( output.get<std::string>() ) ) {
+                    std::cerr << "Missing output for job " << index << ": " << output.get<std::string>() << std::endl;
+                    ++problems;
+                }
+            }
+        }
+    }
+
+    for ( size_t shard = 0; shard < shards; ++shard ) {
+        if ( !seenShards[shard] ) {
+            std::cerr << "Missing manifest for shard " << shard << "/" << shards << "!" << std::endl;
+            ++problems;
+        }
+    }
+
+    for ( size_t job = 0; job < jobs; ++job ) {
+        if ( seenJobs[job] != 1 ) {
+            std::cerr << "Job " << job << " was converted " << seenJobs[job] << " times!" << std::endl;
+            ++problems;
+        }
+    }
+
+    // Max over mean shard cost, 1.0 is a perfect split
+    double balance = totalCost > 0 ? double( maxCost ) * shards / totalCost : 1.0;
+    std::cerr << "Merged " << files.size() << "/" << shards << " shards, " << jobs << " jobs, cost balance " << balance << std::endl;
+
+    if ( problems > 0 ) {
+        std::cerr << problems << " problems found!" << std::endl;
+        return E_FAIL;
+    }
+
+    return 0;
+}
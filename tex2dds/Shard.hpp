@@ -0,0 +1,38 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+struct SShardOptions
+{
+    size_t index = 0;
+    size_t count = 1;
+    std::string manifest;
+
+    bool IsSharded() const { return count > 1; }
+};
+
+// Outcome of one spec of the input array
+struct SJobResult
+{
+    size_t index = 0;
+    uint64_t cost = 0;
+    HRESULT hr = E_PENDING;
+    std::vector<std::wstring> outputs;
+};
+
+// Parses "i/N" with 0 <= i < N
+bool ParseShard( const std::string &value, SShardOptions &shard );
+
+// Longest-processing-time partition: jobs are taken by descending cost (ties by index) and each goes to the
+// least loaded shard (ties by shard number), so every node computes the same split from the same input.
+// Returns the job indices of shard in input order.
+std::vector<size_t> AssignShard( const std::vector<uint64_t> &costs, size_t shard, size_t shards );
+
+std::string DefaultManifestPath( const SShardOptions &shard );
+
+HRESULT WriteShardManifest( const SShardOptions &shard, size_t jobs, const std::vector<SJobResult> &results );
+
+// Checks the manifests form one complete run (every shard once, every job once and successful,
+// every output present) and prints a summary
+HRESULT MergeShardManifests( const std::vector<std::string> &files );
@@ -1,35 +1,211 @@
 #include "pch.h"
 
 #include <iostream>
+#include <mutex>
 #include <wrl\client.h>
+#include <wincodec.h>
+#include <DirectXPackedVector.h>
 
 #include "TexUtils.hpp"
+#include "BlockRDO.hpp"
+#include "Resample.hpp"
+#include "Backend.hpp"
 
 
 using namespace DirectX;
 using Microsoft::WRL::ComPtr;
 
+// Discards everything, so a silenced stream stays good and is never modified by concurrent writers
+template<typename C>
+class CNullBuffer : public std::basic_streambuf<C>
+{
+protected:
+    typename std::basic_streambuf<C>::int_type overflow( typename std::basic_streambuf<C>::int_type c ) override
+    {
+        return std::basic_streambuf<C>::traits_type::not_eof( c );
+    }
+};
+
+static CNullBuffer<char> s_nullBuffer;
+static CNullBuffer<wchar_t> s_nullWBuffer;
+static std::ostream s_nullOut( &s_nullBuffer );
+static std::wostream s_nullWOut( &s_nullWBuffer );
+static std::ostream *s_pProgress = &s_nullOut;
+static std::wostream *s_pWProgress = &s_nullWOut;
+
+void SetProgressStreams( std::ostream *pOut, std::wostream *pWOut )
+{
+    s_pProgress = pOut ? pOut : &s_nullOut;
+    s_pWProgress = pWOut ? pWOut : &s_nullWOut;
+}
+
+std::ostream &Progress() { return *s_pProgress; }
+std::wostream &WProgress() { return *s_pWProgress; }
+
 template<> uint8_t TypeMax() { return -1; }
 template<> uint16_t TypeMax() { return -1; }
+template<> int8_t TypeMax() { return 127; }
+template<> int16_t TypeMax() { return 32767; }
+template<> float TypeMax() { return 1.0f; }
 
 template<> uint8_t TypeMin() { return 0; }
 template<> uint16_t TypeMin() { return 0; }
+template<> int8_t TypeMin() { return -127; }
+template<> int16_t TypeMin() { return -32767; }
+template<> float TypeMin() { return 0.0f; }
 
 void PrintDebugMetadata( std::string name, TexMetadata metadata )
 {
-    std::cout << name << ":";
-    std::cout << " SRGB=" << IsSRGB( metadata.format );
-    std::cout << " BGR=" << IsBGR( metadata.format );
-    std::cout << " Alpha=" << HasAlpha( metadata.format );
-    std::cout << " Dtype=" << FormatDataType( metadata.format );
-    std::cout << " Format=" << LookupByValue( metadata.format, g_pFormats );
-    std::cout << std::endl;
+    Progress() << name << ":";
+    Progress() << " SRGB=" << IsSRGB( metadata.format );
+    Progress() << " BGR=" << IsBGR( metadata.format );
+    Progress() << " Alpha=" << HasAlpha( metadata.format );
+    Progress() << " Dtype=" << FormatDataType( metadata.format );
+    Progress() << " Format=" << LookupByValue( metadata.format, g_pFormats );
+    Progress() << std::endl;
+}
+
+size_t _WICBytesPerPixel( const WICPixelFormatGUID &format )
+{
+    if ( format == GUID_WICPixelFormat32bppRGBA ) return 4;
+    if ( format == GUID_WICPixelFormat32bppBGRA ) return 4;
+    if ( format == GUID_WICPixelFormat24bppBGR ) return 3;
+    if ( format == GUID_WICPixelFormat8bppGray ) return 1;
+    return 0;
+}
+
+// Resolves the frame's colour space the way DirectXTex's WIC loader does: FORCE_LINEAR ignores the tag,
+// otherwise the EXIF colour space wins and the policy only decides for untagged files
+static bool _IsWICFrameSRGB( IWICBitmapFrameDecode *pFrame, SRGB_INPUT srgb )
+{
+    if ( srgb == FORCE_LINEAR ) return false;
+
+    ComPtr<IWICMetadataQueryReader> pReader;
+    if ( FAILED( pFrame->GetMetadataQueryReader( pReader.GetAddressOf() ) ) ) return false;
+
+    bool isSRGB = srgb == FORCE_SRGB || srgb == ASSUME_SRGB;
+
+    PROPVARIANT value;
+    PropVariantInit( &value );
+    if ( SUCCEEDED( pReader->GetMetadataByName( L"System.Image.ColorSpace", &value ) ) && value.vt == VT_UI2 ) {
+        isSRGB = value.uiVal == 1;
+    }
+    PropVariantClear( &value );
+
+    return isSRGB;
 }
 
-HRESULT LoadImageWithSRGB( const wchar_t *szFile, SRGB_INPUT srgb, DXGI_FORMAT formatOut, std::unique_ptr<ScratchImage> &pInputImage, bool verbose )
+// Decodes a JPEG at the smallest DCT-scaled size that still covers the target resolution.
+// Returns S_FALSE when the codec can't scale during decode, so the caller falls back to a full decode.
+HRESULT _LoadFromWICFileScaled( const wchar_t *szFile, const uint8_t *pData, size_t dataSize, SRGB_INPUT srgb, int width, int height, ScratchImage &image, bool verbose )
 {
-    bool srgbOut = IsSRGB( formatOut );
+    if ( width <= 0 || height <= 0 ) return S_FALSE;
+
+    bool iswic2 = false;
+    auto pFactory = GetWICFactory( iswic2 );
+    if ( !pFactory ) return S_FALSE;
+
+    ComPtr<IWICBitmapDecoder> pDecoder;
+    HRESULT hr;
+    if ( pData ) {
+        ComPtr<IWICStream> pStream;
+        hr = pFactory->CreateStream( pStream.GetAddressOf() );
+        if ( FAILED( hr ) ) return S_FALSE;
+
+        hr = pStream->InitializeFromMemory( const_cast<uint8_t *>( pData ), DWORD( dataSize ) );
+        if ( FAILED( hr ) ) return S_FALSE;
+
+        hr = pFactory->CreateDecoderFromStream( pStream.Get(), nullptr, WICDecodeMetadataCacheOnDemand, pDecoder.GetAddressOf() );
+    }
+    else {
+        hr = pFactory->CreateDecoderFromFilename( szFile, nullptr, GENERIC_READ, WICDecodeMetadataCacheOnDemand, pDecoder.GetAddressOf() );
+    }
+    if ( FAILED( hr ) ) return S_FALSE;
+
+    GUID containerFormat;
+    hr = pDecoder->GetContainerFormat( &containerFormat );
+    if ( FAILED( hr ) || containerFormat != GUID_ContainerFormatJpeg ) return S_FALSE;
+
+    ComPtr<IWICBitmapFrameDecode> pFrame;
+    hr = pDecoder->GetFrame( 0, pFrame.GetAddressOf() );
+    if ( FAILED( hr ) ) return hr;
+
+    ComPtr<IWICBitmapSourceTransform> pTransform;
+    if ( FAILED( pFrame.As( &pTransform ) ) ) return S_FALSE;
+
+    UINT srcWidth, srcHeight;
+    hr = pFrame->GetSize( &srcWidth, &srcHeight );
+    if ( FAILED( hr ) ) return hr;
+
+    UINT scaledWidth = srcWidth;
+    UINT scaledHeight = srcHeight;
+    for ( UINT scale = 2; scale <= 8; scale *= 2 ) {
+        UINT w = ( srcWidth + scale - 1 ) / scale;
+        UINT h = ( srcHeight + scale - 1 ) / scale;
+        if ( w < UINT( width ) || h < UINT( height ) ) break;
+
+        hr = pTransform->GetClosestSize( &w, &h );
+        if ( FAILED( hr ) ) return hr;
+
+        if ( w >= UINT( width ) && h >= UINT( height ) && w < scaledWidth ) {
+            scaledWidth = w;
+            scaledHeight = h;
+        }
+    }
+
+    if ( scaledWidth == srcWidth ) return S_FALSE;
+
+    WICPixelFormatGUID decodeFormat = GUID_WICPixelFormat32bppRGBA;
+    hr = pTransform->GetClosestPixelFormat( &decodeFormat );
+    if ( FAILED( hr ) ) return hr;
+
+    auto decodeBpp = _WICBytesPerPixel( decodeFormat );
+    if ( decodeBpp == 0 ) return S_FALSE;
+
+    bool srgbIn = _IsWICFrameSRGB( pFrame.Get(), srgb );
+    hr = image.Initialize2D( srgbIn ? DXGI_FORMAT_R8G8B8A8_UNORM_SRGB : DXGI_FORMAT_R8G8B8A8_UNORM, scaledWidth, scaledHeight, 1, 1 );
+    if ( FAILED( hr ) ) return hr;
+
+    auto pDest = image.GetImages();
+
+    if ( decodeFormat == GUID_WICPixelFormat32bppRGBA ) {
+        hr = pTransform->CopyPixels( nullptr, scaledWidth, scaledHeight, &decodeFormat, WICBitmapTransformRotate0,
+            UINT( pDest->rowPitch ), UINT( pDest->slicePitch ), pDest->pixels );
+        if ( FAILED( hr ) ) return hr;
+    }
+    else {
+        // Decode in the codec's native layout, then expand to RGBA
+        UINT stride = UINT( scaledWidth * decodeBpp );
+        std::vector<uint8_t> decoded( size_t( stride ) * scaledHeight );
+        hr = pTransform->CopyPixels( nullptr, scaledWidth, scaledHeight, &decodeFormat, WICBitmapTransformRotate0,
+            stride, UINT( decoded.size() ), decoded.data() );
+        if ( FAILED( hr ) ) return hr;
+
+        ComPtr<IWICBitmap> pBitmap;
+        hr = pFactory->CreateBitmapFromMemory( scaledWidth, scaledHeight, decodeFormat, stride, UINT( decoded.size() ), decoded.data(), pBitmap.GetAddressOf() );
+        if ( FAILED( hr ) ) return hr;
+
+        ComPtr<IWICFormatConverter> pConverter;
+        hr = pFactory->CreateFormatConverter( pConverter.GetAddressOf() );
+        if ( FAILED( hr ) ) return hr;
+
+        hr = pConverter->Initialize( pBitmap.Get(), GUID_WICPixelFormat32bppRGBA, WICBitmapDitherTypeNone, nullptr, 0.0, WICBitmapPaletteTypeCustom );
+        if ( FAILED( hr ) ) return hr;
+
+        hr = pConverter->CopyPixels( nullptr, UINT( pDest->rowPitch ), UINT( pDest->slicePitch ), pDest->pixels );
+        if ( FAILED( hr ) ) return hr;
+    }
+
+    if ( verbose ) {
+        Progress() << "Decoded at reduced resolution " << scaledWidth << "x" << scaledHeight
+            << " (source " << srcWidth << "x" << srcHeight << ")" << std::endl;
+    }
+
+    return 0;
+}
 
+HRESULT LoadImageWithSRGB( const wchar_t *szFile, SRGB_INPUT srgb, int width, int height, std::unique_ptr<ScratchImage> &pInputImage, bool verbose, const uint8_t *pData, size_t dataSize )
+{
     auto ext = std::filesystem::path( szFile ).extension().string();
     if ( ext == ".tga" || ext == ".TGA" ) {
         TGA_FLAGS tgaFlags = TGA_FLAGS_NONE;
@@ -40,7 +216,9 @@ HRESULT LoadImageWithSRGB( const wchar_t *szFile, SRGB_INPUT srgb, DXGI_FORMAT f
             case FORCE_LINEAR: tgaFlags |= TGA_FLAGS_IGNORE_SRGB; break;
         }
 
-        HRESULT hr = LoadFromTGAFile( szFile, tgaFlags, nullptr, *pInputImage.get() );
+        HRESULT hr = pData
+            ? LoadFromTGAMemory( pData, dataSize, tgaFlags, nullptr, *pInputImage.get() )
+            : LoadFromTGAFile( szFile, tgaFlags, nullptr, *pInputImage.get() );
         if ( FAILED( hr ) ) {
             std::cerr << "Failed to load TGA image!" << std::endl;
             return hr;
@@ -55,7 +233,13 @@ HRESULT LoadImageWithSRGB( const wchar_t *szFile, SRGB_INPUT srgb, DXGI_FORMAT f
             case FORCE_LINEAR: wicFlags |= WIC_FLAGS_IGNORE_SRGB; break;
         }
 
-        HRESULT hr = LoadFromWICFile( szFile, wicFlags, nullptr, *pInputImage.get() );
+        // Reduced-resolution decode avoids a full-size intermediate for downscaled outputs
+        HRESULT hr = _LoadFromWICFileScaled( szFile, pData, dataSize, srgb, width, height, *pInputImage.get(), verbose );
+        if ( hr == S_FALSE || FAILED( hr ) ) {
+            hr = pData
+                ? LoadFromWICMemory( pData, dataSize, wicFlags, nullptr, *pInputImage.get() )
+                : LoadFromWICFile( szFile, wicFlags, nullptr, *pInputImage.get() );
+        }
         if ( FAILED( hr ) ) {
             std::cerr << "Failed to load WIC image!" << std::endl;
             return hr;
@@ -71,52 +255,91 @@ HRESULT LoadImageWithSRGB( const wchar_t *szFile, SRGB_INPUT srgb, DXGI_FORMAT f
         PrintDebugMetadata( "Input", pInputImage->GetMetadata() );
     }
 
+    return 0;
+}
 
-    // Actually convert image to destination SRGB type
-    if ( srgbOut != IsSRGB( pInputImage->GetMetadata().format ) ) {
-        auto pConvImage = std::make_unique<ScratchImage>();
-        HRESULT hr = Convert(
-            pInputImage->GetImages(),
-            pInputImage->GetImageCount(),
-            pInputImage->GetMetadata(),
-            srgbOut ? MakeSRGB( pInputImage->GetMetadata().format ) : MakeLinear( pInputImage->GetMetadata().format ),
-            TEX_FILTER_DEFAULT,
-            TEX_THRESHOLD_DEFAULT,
-            *pConvImage.get()
-        );
-        if ( FAILED( hr ) ) {
-            std::cerr << "Failed to convert image to SRGB!" << std::endl;
-            return hr;
-        }
+HRESULT LoadImageWithSRGB( const Image &image, SRGB_INPUT srgb, std::unique_ptr<ScratchImage> &pInputImage, bool verbose )
+{
+    HRESULT hr = pInputImage->InitializeFromImage( image );
+    if ( FAILED( hr ) ) {
+        std::cerr << "Failed to copy image!" << std::endl;
+        return hr;
+    }
 
-        if ( verbose ) {
-            PrintDebugMetadata( "Output SRGB Conv", pConvImage->GetMetadata() );
-        }
+    // The pixel format carries the caller's encoding, the FORCE policies override it like file tags
+    auto format = pInputImage->GetMetadata().format;
+    if ( srgb == FORCE_SRGB && !IsSRGB( format ) ) {
+        pInputImage->OverrideFormat( MakeSRGB( format ) );
+    }
+    if ( srgb == FORCE_LINEAR && IsSRGB( format ) ) {
+        pInputImage->OverrideFormat( MakeLinear( format ) );
+    }
 
-        pInputImage.swap( pConvImage );
+    if ( verbose ) {
+        PrintDebugMetadata( "Input", pInputImage->GetMetadata() );
     }
 
     return 0;
 }
 
-HRESULT ResizeImage( int width, int height, std::unique_ptr<ScratchImage> &pInputImage, DXGI_FORMAT formatOut )
+size_t PowerOfTwoReduction( size_t srcWidth, size_t srcHeight, size_t width, size_t height )
+{
+    size_t levels = 0;
+    while ( srcWidth > width && srcHeight > height && srcWidth % 2 == 0 && srcHeight % 2 == 0 ) {
+        srcWidth /= 2;
+        srcHeight /= 2;
+        ++levels;
+    }
+
+    return ( srcWidth == width && srcHeight == height ) ? levels : 0;
+}
+
+HRESULT GetImageHeader( const wchar_t *szFile, TexMetadata &metadata )
+{
+    auto ext = std::filesystem::path( szFile ).extension().string();
+    if ( ext == ".tga" || ext == ".TGA" ) {
+        return GetMetadataFromTGAFile( szFile, TGA_FLAGS_NONE, metadata );
+    }
+
+    return GetMetadataFromWICFile( szFile, WIC_FLAGS_FORCE_RGB, metadata );
+}
+
+HRESULT ResizeImage( int width, int height, std::unique_ptr<ScratchImage> &pInputImage, DXGI_FORMAT formatOut, RESIZE_FILTER filter )
 {
     auto flags = TEX_FILTER_DEFAULT;
 
-    if ( MakeTypeless( formatOut ) == DXGI_FORMAT_BC7_TYPELESS ) flags |= TEX_FILTER_SEPARATE_ALPHA;
+    bool separateAlpha = MakeTypeless( formatOut ) == DXGI_FORMAT_BC7_TYPELESS;
+    if ( separateAlpha ) flags |= TEX_FILTER_SEPARATE_ALPHA;
 
 
     if ( width != -1 || height != -1 ) {
+        size_t srcWidth = pInputImage->GetMetadata().width;
+        size_t srcHeight = pInputImage->GetMetadata().height;
+        size_t targetWidth = width == -1 ? srcWidth : width;
+        size_t targetHeight = height == -1 ? srcHeight : height;
+
+        // Reduced-resolution decode may already have landed on the target size
+        if ( targetWidth == srcWidth && targetHeight == srcHeight ) return 0;
+
         auto pResizeImage = std::make_unique<ScratchImage>();
-        HRESULT hr = Resize(
-            pInputImage->GetImages(),
-            pInputImage->GetImageCount(),
-            pInputImage->GetMetadata(),
-            width == -1 ? pInputImage->GetMetadata().width : width,
-            height == -1 ? pInputImage->GetMetadata().height : height,
-            flags,
-            *pResizeImage.get()
-        );
+        HRESULT hr = S_FALSE;
+
+        // Formats the built-in resampler doesn't read fall back to DirectXTex
+        if ( filter != RESIZE_FILTER_DEFAULT ) {
+            hr = ResampleImage( *pInputImage->GetImage( 0, 0, 0 ), targetWidth, targetHeight, filter, separateAlpha, *pResizeImage.get() );
+        }
+
+        if ( hr == S_FALSE ) {
+            hr = Resize(
+                pInputImage->GetImages(),
+                pInputImage->GetImageCount(),
+                pInputImage->GetMetadata(),
+                targetWidth,
+                targetHeight,
+                flags,
+                *pResizeImage.get()
+            );
+        }
         if ( FAILED( hr ) ) {
             return hr;
         }
@@ -150,23 +373,119 @@ void _InvertChannel( const Image *pOutputSlice )
     }
 }
 
-HRESULT ExtractChannel( const std::unique_ptr<ScratchImage> &pInputImage, char swizzle, std::unique_ptr<ScratchImage> &pOutputSlice )
+// v * scale + bias over one row, in storage units. Integers round and saturate to their
+// normalized range, floats pass through unclamped so HDR values survive.
+template<typename T>
+void _RemapRow( T *row, size_t width, float scale, float bias )
+{
+    if constexpr ( std::is_floating_point_v<T> ) {
+        for ( size_t x = 0; x < width; ++x ) {
+            row[x] = row[x] * scale + bias;
+        }
+    } else {
+        const float lo = TypeMin<T>();
+        const float hi = TypeMax<T>();
+        for ( size_t x = 0; x < width; ++x ) {
+            float v = std::clamp( row[x] * scale + bias, lo, hi );
+            row[x] = static_cast<T>( v >= 0.0f ? v + 0.5f : v - 0.5f );
+        }
+    }
+}
+
+template<typename T>
+void _RemapChannel( const Image *pOutputSlice, float scale, float bias )
+{
+    bias = bias * TypeMax<T>();
+
+    for ( size_t y = 0; y < pOutputSlice->height; ++y ) {
+        auto row = reinterpret_cast<T *>( pOutputSlice->pixels + y * pOutputSlice->rowPitch );
+        _RemapRow<T>( row, pOutputSlice->width, scale, bias );
+    }
+}
+
+// Half rows are widened to float in a scratch row, remapped and narrowed back
+void _RemapHalfChannel( const Image *pOutputSlice, float scale, float bias )
+{
+    using namespace DirectX::PackedVector;
+
+    if ( scale == 0.0f ) {
+        HALF fillVal = XMConvertFloatToHalf( bias );
+        for ( size_t y = 0; y < pOutputSlice->height; ++y ) {
+            auto row = reinterpret_cast<HALF *>( pOutputSlice->pixels + y * pOutputSlice->rowPitch );
+            std::fill_n( row, pOutputSlice->width, fillVal );
+        }
+        return;
+    }
+
+    std::vector<float> scratch( pOutputSlice->width );
+
+    for ( size_t y = 0; y < pOutputSlice->height; ++y ) {
+        auto row = reinterpret_cast<HALF *>( pOutputSlice->pixels + y * pOutputSlice->rowPitch );
+        XMConvertHalfToFloatStream( scratch.data(), sizeof( float ), row, sizeof( HALF ), pOutputSlice->width );
+        _RemapRow<float>( scratch.data(), pOutputSlice->width, scale, bias );
+        XMConvertFloatToHalfStream( row, sizeof( HALF ), scratch.data(), sizeof( float ), pOutputSlice->width );
+    }
+}
+
+template<typename T>
+void _RemapChannelFast( const Image *pOutputSlice, float scale, float bias )
+{
+    if ( scale == 0.0f ) {
+        _FillChannel<T>( pOutputSlice, bias );
+        return;
+    }
+
+    if constexpr ( std::is_unsigned_v<T> ) {
+        if ( scale == -1.0f && bias == 1.0f ) {
+            _InvertChannel<T>( pOutputSlice );
+            return;
+        }
+    }
+
+    _RemapChannel<T>( pOutputSlice, scale, bias );
+}
+
+HRESULT RemapChannel( const Image &slice, float scale, float bias )
+{
+    switch ( slice.format ) {
+        case DXGI_FORMAT_R8_UNORM: _RemapChannelFast<uint8_t>( &slice, scale, bias ); break;
+        case DXGI_FORMAT_R16_UNORM: _RemapChannelFast<uint16_t>( &slice, scale, bias ); break;
+        case DXGI_FORMAT_R8_SNORM: _RemapChannelFast<int8_t>( &slice, scale, bias ); break;
+        case DXGI_FORMAT_R16_SNORM: _RemapChannelFast<int16_t>( &slice, scale, bias ); break;
+        case DXGI_FORMAT_R32_FLOAT: _RemapChannelFast<float>( &slice, scale, bias ); break;
+        case DXGI_FORMAT_R16_FLOAT: _RemapHalfChannel( &slice, scale, bias ); break;
+
+        default:
+            std::cerr << "Unsupported format: " << LookupByValue( slice.format, g_pFormats ) << "!" << std::endl;
+            return E_FAIL;
+    }
+
+    return 0;
+}
+
+HRESULT ExtractChannel( const std::unique_ptr<ScratchImage> &pInputImage, const ChannelSwizzle &channel, bool srgbOut, std::unique_ptr<ScratchImage> &pOutputSlice )
 {
-    auto singleChannelFormat = CreateOutputFormat( pInputImage->GetMetadata().format, 1 );
+    auto inputFormat = pInputImage->GetMetadata().format;
+    auto singleChannelFormat = CreateOutputFormat( inputFormat, 1 );
 
+    // Only 8-bit UNORM colour changes encoding. Convert decodes before the channel copy and encodes
+    // after it, so an encode would also hit alpha; setting both flags cancels the conversion.
     TEX_FILTER_FLAGS channelFlags = TEX_FILTER_DEFAULT | TEX_FILTER_FORCE_NON_WIC;
-    if ( IsSRGB( pInputImage->GetMetadata().format ) ) {
+    bool reencode = srgbOut != IsSRGB( inputFormat ) && MakeSRGB( inputFormat ) != MakeLinear( inputFormat ) && channel.swizzle != 'a';
+    if ( !reencode ) {
         channelFlags |= TEX_FILTER_SRGB;
     }
+    else if ( srgbOut ) {
+        channelFlags |= TEX_FILTER_SRGB_OUT;
+    }
 
     bool fill = false;
     float fillVal;
-    bool invert = false;
+    bool invert = channel.invert;
 
-    switch ( swizzle ) {
+    switch ( channel.swizzle ) {
         case 'r': channelFlags |= TEX_FILTER_RGB_COPY_RED; break;
         case 'g': channelFlags |= TEX_FILTER_RGB_COPY_GREEN; break;
-        case 'G': channelFlags |= TEX_FILTER_RGB_COPY_GREEN; invert = true; break;
         case 'b': channelFlags |= TEX_FILTER_RGB_COPY_BLUE; break;
         case 'a': channelFlags |= TEX_FILTER_RGB_COPY_ALPHA; break;
 
@@ -186,7 +505,7 @@ HRESULT ExtractChannel( const std::unique_ptr<ScratchImage> &pInputImage, char s
             break;
 
         default:
-            std::cerr << "Unknown swizzle: " << swizzle << std::endl;
+            std::cerr << "Unknown swizzle: " << channel.swizzle << std::endl;
             return E_FAIL;
     }
 
@@ -204,51 +523,24 @@ HRESULT ExtractChannel( const std::unique_ptr<ScratchImage> &pInputImage, char s
         return hr;
     }
 
-    auto bitDepth = BitsPerColor( pOutputSlice->GetMetadata().format );
-    auto formatType = FormatDataType( pOutputSlice->GetMetadata().format );
-
     if ( fill ) {
-        switch ( formatType ) {
-            case FORMAT_TYPE_UNORM:
-                if ( bitDepth == 8 ) {
-                    _FillChannel<uint8_t>( pOutputSlice->GetImages(), fillVal );
-                    break;
-                }
-
-                if ( bitDepth == 16 ) {
-                    _FillChannel<uint16_t>( pOutputSlice->GetImages(), fillVal );
-                    break;
-                }
-
-                std::cerr << "Unsupported bitdepth!" << std::endl;
-                return E_FAIL;
-
-            default:
-                std::cerr << "Unsupported format!" << std::endl;
-                return E_FAIL;
+        hr = RemapChannel( *pOutputSlice->GetImages(), 0.0f, fillVal );
+        if ( FAILED( hr ) ) {
+            return hr;
         }
     }
 
-    if ( invert ) {
-        switch ( formatType ) {
-            case FORMAT_TYPE_UNORM:
-                if ( bitDepth == 8 ) {
-                    _InvertChannel<uint8_t>( pOutputSlice->GetImages() );
-                    break;
-                }
-
-                if ( bitDepth == 16 ) {
-                    _InvertChannel<uint16_t>( pOutputSlice->GetImages() );
-                    break;
-                }
-
-                std::cerr << "Unsupported bitdepth!" << std::endl;
-                return E_FAIL;
-
-            default:
-                std::cerr << "Unsupported format!" << std::endl;
-                return E_FAIL;
+    // Inverting mirrors the value in the normalized range: 1 - v for UNORM and float, -v for SNORM
+    if ( invert || channel.HasRemap() ) {
+        float scale = channel.scale;
+        float bias = channel.bias;
+        if ( invert ) {
+            float invertBias = FormatDataType( pOutputSlice->GetMetadata().format ) == FORMAT_TYPE_SNORM ? 0.0f : 1.0f;
+            bias += invertBias * scale;
+            scale = -scale;
         }
+
+        return RemapChannel( *pOutputSlice->GetImages(), scale, bias );
     }
 
     return 0;
@@ -275,8 +567,108 @@ bool EnsureCompatibleChannelSlices( const std::vector<std::unique_ptr<ScratchIma
     return true;
 }
 
+float SRGBToLinear( float c )
+{
+    return c <= 0.04045f ? c / 12.92f : std::pow( ( c + 0.055f ) / 1.055f, 2.4f );
+}
+
+float LinearToSRGB( float c )
+{
+    return c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow( c, 1.0f / 2.4f ) - 0.055f;
+}
+
+const float *SRGBToLinearTable()
+{
+    static const auto s_table = [] {
+        std::array<float, 256> table;
+        for ( size_t i = 0; i < table.size(); ++i ) {
+            table[i] = SRGBToLinear( i / 255.0f );
+        }
+        return table;
+    }();
+
+    return s_table.data();
+}
+
+const uint8_t *SRGBConversionTable( bool toLinear )
+{
+    static const auto s_tables = [] {
+        std::array<std::array<uint8_t, 256>, 2> tables;
+        for ( size_t i = 0; i < 256; ++i ) {
+            tables[0][i] = static_cast<uint8_t>( LinearToSRGB( i / 255.0f ) * 255.0f + 0.5f );
+            tables[1][i] = static_cast<uint8_t>( SRGBToLinear( i / 255.0f ) * 255.0f + 0.5f );
+        }
+        return tables;
+    }();
+
+    return s_tables[toLinear ? 1 : 0].data();
+}
+
+uint8_t LinearToSRGB8( float linear )
+{
+    // 12-bit linear input keeps the round trip within one code of the exact encode
+    static const auto s_table = [] {
+        std::array<uint8_t, 4096> table;
+        for ( size_t i = 0; i < table.size(); ++i ) {
+            float srgb = LinearToSRGB( i / 4095.0f );
+            table[i] = static_cast<uint8_t>( std::clamp( srgb * 255.0f + 0.5f, 0.0f, 255.0f ) );
+        }
+        return table;
+    }();
+
+    return s_table[static_cast<size_t>( std::clamp( linear, 0.0f, 1.0f ) * 4095.0f + 0.5f )];
+}
+
+// Premultiplies one RGBA row in place. sRGB colour is multiplied in linear space and re-encoded.
 template<typename T>
-void _CombineChannels( const std::vector<std::unique_ptr<ScratchImage>> &slices, const Image *pOutputSlice )
+void _PremultiplyRow( T *row, size_t width, bool srgb );
+
+template<>
+void _PremultiplyRow( uint8_t *row, size_t width, bool srgb )
+{
+    if ( srgb ) {
+        auto toLinear = SRGBToLinearTable();
+        for ( size_t x = 0; x < width; ++x ) {
+            auto pixel = row + x * 4;
+
+            // The sRGB round trip isn't exact, so opaque texels are left untouched
+            if ( pixel[3] == 255 ) continue;
+
+            float alpha = pixel[3] / 255.0f;
+            pixel[0] = LinearToSRGB8( toLinear[pixel[0]] * alpha );
+            pixel[1] = LinearToSRGB8( toLinear[pixel[1]] * alpha );
+            pixel[2] = LinearToSRGB8( toLinear[pixel[2]] * alpha );
+        }
+        return;
+    }
+
+    // Exact rounded c * a / 255 in integer math so the loop vectorizes
+    for ( size_t x = 0; x < width; ++x ) {
+        auto pixel = row + x * 4;
+        uint32_t alpha = pixel[3];
+        for ( size_t c = 0; c < 3; ++c ) {
+            uint32_t v = pixel[c] * alpha + 128;
+            pixel[c] = static_cast<uint8_t>( ( v + ( v >> 8 ) ) >> 8 );
+        }
+    }
+}
+
+// 16-bit UNORM formats have no sRGB variant, so there is only the integer path
+template<>
+void _PremultiplyRow( uint16_t *row, size_t width, bool )
+{
+    for ( size_t x = 0; x < width; ++x ) {
+        auto pixel = row + x * 4;
+        uint32_t alpha = pixel[3];
+        for ( size_t c = 0; c < 3; ++c ) {
+            uint32_t v = pixel[c] * alpha + 32768;
+            pixel[c] = static_cast<uint16_t>( ( v + ( v >> 16 ) ) >> 16 );
+        }
+    }
+}
+
+template<typename T>
+void _CombineChannels( const std::vector<std::unique_ptr<ScratchImage>> &slices, const Image *pOutputSlice, bool premultiplyAlpha, bool srgb )
 {
     for ( size_t y = 0; y < pOutputSlice->height; ++y ) {
         auto outRow = reinterpret_cast<T *>( pOutputSlice->pixels + y * pOutputSlice->rowPitch );
@@ -289,17 +681,20 @@ void _CombineChannels( const std::vector<std::unique_ptr<ScratchImage>> &slices,
                 outRow[x * slices.size() + c] = inRow[x];
             }
         }
+
+        // Premultiply while the freshly packed row is still in cache
+        if constexpr ( sizeof( T ) <= 2 ) {
+            if ( premultiplyAlpha ) {
+                _PremultiplyRow<T>( outRow, pOutputSlice->width, srgb );
+            }
+        }
     }
 }
 
-HRESULT CombineChannelSlices( const std::vector<std::unique_ptr<ScratchImage>> &slices, DXGI_FORMAT formatOut, std::unique_ptr<ScratchImage> &pCombinerImage, bool verbose )
+// Creates the packed image for channels of type channelFormat, validating the premultiply requirements
+HRESULT _CreateCombinerImage( DXGI_FORMAT channelFormat, size_t width, size_t height, size_t channels, DXGI_FORMAT formatOut, bool premultiplyAlpha, std::unique_ptr<ScratchImage> &pCombinerImage )
 {
-    if ( !EnsureCompatibleChannelSlices( slices ) ) {
-        std::cerr << "Channel slices aren't in compatible formats!" << std::endl;
-        return E_FAIL;
-    }
-
-    DXGI_FORMAT combinerFormat = CreateOutputFormat( slices[0]->GetMetadata().format, slices.size() );
+    DXGI_FORMAT combinerFormat = CreateOutputFormat( channelFormat, channels );
     if ( combinerFormat == DXGI_FORMAT_UNKNOWN ) {
         std::cerr << "Unknown input format!" << std::endl;
         return E_FAIL;
@@ -308,20 +703,65 @@ HRESULT CombineChannelSlices( const std::vector<std::unique_ptr<ScratchImage>> &
         combinerFormat = MakeSRGB( combinerFormat );
     }
 
-    HRESULT hr = pCombinerImage->Initialize2D( combinerFormat, slices[0]->GetMetadata().width, slices[0]->GetMetadata().height, 1, 1 );
+    if ( premultiplyAlpha ) {
+        if ( channels != 4 ) {
+            std::cerr << "Premultiplied alpha requires 4 channels!" << std::endl;
+            return E_FAIL;
+        }
+        if ( FormatDataType( combinerFormat ) != FORMAT_TYPE_UNORM ) {
+            std::cerr << "Premultiplied alpha requires a UNORM format!" << std::endl;
+            return E_FAIL;
+        }
+    }
+
+    TexMetadata mdata = {};
+    mdata.width = width;
+    mdata.height = height;
+    mdata.depth = 1;
+    mdata.arraySize = 1;
+    mdata.mipLevels = 1;
+    mdata.format = combinerFormat;
+    mdata.dimension = TEX_DIMENSION_TEXTURE2D;
+    if ( premultiplyAlpha ) {
+        mdata.SetAlphaMode( TEX_ALPHA_MODE_PREMULTIPLIED );
+    }
+
+    HRESULT hr = pCombinerImage->Initialize( mdata );
     if ( FAILED( hr ) ) {
         std::cerr << "Could not create combiner image!" << std::endl;
         return hr;
     }
 
+    return 0;
+}
+
+HRESULT CombineChannelSlices( const std::vector<std::unique_ptr<ScratchImage>> &slices, DXGI_FORMAT formatOut, bool premultiplyAlpha, std::unique_ptr<ScratchImage> &pCombinerImage, bool verbose )
+{
+    if ( !EnsureCompatibleChannelSlices( slices ) ) {
+        std::cerr << "Channel slices aren't in compatible formats!" << std::endl;
+        return E_FAIL;
+    }
+
+    const auto &sliceInfo = slices[0]->GetMetadata();
+    HRESULT hr = _CreateCombinerImage( sliceInfo.format, sliceInfo.width, sliceInfo.height, slices.size(), formatOut, premultiplyAlpha, pCombinerImage );
+    if ( FAILED( hr ) ) {
+        return hr;
+    }
+
+    bool srgb = IsSRGB( pCombinerImage->GetMetadata().format );
+
     auto bitDepth = BitsPerColor( pCombinerImage->GetMetadata().format );
     switch ( bitDepth ) {
         case 8:
-            _CombineChannels<uint8_t>( slices, pCombinerImage->GetImages() );
+            _CombineChannels<uint8_t>( slices, pCombinerImage->GetImages(), premultiplyAlpha, srgb );
             break;
 
         case 16:
-            _CombineChannels<uint16_t>( slices, pCombinerImage->GetImages() );
+            _CombineChannels<uint16_t>( slices, pCombinerImage->GetImages(), premultiplyAlpha, srgb );
+            break;
+
+        case 32:
+            _CombineChannels<uint32_t>( slices, pCombinerImage->GetImages(), premultiplyAlpha, srgb );
             break;
 
         default:
@@ -336,70 +776,420 @@ HRESULT CombineChannelSlices( const std::vector<std::unique_ptr<ScratchImage>> &
     return 0;
 }
 
-HRESULT GenerateMipMapChain( DXGI_FORMAT format, std::unique_ptr<ScratchImage> &pCombinerImage, std::unique_ptr<ScratchImage> &pMipMapImage, bool verbose )
+// One packed channel: the source row layout for extracted channels, or the constant for fills.
+// lut re-encodes sources whose sRGB-ness differs from the combiner.
+template<typename T>
+struct SPackSource
+{
+    const uint8_t *pixels;
+    size_t rowPitch;
+    size_t offset;
+    T fill;
+    const T *lut;
+};
+
+template<typename T, size_t C, uint32_t InvertMask, uint32_t FillMask>
+inline T _PackTexel( const T *const *rows, const SPackSource<T> *sources, size_t x )
+{
+    if constexpr ( ( FillMask >> C ) & 1 ) {
+        return sources[C].fill;
+    }
+    else {
+        T v = sources[C].lut ? sources[C].lut[rows[C][x * 4]] : rows[C][x * 4];
+        if constexpr ( ( InvertMask >> C ) & 1 ) {
+            v = static_cast<T>( TypeMax<T>() - v );
+        }
+        return v;
+    }
+}
+
+// Packs N channels straight from 4-channel UNORM sources. Layout and ops are template
+// constants, so the per-texel channel loop unrolls and the branches fold away.
+template<typename T, size_t N, uint32_t InvertMask, uint32_t FillMask>
+void _PackKernel( const SPackSource<T> *sources, const Image *pOutputSlice, bool premultiplyAlpha, bool srgb )
+{
+    for ( size_t y = 0; y < pOutputSlice->height; ++y ) {
+        auto outRow = reinterpret_cast<T *>( pOutputSlice->pixels + y * pOutputSlice->rowPitch );
+
+        const T *rows[N];
+        for ( size_t c = 0; c < N; ++c ) {
+            rows[c] = reinterpret_cast<const T *>( sources[c].pixels + y * sources[c].rowPitch ) + sources[c].offset;
+        }
+
+        for ( size_t x = 0; x < pOutputSlice->width; ++x ) {
+            [&]<size_t... C>( std::index_sequence<C...> ) {
+                ( ( outRow[x * N + C] = _PackTexel<T, C, InvertMask, FillMask>( rows, sources, x ) ), ... );
+            }( std::make_index_sequence<N>() );
+        }
+
+        if constexpr ( N == 4 ) {
+            if ( premultiplyAlpha ) {
+                _PremultiplyRow<T>( outRow, pOutputSlice->width, srgb );
+            }
+        }
+    }
+}
+
+template<typename T>
+using PackKernel = void ( * )( const SPackSource<T> *, const Image *, bool, bool );
+
+struct SPackLayout
+{
+    size_t channels;
+    uint32_t invertMask;
+    uint32_t fillMask;
+    PackKernel<uint8_t> pack8;
+    PackKernel<uint16_t> pack16;
+};
+
+#define DEFPACK(n, invert, fill) { n, invert, fill, _PackKernel<uint8_t, n, invert, fill>, _PackKernel<uint16_t, n, invert, fill> }
+const SPackLayout g_pPackLayouts[] =
+{
+    DEFPACK( 4, 0b0000, 0b0000 ), // RGBA passthrough, ORM + mask
+    DEFPACK( 4, 0b0000, 0b1000 ), // ORM / RGB with constant alpha
+    DEFPACK( 4, 0b0000, 0b1100 ), // Normal XY + fill
+    DEFPACK( 4, 0b0010, 0b1100 ), // Normal XY with flipped green + fill
+    DEFPACK( 2, 0b00, 0b00 ),     // Normal XY
+    DEFPACK( 2, 0b10, 0b00 ),     // Normal XY with flipped green
+    DEFPACK( 1, 0b0, 0b0 ),       // Mask
+    DEFPACK( 1, 0b1, 0b0 ),       // Inverted mask
+};
+#undef DEFPACK
+
+// Offset of a swizzle channel within an RGBA/BGRA texel, or -1 for fills
+int _SwizzleOffset( char swizzle, DXGI_FORMAT format )
+{
+    switch ( swizzle ) {
+        case 'r': return IsBGR( format ) ? 2 : 0;
+        case 'g': return 1;
+        case 'b': return IsBGR( format ) ? 0 : 2;
+        case 'a': return 3;
+        default: return -1;
+    }
+}
+
+float _SwizzleFill( char swizzle )
+{
+    switch ( swizzle ) {
+        case '1': return 1.0f;
+        case 'h': return 0.5f;
+        default: return 0.0f;
+    }
+}
+
+template<typename T>
+HRESULT _PackChannels( const std::vector<const ScratchImage *> &sources, const std::vector<ChannelSwizzle> &channels, PackKernel<T> kernel, const Image *pOutputSlice, bool premultiplyAlpha, bool srgb )
+{
+    SPackSource<T> packSources[4] = {};
+
+    for ( size_t c = 0; c < channels.size(); ++c ) {
+        auto image = sources[c]->GetImages();
+        auto offset = _SwizzleOffset( channels[c].swizzle, image->format );
+
+        packSources[c].pixels = image->pixels;
+        packSources[c].rowPitch = image->rowPitch;
+        packSources[c].offset = offset < 0 ? 0 : offset;
+
+        // Only 8-bit formats have sRGB variants, alpha is never encoded
+        if constexpr ( sizeof( T ) == 1 ) {
+            if ( offset >= 0 && offset != 3 && IsSRGB( image->format ) != srgb ) {
+                packSources[c].lut = SRGBConversionTable( IsSRGB( image->format ) );
+            }
+        }
+
+        // Same quantization as the fill then invert of ExtractChannel
+        float fill = std::clamp<float>( _SwizzleFill( channels[c].swizzle ) * TypeMax<T>(), TypeMin<T>(), TypeMax<T>() );
+        packSources[c].fill = static_cast<T>( fill );
+        if ( channels[c].invert ) {
+            packSources[c].fill = static_cast<T>( TypeMax<T>() - packSources[c].fill );
+        }
+    }
+
+    kernel( packSources, pOutputSlice, premultiplyAlpha, srgb );
+
+    return 0;
+}
+
+HRESULT PackChannels( const std::vector<const ScratchImage *> &sources, const std::vector<ChannelSwizzle> &channels, DXGI_FORMAT formatOut, bool premultiplyAlpha, std::unique_ptr<ScratchImage> &pCombinerImage, bool verbose )
 {
-    TEX_FILTER_FLAGS mipFlags = TEX_FILTER_DEFAULT | TEX_FILTER_WRAP;
+    if ( sources.empty() || sources.size() != channels.size() ) return E_INVALIDARG;
+
+    // Specialized kernels read 4-channel UNORM texels directly and only cover plain swizzles
+    const auto &info = sources[0]->GetMetadata();
+    auto bitDepth = BitsPerColor( info.format );
+
+    uint32_t invertMask = 0;
+    uint32_t fillMask = 0;
+
+    for ( size_t c = 0; c < channels.size(); ++c ) {
+        const auto &sourceInfo = sources[c]->GetMetadata();
+
+        switch ( MakeLinear( sourceInfo.format ) ) {
+            case DXGI_FORMAT_R8G8B8A8_UNORM:
+            case DXGI_FORMAT_B8G8R8A8_UNORM:
+            case DXGI_FORMAT_R16G16B16A16_UNORM:
+                break;
+
+            default:
+                return S_FALSE;
+        }
+
+        if ( BitsPerColor( sourceInfo.format ) != bitDepth ) return S_FALSE;
+        if ( sourceInfo.width != info.width || sourceInfo.height != info.height ) return S_FALSE;
+        if ( channels[c].HasRemap() ) return S_FALSE;
+
+        if ( _SwizzleOffset( channels[c].swizzle, sourceInfo.format ) < 0 ) {
+            fillMask |= 1u << c;
+        }
+        else if ( channels[c].invert ) {
+            invertMask |= 1u << c;
+        }
+    }
 
-    if ( MakeTypeless( format ) == DXGI_FORMAT_BC7_TYPELESS ) mipFlags |= TEX_FILTER_SEPARATE_ALPHA;
-    if ( IsSRGB( format ) ) mipFlags |= TEX_FILTER_FORCE_WIC;
+    const SPackLayout *pLayout = nullptr;
+    for ( const auto &layout : g_pPackLayouts ) {
+        if ( layout.channels == channels.size() && layout.invertMask == invertMask && layout.fillMask == fillMask ) {
+            pLayout = &layout;
+            break;
+        }
+    }
+    if ( !pLayout ) return S_FALSE;
 
-    HRESULT hr = GenerateMipMaps( pCombinerImage->GetImages(), pCombinerImage->GetImageCount(), pCombinerImage->GetMetadata(), mipFlags, 0, *pMipMapImage.get() );
+    HRESULT hr = _CreateCombinerImage( info.format, info.width, info.height, channels.size(), formatOut, premultiplyAlpha, pCombinerImage );
+    if ( FAILED( hr ) ) {
+        return hr;
+    }
+
+    bool srgb = IsSRGB( pCombinerImage->GetMetadata().format );
+
+    if ( bitDepth == 8 ) {
+        hr = _PackChannels<uint8_t>( sources, channels, pLayout->pack8, pCombinerImage->GetImages(), premultiplyAlpha, srgb );
+    }
+    else {
+        hr = _PackChannels<uint16_t>( sources, channels, pLayout->pack16, pCombinerImage->GetImages(), premultiplyAlpha, srgb );
+    }
     if ( FAILED( hr ) ) {
         return hr;
     }
 
     if ( verbose ) {
-        auto mip = pMipMapImage->GetMetadata().mipLevels - 1;
-        std::cout << "Last uncompressed MIP channel values: "
-            << int( pMipMapImage->GetImage( mip, 0, 0 )->pixels[0] ) << " "
-            << int( pMipMapImage->GetImage( mip, 0, 0 )->pixels[1] ) << " "
-            << int( pMipMapImage->GetImage( mip, 0, 0 )->pixels[2] ) << " "
-            << int( pMipMapImage->GetImage( mip, 0, 0 )->pixels[3] ) << std::endl;
+        PrintDebugMetadata( "Combiner", pCombinerImage->GetMetadata() );
     }
 
     return 0;
 }
 
+HRESULT BlitImage( const Image &src, const Image &dst, size_t x, size_t y )
+{
+    if ( src.format != dst.format || IsCompressed( src.format ) ) return E_INVALIDARG;
+    if ( x + src.width > dst.width || y + src.height > dst.height ) return E_INVALIDARG;
+
+    auto bytesPerPixel = BitsPerPixel( src.format ) / 8;
+
+    for ( size_t row = 0; row < src.height; ++row ) {
+        memcpy( dst.pixels + ( y + row ) * dst.rowPitch + x * bytesPerPixel, src.pixels + row * src.rowPitch, src.width * bytesPerPixel );
+    }
+
+    return 0;
+}
 
-bool _RequiresGPU( DXGI_FORMAT format )
+size_t ClampAtlasMipLevels( const std::vector<std::pair<size_t, size_t>> &sizes, size_t mipLevels )
 {
-    if ( MakeTypeless( format ) == DXGI_FORMAT_BC6H_TYPELESS ) return true;
-    if ( MakeTypeless( format ) == DXGI_FORMAT_BC7_TYPELESS ) return true;
-    return false;
+    size_t largest = 1;
+    for ( const auto &[w, h] : sizes ) {
+        largest = std::max( { largest, w, h } );
+    }
+
+    size_t levels = 1;
+    while ( ( largest >> levels ) > 0 ) ++levels;
+
+    return std::min( mipLevels, levels );
 }
 
-HRESULT CompressImage( ID3D11Device *pDevice, DXGI_FORMAT format, std::unique_ptr<ScratchImage> &pMipMapImage, std::unique_ptr<ScratchImage> &pCompressedImage, bool verbose )
+void PackAtlasRects( const std::vector<std::pair<size_t, size_t>> &sizes, size_t alignment, size_t &width, size_t &height, std::vector<std::pair<size_t, size_t>> &offsets )
 {
-    HRESULT hr;
+    auto align = [alignment]( size_t v ) { return ( v + alignment - 1 ) / alignment * alignment; };
 
-    if ( _RequiresGPU( format ) ) {
-        hr = Compress(
-            pDevice,
-            pMipMapImage->GetImages(),
-            pMipMapImage->GetImageCount(),
-            pMipMapImage->GetMetadata(),
-            format,
-            TEX_COMPRESS_PARALLEL,
-            TEX_ALPHA_WEIGHT_DEFAULT,
-            *pCompressedImage.get()
-        );
+    size_t maxWidth = 0;
+    size_t area = 0;
+    for ( const auto &[w, h] : sizes ) {
+        maxWidth = std::max( maxWidth, align( w ) );
+        area += align( w ) * align( h );
     }
-    else {
-        hr = Compress(
-            pMipMapImage->GetImages(),
-            pMipMapImage->GetImageCount(),
-            pMipMapImage->GetMetadata(),
-            format,
-            TEX_COMPRESS_PARALLEL,
-            TEX_THRESHOLD_DEFAULT,
-            *pCompressedImage.get()
-        );
+
+    // Square-ish power-of-two width that fits the widest member
+    width = 1;
+    while ( width * width < area || width < maxWidth ) width *= 2;
+
+    // Shelf packing, tallest first, ties broken by index so the layout is deterministic
+    std::vector<size_t> order( sizes.size() );
+    for ( size_t i = 0; i < order.size(); ++i ) order[i] = i;
+    std::stable_sort( order.begin(), order.end(), [&]( size_t a, size_t b ) { return align( sizes[a].second ) > align( sizes[b].second ); } );
+
+    offsets.assign( sizes.size(), { 0, 0 } );
+
+    size_t x = 0;
+    size_t y = 0;
+    size_t shelfHeight = 0;
+    for ( auto i : order ) {
+        auto w = align( sizes[i].first );
+        auto h = align( sizes[i].second );
+
+        if ( x + w > width ) {
+            y += shelfHeight;
+            x = 0;
+            shelfHeight = 0;
+        }
+
+        offsets[i] = { x, y };
+        x += w;
+        shelfHeight = std::max( shelfHeight, h );
+    }
+
+    height = align( y + shelfHeight );
+}
+
+// One 2x2 box-filtered level from the previous one. sRGB colour is averaged in linear light
+// through the code tables; alpha and linear channels are averaged as integers.
+template<size_t N>
+void _BoxMipLevel8( const Image &src, const Image &dst, bool srgb )
+{
+    auto toLinear = SRGBToLinearTable();
+
+    for ( size_t y = 0; y < dst.height; ++y ) {
+        auto row0 = src.pixels + std::min( y * 2, src.height - 1 ) * src.rowPitch;
+        auto row1 = src.pixels + std::min( y * 2 + 1, src.height - 1 ) * src.rowPitch;
+        auto outRow = dst.pixels + y * dst.rowPitch;
+
+        for ( size_t x = 0; x < dst.width; ++x ) {
+            size_t x0 = std::min( x * 2, src.width - 1 ) * N;
+            size_t x1 = std::min( x * 2 + 1, src.width - 1 ) * N;
+
+            for ( size_t c = 0; c < N; ++c ) {
+                if ( srgb && c < 3 ) {
+                    float sum = toLinear[row0[x0 + c]] + toLinear[row0[x1 + c]] + toLinear[row1[x0 + c]] + toLinear[row1[x1 + c]];
+                    outRow[x * N + c] = LinearToSRGB8( sum * 0.25f );
+                }
+                else {
+                    uint32_t sum = row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c];
+                    outRow[x * N + c] = static_cast<uint8_t>( ( sum + 2 ) >> 2 );
+                }
+            }
+        }
+    }
+}
+
+// Full chain for power-of-two 8-bit UNORM images, where 2x2 boxes are exact. Colour and alpha are
+// averaged separately. S_FALSE for anything else.
+HRESULT _GenerateMipMaps8( const ScratchImage &base, ScratchImage &mipChain )
+{
+    const auto &info = base.GetMetadata();
+
+    size_t channels;
+    switch ( MakeLinear( info.format ) ) {
+        case DXGI_FORMAT_R8_UNORM: channels = 1; break;
+        case DXGI_FORMAT_R8G8_UNORM: channels = 2; break;
+        case DXGI_FORMAT_R8G8B8A8_UNORM: channels = 4; break;
+        case DXGI_FORMAT_B8G8R8A8_UNORM: channels = 4; break;
+        default: return S_FALSE;
     }
 
+    auto isPow2 = []( size_t v ) { return v > 0 && ( v & ( v - 1 ) ) == 0; };
+    if ( info.arraySize != 1 || info.depth != 1 || !isPow2( info.width ) || !isPow2( info.height ) ) return S_FALSE;
+
+    size_t levels = 1;
+    while ( ( info.width >> levels ) > 0 || ( info.height >> levels ) > 0 ) ++levels;
+
+    TexMetadata mdata = info;
+    mdata.mipLevels = levels;
+    HRESULT hr = mipChain.Initialize( mdata );
+    if ( FAILED( hr ) ) {
+        return hr;
+    }
+
+    const auto &top = *base.GetImage( 0, 0, 0 );
+    auto dst = mipChain.GetImage( 0, 0, 0 );
+    for ( size_t y = 0; y < top.height; ++y ) {
+        memcpy( dst->pixels + y * dst->rowPitch, top.pixels + y * top.rowPitch, top.width * channels );
+    }
+
+    bool srgb = IsSRGB( info.format );
+    for ( size_t level = 1; level < levels; ++level ) {
+        const auto &src = *mipChain.GetImage( level - 1, 0, 0 );
+        const auto &out = *mipChain.GetImage( level, 0, 0 );
+
+        switch ( channels ) {
+            case 1: _BoxMipLevel8<1>( src, out, false ); break;
+            case 2: _BoxMipLevel8<2>( src, out, false ); break;
+            default: _BoxMipLevel8<4>( src, out, srgb ); break;
+        }
+    }
+
+    return 0;
+}
+
+HRESULT GenerateMipMapChain( DXGI_FORMAT format, MIP_FILTER filter, std::unique_ptr<ScratchImage> &pCombinerImage, std::unique_ptr<ScratchImage> &pMipMapImage, bool verbose )
+{
+    // The box filter skips DirectXTex's float round trip for 8-bit power-of-two images, premultiplied ones included
+    HRESULT hr = filter == MIP_FILTER_BOX ? _GenerateMipMaps8( *pCombinerImage.get(), *pMipMapImage.get() ) : S_FALSE;
+    if ( hr == S_FALSE ) {
+        TEX_FILTER_FLAGS mipFlags = TEX_FILTER_DEFAULT | TEX_FILTER_WRAP;
+
+        // Premultiplied colour is averaged channel-wise, so no separate alpha pass and no WIC alpha weighting
+        if ( pCombinerImage->GetMetadata().IsPMAlpha() ) {
+            mipFlags |= TEX_FILTER_FORCE_NON_WIC;
+        }
+        else {
+            if ( MakeTypeless( format ) == DXGI_FORMAT_BC7_TYPELESS ) mipFlags |= TEX_FILTER_SEPARATE_ALPHA;
+            if ( IsSRGB( format ) ) mipFlags |= TEX_FILTER_FORCE_WIC;
+        }
+
+        hr = GenerateMipMaps( pCombinerImage->GetImages(), pCombinerImage->GetImageCount(), pCombinerImage->GetMetadata(), mipFlags, 0, *pMipMapImage.get() );
+    }
     if ( FAILED( hr ) ) {
         return hr;
     }
 
+    if ( verbose ) {
+        auto mip = pMipMapImage->GetMetadata().mipLevels - 1;
+        Progress() << "Last uncompressed MIP channel values: "
+            << int( pMipMapImage->GetImage( mip, 0, 0 )->pixels[0] ) << " "
+            << int( pMipMapImage->GetImage( mip, 0, 0 )->pixels[1] ) << " "
+            << int( pMipMapImage->GetImage( mip, 0, 0 )->pixels[2] ) << " "
+            << int( pMipMapImage->GetImage( mip, 0, 0 )->pixels[3] ) << std::endl;
+    }
+
+    return 0;
+}
+
+
+HRESULT CompressImage( CBackendRegistry &backends, DXGI_FORMAT format, float rdoLambda, std::unique_ptr<ScratchImage> &pMipMapImage, std::unique_ptr<ScratchImage> &pCompressedImage, bool verbose )
+{
+    HRESULT hr = backends.Compress( format, pMipMapImage->GetImages(), pMipMapImage->GetImageCount(), pMipMapImage->GetMetadata(), *pCompressedImage.get() );
+
+    if ( FAILED( hr ) ) {
+        return hr;
+    }
+
+    if ( rdoLambda > 0.0f ) {
+        auto lzBefore = EstimateLZSize( *pCompressedImage.get() );
+
+        SRDOStats stats;
+        hr = OptimizeBlocksRDO( *pMipMapImage.get(), *pCompressedImage.get(), rdoLambda, stats );
+        if ( FAILED( hr ) ) {
+            std::cerr << "Failed RDO pass!" << std::endl;
+            return hr;
+        }
+
+        auto lzAfter = EstimateLZSize( *pCompressedImage.get() );
+
+        Progress() << "RDO lambda=" << rdoLambda << ": "
+            << stats.reusedBlocks << "/" << stats.blocks << " blocks reused, "
+            << "DDS " << pCompressedImage->GetPixelsSize() << " bytes, "
+            << "XPRESS " << lzBefore << " -> " << lzAfter << " bytes, "
+            << "PSNR " << stats.PSNRBefore() << " -> " << stats.PSNRAfter() << " dB" << std::endl;
+    }
+
     if ( verbose ) {
         PrintDebugMetadata( "Compressed", pCompressedImage->GetMetadata() );
     }
@@ -542,6 +1332,16 @@ bool GetDXGIFactory( IDXGIFactory1 **pFactory )
 	return SUCCEEDED( s_CreateDXGIFactory1( IID_PPV_ARGS( pFactory ) ) );
 }
 
+bool HasAdapter( int adapter )
+{
+	ComPtr<IDXGIFactory1> dxgiFactory;
+	if ( !GetDXGIFactory( dxgiFactory.GetAddressOf() ) )
+		return false;
+
+	ComPtr<IDXGIAdapter> pAdapter;
+	return SUCCEEDED( dxgiFactory->EnumAdapters( static_cast<UINT>( std::max( adapter, 0 ) ), pAdapter.GetAddressOf() ) );
+}
+
 bool CreateDevice( int adapter, ID3D11Device **pDevice )
 {
 	if ( !pDevice )
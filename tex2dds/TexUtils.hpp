@@ -2,9 +2,20 @@
 
 #define NOMINMAX
 #include <d3d11.h>
+#include <ostream>
+
+// Progress messages of the library go to these streams. Nothing is printed until the host sets them,
+// nullptr silences them again.
+void SetProgressStreams( std::ostream *pOut, std::wostream *pWOut );
+std::ostream &Progress();
+std::wostream &WProgress();
 
 DXGI_FORMAT CreateOutputFormat( DXGI_FORMAT inputFormat, size_t outChannels );
 bool CreateDevice( int adapter, ID3D11Device **pDevice );
+// Enumerates adapter without creating a device
+bool HasAdapter( int adapter );
+
+class CBackendRegistry;
 
 template<typename T> T TypeMax();
 template<typename T> T TypeMin();
@@ -17,10 +28,35 @@ enum SRGB_INPUT
     FORCE_LINEAR
 };
 
+// Filter of the built-in resampler, DEFAULT keeps DirectXTex Resize
+enum RESIZE_FILTER
+{
+    RESIZE_FILTER_DEFAULT,
+    RESIZE_FILTER_BOX,
+    RESIZE_FILTER_TRIANGLE,
+    RESIZE_FILTER_LANCZOS3,
+    RESIZE_FILTER_MITCHELL
+};
+
+// Mip filter of 8-bit power-of-two chains. DEFAULT keeps DirectXTex GenerateMipMaps, BOX averages 2x2 blocks
+// directly, with sRGB colour in linear light and alpha kept separate.
+enum MIP_FILTER
+{
+    MIP_FILTER_DEFAULT,
+    MIP_FILTER_BOX
+};
+
 struct ChannelSwizzle {
     std::optional<std::wstring> szFile;
     char swizzle;
 
+    // Applied after the channel is extracted: ( invert ? 1 - v : v ) * scale + bias
+    bool invert = false;
+    float scale = 1.0f;
+    float bias = 0.0f;
+
+    bool HasRemap() const { return scale != 1.0f || bias != 0.0f; }
+
     ChannelSwizzle( std::wstring file, char swiz )
     {
         szFile = file;
@@ -35,46 +71,106 @@ struct ChannelSwizzle {
 
 void PrintDebugMetadata( std::string name, DirectX::TexMetadata metadata );
 
+float SRGBToLinear( float c );
+float LinearToSRGB( float c );
+
+// 8-bit sRGB code to linear float
+const float *SRGBToLinearTable();
+
+// 8-bit code to the nearest code in the other encoding
+const uint8_t *SRGBConversionTable( bool toLinear );
+
+uint8_t LinearToSRGB8( float linear );
+
+// Decodes as the policy says the source is encoded; the pack stage re-encodes for the output format
 HRESULT LoadImageWithSRGB(
     const wchar_t *szFile,
     SRGB_INPUT srgb,
-    DXGI_FORMAT formatOut,
+    int width,
+    int height,
+    std::unique_ptr<DirectX::ScratchImage> &pInputImage,
+    bool verbose = false,
+    const uint8_t *pData = nullptr,  // Contents of szFile when already read
+    size_t dataSize = 0
+);
+
+// Decoded pixels instead of a file, under the same policy
+HRESULT LoadImageWithSRGB(
+    const DirectX::Image &image,
+    SRGB_INPUT srgb,
     std::unique_ptr<DirectX::ScratchImage> &pInputImage,
     bool verbose = false
 );
 
+// Reads dimensions and format without decoding pixels
+HRESULT GetImageHeader( const wchar_t *szFile, DirectX::TexMetadata &metadata );
+
+// Returns the number of halvings k when the target is exactly source / 2^k on both axes, or 0 otherwise
+size_t PowerOfTwoReduction( size_t srcWidth, size_t srcHeight, size_t width, size_t height );
+
 HRESULT ResizeImage(
     int width,
     int height,
     std::unique_ptr<DirectX::ScratchImage> &pInputImage,
-    DXGI_FORMAT formatOut
+    DXGI_FORMAT formatOut,
+    RESIZE_FILTER filter = RESIZE_FILTER_DEFAULT
 );
 
 HRESULT ExtractChannel(
     const std::unique_ptr<DirectX::ScratchImage> &pInputImage,
-    char swizzle,
+    const ChannelSwizzle &channel,
+    bool srgbOut,
     std::unique_ptr<DirectX::ScratchImage> &pOutputSlice
 );
 
+// Applies v * scale + bias (normalized units) to an R8/R16 UNORM/SNORM, R16_FLOAT or R32_FLOAT slice
+HRESULT RemapChannel( const DirectX::Image &slice, float scale, float bias );
+
 bool EnsureCompatibleChannelSlices( const std::vector<std::unique_ptr<DirectX::ScratchImage>> &slices );
 
 HRESULT CombineChannelSlices(
     const std::vector<std::unique_ptr<DirectX::ScratchImage>> &slices,
     DXGI_FORMAT formatOut,
+    bool premultiplyAlpha,
     std::unique_ptr<DirectX::ScratchImage> &pCombinerImage,
     bool verbose = false
 );
 
+HRESULT PackChannels(
+    const std::vector<const DirectX::ScratchImage *> &sources,
+    const std::vector<ChannelSwizzle> &channels,
+    DXGI_FORMAT formatOut,
+    bool premultiplyAlpha,
+    std::unique_ptr<DirectX::ScratchImage> &pCombinerImage,
+    bool verbose = false
+);
+
+HRESULT BlitImage( const DirectX::Image &src, const DirectX::Image &dst, size_t x, size_t y );
+
+// mip_levels of an atlas, capped at the chain of its largest member so the rect alignment stays in range
+size_t ClampAtlasMipLevels( const std::vector<std::pair<size_t, size_t>> &sizes, size_t mipLevels );
+
+void PackAtlasRects(
+    const std::vector<std::pair<size_t, size_t>> &sizes,
+    size_t alignment,
+    size_t &width,
+    size_t &height,
+    std::vector<std::pair<size_t, size_t>> &offsets
+);
+
 HRESULT GenerateMipMapChain(
     DXGI_FORMAT format,
+    MIP_FILTER filter,
     std::unique_ptr<DirectX::ScratchImage> &pCombinerImage,
     std::unique_ptr<DirectX::ScratchImage> &pMipMapImage,
     bool verbose = false
 );
 
+// Compresses with the backend of format, then runs the RDO pass when rdoLambda is set
 HRESULT CompressImage(
-    ID3D11Device *pDevice,
+    CBackendRegistry &backends,
     DXGI_FORMAT format,
+    float rdoLambda,
     std::unique_ptr<DirectX::ScratchImage> &pMipMapImage,
     std::unique_ptr<DirectX::ScratchImage> &pCompressedImage,
     bool verbose = false
@@ -0,0 +1,669 @@
+#include "pch.h"
+
+#include <iostream>
+#include <algorithm>
+#include <fstream>
+#include <deque>
+#include <cmath>
+#include <wrl\client.h>
+#include <wincodec.h>
+
+#include "Tiled.hpp"
+#include "Resample.hpp"
+
+using namespace DirectX;
+using Microsoft::WRL::ComPtr;
+
+bool _IsTGA( const std::wstring &file )
+{
+    auto ext = std::filesystem::path( file ).extension().string();
+    return ext == ".tga" || ext == ".TGA";
+}
+
+// Same interpretation LoadImageWithSRGB gives the source
+bool _IsSourceSRGB( SRGB_INPUT srgb, const TexMetadata &header )
+{
+    switch ( srgb ) {
+        case FORCE_SRGB: return true;
+        case ASSUME_SRGB: return true;
+        case ASSUME_LINEAR: return IsSRGB( header.format );
+        default: return false;
+    }
+}
+
+bool _IsJPEG( const std::wstring &file )
+{
+    auto ext = std::filesystem::path( file ).extension().string();
+    return ext == ".jpg" || ext == ".JPG" || ext == ".jpeg" || ext == ".JPEG";
+}
+
+// Filter that reproduces what ResizeImage does to this source, or false when streaming can't match it:
+// DEFAULT only streams as the box pyramid of an exact power-of-two reduction, and JPEG downscales are
+// decoded at reduced resolution by the in-memory path.
+bool _GetStreamFilter( CTex2DDS &spec, const std::wstring &file, const TexMetadata &header, size_t width, size_t height, RESIZE_FILTER &filter )
+{
+    filter = RESIZE_FILTER_BOX;
+    if ( header.width == width && header.height == height ) return true;
+
+    if ( _IsJPEG( file ) && ( header.width + 1 ) / 2 >= width && ( header.height + 1 ) / 2 >= height ) return false;
+
+    if ( spec.GetResizeFilter() != RESIZE_FILTER_DEFAULT ) {
+        filter = spec.GetResizeFilter();
+        return true;
+    }
+
+    return PowerOfTwoReduction( header.width, header.height, width, height ) > 0;
+}
+
+// Decodes a WIC source a band of rows at a time into float RGBA, linear when the source is sRGB
+class CBandReader
+{
+public:
+    HRESULT Open( const wchar_t *szFile, bool srgb, bool wide, size_t bandRows )
+    {
+        bool iswic2 = false;
+        auto pFactory = GetWICFactory( iswic2 );
+        if ( !pFactory ) return E_NOINTERFACE;
+
+        ComPtr<IWICBitmapDecoder> pDecoder;
+        HRESULT hr = pFactory->CreateDecoderFromFilename( szFile, nullptr, GENERIC_READ, WICDecodeMetadataCacheOnDemand, pDecoder.GetAddressOf() );
+        if ( FAILED( hr ) ) return hr;
+
+        ComPtr<IWICBitmapFrameDecode> pFrame;
+        hr = pDecoder->GetFrame( 0, pFrame.GetAddressOf() );
+        if ( FAILED( hr ) ) return hr;
+
+        UINT width, height;
+        hr = pFrame->GetSize( &width, &height );
+        if ( FAILED( hr ) ) return hr;
+
+        // The converter forwards the band rectangle to the codec, so only the band is decoded
+        ComPtr<IWICFormatConverter> pConverter;
+        hr = pFactory->CreateFormatConverter( pConverter.GetAddressOf() );
+        if ( FAILED( hr ) ) return hr;
+
+        hr = pConverter->Initialize( pFrame.Get(), wide ? GUID_WICPixelFormat64bppRGBA : GUID_WICPixelFormat32bppRGBA,
+            WICBitmapDitherTypeNone, nullptr, 0.0, WICBitmapPaletteTypeCustom );
+        if ( FAILED( hr ) ) return hr;
+
+        hr = pConverter.As( &m_pSource );
+        if ( FAILED( hr ) ) return hr;
+
+        m_width = width;
+        m_height = height;
+        m_wide = wide;
+        m_bandRows = bandRows;
+
+        size_t levels = wide ? 65536 : 256;
+        m_colorLUT.resize( levels );
+        m_alphaLUT.resize( levels );
+        for ( size_t i = 0; i < levels; ++i ) {
+            float v = float( i ) / float( levels - 1 );
+            m_colorLUT[i] = srgb ? SRGBToLinear( v ) : v;
+            m_alphaLUT[i] = v;
+        }
+
+        return 0;
+    }
+
+    size_t GetWidth() const { return m_width; }
+    size_t GetHeight() const { return m_height; }
+
+    // Rows are read in increasing order, each band is decoded once
+    HRESULT ReadRow( size_t y, float *pRow )
+    {
+        size_t stride = m_width * ( m_wide ? 8 : 4 );
+
+        if ( y < m_bandFirst || y >= m_bandFirst + m_bandCount ) {
+            m_bandFirst = y;
+            m_bandCount = std::min( m_bandRows, m_height - y );
+            m_band.resize( stride * m_bandCount );
+
+            WICRect rect = { 0, INT( y ), INT( m_width ), INT( m_bandCount ) };
+            HRESULT hr = m_pSource->CopyPixels( &rect, UINT( stride ), UINT( m_band.size() ), m_band.data() );
+            if ( FAILED( hr ) ) return hr;
+        }
+
+        auto pSrc = m_band.data() + ( y - m_bandFirst ) * stride;
+        if ( m_wide ) {
+            _ExpandRow( reinterpret_cast<const uint16_t *>( pSrc ), pRow );
+        }
+        else {
+            _ExpandRow( pSrc, pRow );
+        }
+
+        return 0;
+    }
+
+protected:
+    template<typename T>
+    void _ExpandRow( const T *pSrc, float *pRow )
+    {
+        for ( size_t x = 0; x < m_width * 4; x += 4 ) {
+            pRow[x + 0] = m_colorLUT[pSrc[x + 0]];
+            pRow[x + 1] = m_colorLUT[pSrc[x + 1]];
+            pRow[x + 2] = m_colorLUT[pSrc[x + 2]];
+            pRow[x + 3] = m_alphaLUT[pSrc[x + 3]];
+        }
+    }
+
+    ComPtr<IWICBitmapSource> m_pSource;
+    size_t m_width = 0;
+    size_t m_height = 0;
+    size_t m_bandRows = 0;
+    bool m_wide = false;
+
+    std::vector<uint8_t> m_band;
+    size_t m_bandFirst = 0;
+    size_t m_bandCount = 0;
+
+    std::vector<float> m_colorLUT;
+    std::vector<float> m_alphaLUT;
+};
+
+// Source rows resampled to the output size. Only the window of rows the vertical filter still needs is
+// kept, which is the band overlap: a row stays resident until no later output row has a tap on it.
+class CSourceStream
+{
+public:
+    // Same filter tables as ResampleImage; colour is weighted by alpha when weightAlpha is set
+    HRESULT Open( const wchar_t *szFile, bool srgb, bool wide, size_t width, size_t height, size_t bandRows, RESIZE_FILTER filter, bool weightAlpha )
+    {
+        HRESULT hr = m_reader.Open( szFile, srgb, wide, bandRows );
+        if ( FAILED( hr ) ) return hr;
+
+        BuildFilterTable( m_reader.GetWidth(), width, filter, m_horizontal );
+        BuildFilterTable( m_reader.GetHeight(), height, filter, m_vertical );
+
+        m_width = width;
+        m_weightAlpha = weightAlpha;
+        m_sourceRow.resize( m_reader.GetWidth() * 4 );
+
+        return 0;
+    }
+
+    // Output rows are requested in increasing order
+    HRESULT GetRow( size_t y, float *pRow )
+    {
+        size_t first = m_vertical.first[y];
+        size_t count = m_vertical.count[y];
+        const float *weights = &m_vertical.weights[y * m_vertical.taps];
+
+        while ( m_windowFirst < first ) {
+            if ( !m_window.empty() ) m_window.pop_front();
+            ++m_windowFirst;
+        }
+
+        while ( m_windowFirst + m_window.size() < first + count ) {
+            HRESULT hr = m_reader.ReadRow( m_windowFirst + m_window.size(), m_sourceRow.data() );
+            if ( FAILED( hr ) ) return hr;
+
+            if ( m_weightAlpha ) {
+                for ( size_t i = 0; i < m_sourceRow.size(); i += 4 ) {
+                    for ( size_t c = 0; c < 3; ++c ) m_sourceRow[i + c] *= m_sourceRow[i + 3];
+                }
+            }
+
+            auto &row = m_window.emplace_back( m_width * 4 );
+            for ( size_t x = 0; x < m_width; ++x ) {
+                const float *pSrc = m_sourceRow.data() + m_horizontal.first[x] * 4;
+                const float *pWeights = &m_horizontal.weights[x * m_horizontal.taps];
+                float sum[4] = {};
+                for ( size_t k = 0; k < m_horizontal.count[x]; ++k ) {
+                    for ( size_t c = 0; c < 4; ++c ) sum[c] += pWeights[k] * pSrc[c];
+                    pSrc += 4;
+                }
+                std::copy( sum, sum + 4, row.data() + x * 4 );
+            }
+        }
+
+        std::fill( pRow, pRow + m_width * 4, 0.0f );
+        for ( size_t k = 0; k < count; ++k ) {
+            const auto &row = m_window[first - m_windowFirst + k];
+            for ( size_t i = 0; i < m_width * 4; ++i ) {
+                pRow[i] += weights[k] * row[i];
+            }
+        }
+
+        if ( m_weightAlpha ) {
+            for ( size_t i = 0; i < m_width * 4; i += 4 ) {
+                float alpha = pRow[i + 3];
+                if ( alpha > 0.0f ) {
+                    for ( size_t c = 0; c < 3; ++c ) pRow[i + c] /= alpha;
+                }
+            }
+        }
+
+        return 0;
+    }
+
+protected:
+    CBandReader m_reader;
+    SFilterTable m_horizontal;
+    SFilterTable m_vertical;
+    std::vector<float> m_sourceRow;
+    std::deque<std::vector<float>> m_window;
+    size_t m_windowFirst = 0;
+    size_t m_width = 0;
+    bool m_weightAlpha = false;
+};
+
+// One output channel of the packed row, with the swizzle operations of ExtractChannel. Those apply
+// to stored values, so rows in linear light are encoded around them when the channel is sRGB.
+struct SPackChannel
+{
+    int source = -1;
+    size_t component = 0;
+    float fill = 0.0f;
+    float scale = 1.0f;
+    float bias = 0.0f;
+    bool encodeIn = false;
+    bool decodeOut = false;
+    bool identity = true;
+};
+
+// Box-filtered mip chain built row by row. Each level gathers a strip of rows for the compressor and
+// the sum of the rows that form the next row of the level below. Rows of odd-sized levels fold into
+// the last texel, like a 3-wide box.
+class CMipCascade
+{
+public:
+    HRESULT Initialize( CBackendRegistry *pBackends, const TexMetadata &metadata, DXGI_FORMAT combinerFormat, size_t bandRows, std::ofstream &file, size_t dataOffset )
+    {
+        m_pBackends = pBackends;
+        m_format = metadata.format;
+        m_combinerFormat = combinerFormat;
+        m_pFile = &file;
+
+        m_levels.resize( metadata.mipLevels );
+
+        size_t offset = dataOffset;
+        for ( size_t i = 0; i < metadata.mipLevels; ++i ) {
+            auto &level = m_levels[i];
+            level.width = std::max<size_t>( 1, metadata.width >> i );
+            level.height = std::max<size_t>( 1, metadata.height >> i );
+
+            size_t slicePitch;
+            HRESULT hr = ComputePitch( m_format, level.width, level.height, level.blockRowPitch, slicePitch );
+            if ( FAILED( hr ) ) return hr;
+
+            level.offset = offset;
+            offset += slicePitch;
+
+            hr = level.strip.Initialize2D( DXGI_FORMAT_R32G32B32A32_FLOAT, level.width, std::min( bandRows, level.height ), 1, 1 );
+            if ( FAILED( hr ) ) return hr;
+
+            if ( i + 1 < metadata.mipLevels ) {
+                level.sum.resize( level.width * 4 );
+                level.down.resize( std::max<size_t>( 1, level.width / 2 ) * 4 );
+            }
+        }
+
+        return 0;
+    }
+
+    HRESULT PushRow( size_t index, const float *pRow )
+    {
+        auto &level = m_levels[index];
+
+        auto strip = level.strip.GetImage( 0, 0, 0 );
+        memcpy( strip->pixels + level.stripRows * strip->rowPitch, pRow, level.width * 4 * sizeof( float ) );
+        ++level.stripRows;
+        ++level.rows;
+
+        if ( level.stripRows == strip->height || level.rows == level.height ) {
+            HRESULT hr = FlushStrip( level );
+            if ( FAILED( hr ) ) return hr;
+        }
+
+        if ( index + 1 == m_levels.size() ) return 0;
+
+        for ( size_t i = 0; i < level.sum.size(); ++i ) {
+            level.sum[i] += pRow[i];
+        }
+        ++level.sumRows;
+
+        const auto &next = m_levels[index + 1];
+        size_t needed = level.emitted == next.height - 1 ? level.height - 2 * level.emitted : 2;
+        if ( level.sumRows < needed ) return 0;
+
+        for ( size_t x = 0; x < next.width; ++x ) {
+            size_t columns = x == next.width - 1 ? level.width - 2 * x : 2;
+            float scale = 1.0f / float( columns * level.sumRows );
+
+            for ( size_t c = 0; c < 4; ++c ) {
+                float sum = 0.0f;
+                for ( size_t k = 0; k < columns; ++k ) {
+                    sum += level.sum[( 2 * x + k ) * 4 + c];
+                }
+                level.down[x * 4 + c] = sum * scale;
+            }
+        }
+
+        std::fill( level.sum.begin(), level.sum.end(), 0.0f );
+        level.sumRows = 0;
+        ++level.emitted;
+
+        return PushRow( index + 1, level.down.data() );
+    }
+
+protected:
+    struct SLevel
+    {
+        size_t width = 0;
+        size_t height = 0;
+        size_t offset = 0;
+        size_t blockRowPitch = 0;
+        size_t rows = 0;
+
+        ScratchImage strip;
+        size_t stripFirst = 0;
+        size_t stripRows = 0;
+
+        std::vector<float> sum;
+        size_t sumRows = 0;
+        size_t emitted = 0;
+        std::vector<float> down;
+    };
+
+    // Converts the strip to the packed format, compresses it and writes its block rows in place
+    HRESULT FlushStrip( SLevel &level )
+    {
+        Image rows = *level.strip.GetImage( 0, 0, 0 );
+        rows.height = level.stripRows;
+        rows.slicePitch = rows.rowPitch * rows.height;
+
+        TEX_FILTER_FLAGS flags = TEX_FILTER_DEFAULT;
+        if ( IsSRGB( m_combinerFormat ) ) flags |= TEX_FILTER_SRGB_OUT;
+        if ( BitsPerPixel( m_combinerFormat ) / BitsPerColor( m_combinerFormat ) == 1 ) flags |= TEX_FILTER_RGB_COPY_RED;
+
+        ScratchImage packed;
+        HRESULT hr = Convert( rows, m_combinerFormat, flags, TEX_THRESHOLD_DEFAULT, packed );
+        if ( FAILED( hr ) ) return hr;
+
+        ScratchImage compressed;
+        hr = m_pBackends->Compress( m_format, packed.GetImages(), 1, packed.GetMetadata(), compressed );
+        if ( FAILED( hr ) ) return hr;
+
+        m_pFile->seekp( level.offset + level.stripFirst / 4 * level.blockRowPitch );
+        m_pFile->write( reinterpret_cast<const char *>( compressed.GetPixels() ), compressed.GetPixelsSize() );
+        if ( !m_pFile->good() ) return E_FAIL;
+
+        level.stripFirst += level.stripRows;
+        level.stripRows = 0;
+
+        return 0;
+    }
+
+    CBackendRegistry *m_pBackends = nullptr;
+    DXGI_FORMAT m_format = DXGI_FORMAT_UNKNOWN;
+    DXGI_FORMAT m_combinerFormat = DXGI_FORMAT_UNKNOWN;
+    std::ofstream *m_pFile = nullptr;
+    std::vector<SLevel> m_levels;
+};
+
+bool CTiledProcessor::Accepts( CTex2DDS &spec )
+{
+    if ( m_thresholdSize == 0 || spec.IsGroup() || spec.IsPaged() || spec.GetRDOLambda() > 0.0f ) return false;
+
+    auto formatOut = spec.GetOutputFormat();
+    if ( !IsCompressed( formatOut ) || MakeTypeless( formatOut ) == DXGI_FORMAT_BC6H_TYPELESS ) return false;
+
+    auto channels = spec.GetChannelCount();
+    if ( CreateOutputFormat( DXGI_FORMAT_R8G8B8A8_UNORM, channels ) == DXGI_FORMAT_UNKNOWN ) return false;
+    if ( spec.GetPremultiplyAlpha() && channels != 4 ) return false;
+
+    // The box cascade only matches the in-memory box mips on power-of-two sizes
+    if ( spec.GetMipFilter() != MIP_FILTER_BOX ) return false;
+
+    size_t width, height;
+    spec.GetOutputSize( width, height );
+    auto isPow2 = []( size_t v ) { return v > 0 && ( v & ( v - 1 ) ) == 0; };
+    if ( !isPow2( width ) || !isPow2( height ) ) return false;
+
+    bool large = false;
+    for ( const auto &channel : spec.GetChannels() ) {
+        if ( !channel.szFile.has_value() ) continue;
+
+        const auto &file = channel.szFile.value();
+        if ( _IsTGA( file ) ) return false;
+
+        TexMetadata header;
+        if ( FAILED( GetImageHeader( file.c_str(), header ) ) ) return false;
+        if ( FormatDataType( header.format ) != FORMAT_TYPE_UNORM ) return false;
+
+        RESIZE_FILTER filter;
+        if ( !_GetStreamFilter( spec, file, header, width, height, filter ) ) return false;
+
+        large |= std::max( header.width, header.height ) >= m_thresholdSize;
+    }
+
+    return large;
+}
+
+uint64_t CTiledProcessor::EstimateMemory( CTex2DDS &spec )
+{
+    std::set<std::wstring> files;
+    uint64_t total = 0;
+    uint64_t width = 0;
+
+    for ( const auto &channel : spec.GetChannels() ) {
+        if ( !channel.szFile.has_value() || !files.insert( channel.szFile.value() ).second ) continue;
+
+        TexMetadata header;
+        if ( FAILED( GetImageHeader( channel.szFile.value().c_str(), header ) ) ) continue;
+
+        uint64_t dstWidth = spec.GetWidth() == -1 ? header.width : spec.GetWidth();
+        uint64_t dstHeight = spec.GetHeight() == -1 ? header.height : spec.GetHeight();
+        // Lanczos3 has the widest support of the filter tables
+        uint64_t windowRows = 6 * ( ( header.height + dstHeight - 1 ) / dstHeight ) + 2;
+
+        // Decoded band, one float source row and the vertical filter window
+        total += uint64_t( header.width ) * m_bandRows * 8;
+        total += uint64_t( header.width ) * 16;
+        total += windowRows * dstWidth * 16;
+
+        width = std::max( width, dstWidth );
+    }
+
+    // Float strips of every level add up to twice the top one, plus their packed and compressed copies
+    return total + 2 * width * m_bandRows * ( 16 + 8 + 1 );
+}
+
+HRESULT CTiledProcessor::Process( CTex2DDS &spec, bool verbose )
+{
+    HRESULT hr;
+
+    auto formatOut = spec.GetOutputFormat();
+    auto channels = spec.GetChannelCount();
+    bool srgbOut = IsSRGB( formatOut );
+
+    // Unique sources in order of first use
+    std::vector<std::wstring> files;
+    std::vector<TexMetadata> headers;
+    for ( const auto &channel : spec.GetChannels() ) {
+        if ( !channel.szFile.has_value() ) continue;
+        if ( std::find( files.begin(), files.end(), channel.szFile.value() ) != files.end() ) continue;
+
+        TexMetadata header;
+        hr = GetImageHeader( channel.szFile.value().c_str(), header );
+        if ( FAILED( hr ) ) {
+            std::wcerr << "Failed to load image: " << channel.szFile.value() << std::endl;
+            return hr;
+        }
+
+        files.push_back( channel.szFile.value() );
+        headers.push_back( header );
+    }
+
+    bool wide = false;
+    for ( const auto &header : headers ) {
+        wide |= BitsPerColor( header.format ) > 8;
+    }
+
+    size_t width = spec.GetWidth() == -1 ? headers[0].width : spec.GetWidth();
+    size_t height = spec.GetHeight() == -1 ? headers[0].height : spec.GetHeight();
+
+    DXGI_FORMAT combinerFormat = CreateOutputFormat( wide ? DXGI_FORMAT_R16G16B16A16_UNORM : DXGI_FORMAT_R8G8B8A8_UNORM, channels );
+    if ( srgbOut ) {
+        combinerFormat = MakeSRGB( combinerFormat );
+    }
+
+    TexMetadata mdata = {};
+    mdata.width = width;
+    mdata.height = height;
+    mdata.depth = 1;
+    mdata.arraySize = 1;
+    mdata.mipLevels = 1;
+    mdata.format = formatOut;
+    mdata.dimension = TEX_DIMENSION_TEXTURE2D;
+    while ( ( std::max( width, height ) >> mdata.mipLevels ) > 0 ) ++mdata.mipLevels;
+    if ( spec.GetPremultiplyAlpha() ) {
+        mdata.SetAlphaMode( TEX_ALPHA_MODE_PREMULTIPLIED );
+    }
+
+    Progress() << "Tiling " << headers[0].width << "x" << headers[0].height << " source in bands of " << m_bandRows << " rows..." << std::endl;
+
+    // Output channels in the stored domain of the combiner
+    std::vector<SPackChannel> pack( channels );
+    for ( size_t i = 0; i < channels; ++i ) {
+        const auto &channel = spec.GetChannel( i );
+        auto &op = pack[i];
+        bool srgbChannel = srgbOut && i < 3;
+
+        switch ( channel.swizzle ) {
+            case 'r': op.component = 0; break;
+            case 'g': op.component = 1; break;
+            case 'b': op.component = 2; break;
+            case 'a': op.component = 3; break;
+            case '0': op.fill = 0.0f; break;
+            case '1': op.fill = 1.0f; break;
+            case 'h': op.fill = 0.5f; break;
+
+            default:
+                std::cerr << "Unknown swizzle: " << channel.swizzle << std::endl;
+                return E_FAIL;
+        }
+
+        bool fill = std::string_view( "01h" ).find( channel.swizzle ) != std::string_view::npos;
+        op.scale = channel.scale;
+        op.bias = channel.bias;
+        if ( channel.invert ) {
+            op.bias += op.scale;
+            op.scale = -op.scale;
+        }
+
+        if ( fill ) {
+            float v = std::clamp( op.fill * op.scale + op.bias, 0.0f, 1.0f );
+            op.fill = srgbChannel ? SRGBToLinear( v ) : v;
+            continue;
+        }
+
+        auto file = channel.szFile.has_value() ? channel.szFile.value() : files[0];
+        op.source = int( std::find( files.begin(), files.end(), file ) - files.begin() );
+
+        bool srgbComponent = srgbOut && op.component < 3;
+        op.identity = op.scale == 1.0f && op.bias == 0.0f && srgbComponent == srgbChannel;
+        op.encodeIn = srgbComponent;
+        op.decodeOut = srgbChannel;
+    }
+
+    // Explicit filters weight colour by alpha as ResampleImage does, except for BC7's separate alpha
+    bool separateAlpha = MakeTypeless( formatOut ) == DXGI_FORMAT_BC7_TYPELESS;
+
+    std::vector<CSourceStream> streams( files.size() );
+    for ( size_t s = 0; s < files.size(); ++s ) {
+        bool srgbIn = _IsSourceSRGB( spec.GetInputSRGB(), headers[s] );
+        RESIZE_FILTER filter;
+        _GetStreamFilter( spec, files[s], headers[s], width, height, filter );
+        bool resized = headers[s].width != width || headers[s].height != height;
+        bool weightAlpha = resized && !separateAlpha && filter == spec.GetResizeFilter();
+
+        hr = streams[s].Open( files[s].c_str(), srgbIn, wide, width, height, m_bandRows, filter, weightAlpha );
+        if ( FAILED( hr ) ) {
+            std::wcerr << "Failed to load image: " << files[s] << std::endl;
+            return hr;
+        }
+    }
+
+    std::ofstream file( std::filesystem::path( spec.GetOutFile() ), std::ios::binary | std::ios::trunc );
+    if ( !file ) {
+        std::cerr << "Failed to save file!" << std::endl;
+        return E_FAIL;
+    }
+
+    size_t headerSize = 0;
+    hr = EncodeDDSHeader( mdata, DDS_FLAGS_NONE, nullptr, 0, headerSize );
+    if ( FAILED( hr ) ) return hr;
+
+    std::vector<uint8_t> header( headerSize );
+    hr = EncodeDDSHeader( mdata, DDS_FLAGS_NONE, header.data(), header.size(), headerSize );
+    if ( FAILED( hr ) ) return hr;
+    file.write( reinterpret_cast<const char *>( header.data() ), headerSize );
+
+    CMipCascade cascade;
+    hr = cascade.Initialize( &m_backends, mdata, combinerFormat, m_bandRows, file, headerSize );
+    if ( FAILED( hr ) ) {
+        std::cerr << "Could not create combiner image!" << std::endl;
+        return hr;
+    }
+
+    std::vector<std::vector<float>> sourceRows( streams.size(), std::vector<float>( width * 4 ) );
+    std::vector<float> packed( width * 4 );
+
+    for ( size_t y = 0; y < height; ++y ) {
+        for ( size_t s = 0; s < streams.size(); ++s ) {
+            hr = streams[s].GetRow( y, sourceRows[s].data() );
+            if ( FAILED( hr ) ) {
+                std::wcerr << "Failed to load image: " << files[s] << std::endl;
+                return hr;
+            }
+        }
+
+        for ( size_t x = 0; x < width; ++x ) {
+            float *pOut = packed.data() + x * 4;
+            pOut[0] = pOut[1] = pOut[2] = 0.0f;
+            pOut[3] = 1.0f;
+
+            for ( size_t i = 0; i < channels; ++i ) {
+                const auto &op = pack[i];
+                if ( op.source < 0 ) {
+                    pOut[i] = op.fill;
+                    continue;
+                }
+
+                float v = sourceRows[op.source][x * 4 + op.component];
+                if ( !op.identity ) {
+                    if ( op.encodeIn ) v = LinearToSRGB( v );
+                    v = std::clamp( v * op.scale + op.bias, 0.0f, 1.0f );
+                    if ( op.decodeOut ) v = SRGBToLinear( v );
+                }
+                pOut[i] = v;
+            }
+
+            if ( spec.GetPremultiplyAlpha() ) {
+                pOut[0] *= pOut[3];
+                pOut[1] *= pOut[3];
+                pOut[2] *= pOut[3];
+            }
+        }
+
+        hr = cascade.PushRow( 0, packed.data() );
+        if ( FAILED( hr ) ) {
+            std::cerr << "Failed to compress texture!" << std::endl;
+            return hr;
+        }
+
+        if ( verbose && ( y + 1 ) % ( m_bandRows * 16 ) == 0 ) {
+            Progress() << "Processed " << y + 1 << "/" << height << " rows" << std::endl;
+        }
+    }
+
+    file.close();
+    if ( file.fail() ) {
+        std::cerr << "Failed to save file!" << std::endl;
+        return E_FAIL;
+    }
+
+    return 0;
+}
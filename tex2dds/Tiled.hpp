@@ -0,0 +1,35 @@
+#pragma once
+
+#include "CTex2DDS.hpp"
+#include "Backend.hpp"
+
+// Converts specs with very large WIC sources in horizontal bands, so memory scales with the band
+// instead of the image: sources are decoded and resampled a band at a time, every mip level is
+// built from rows of the one above as they arrive, and each level is compressed and written
+// to its place in the DDS once it has a band of rows.
+class CTiledProcessor
+{
+public:
+    // Sources with a side of at least thresholdSize pixels are tiled, 0 disables tiling
+    CTiledProcessor( CBackendRegistry &backends, size_t thresholdSize = 16384, size_t bandRows = 128 ) :
+        m_backends( backends ),
+        m_thresholdSize( thresholdSize ),
+        m_bandRows( std::max<size_t>( 4, ( bandRows + 3 ) / 4 * 4 ) )
+    {
+    }
+
+    // Whether the spec has a source above the threshold and only uses what the tiled path supports
+    bool Accepts( CTex2DDS &spec );
+
+    // Bands, mip rows and compressed strips resident while the spec is processed
+    uint64_t EstimateMemory( CTex2DDS &spec );
+
+    HRESULT Process( CTex2DDS &spec, bool verbose = false );
+
+    size_t GetBandRows() const { return m_bandRows; }
+
+protected:
+    CBackendRegistry &m_backends;
+    size_t m_thresholdSize;
+    size_t m_bandRows;
+};
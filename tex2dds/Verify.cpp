@@ -0,0 +1,156 @@
+#include "pch.h"
+
+#include <iostream>
+#include <random>
+
+#include "Verify.hpp"
+
+using namespace DirectX;
+
+// Builds a strip of the given blocks from image, padding partial edge blocks by clamping
+HRESULT _GatherStrip( const Image &image, const std::vector<std::pair<size_t, size_t>> &blocks, DXGI_FORMAT format, ScratchImage &strip )
+{
+    HRESULT hr = strip.Initialize2D( format, blocks.size() * 4, 4, 1, 1 );
+    if ( FAILED( hr ) ) {
+        return hr;
+    }
+
+    auto dst = strip.GetImage( 0, 0, 0 );
+    auto bytesPerPixel = BitsPerPixel( format ) / 8;
+
+    for ( size_t i = 0; i < blocks.size(); ++i ) {
+        auto [bx, by] = blocks[i];
+
+        for ( size_t y = 0; y < 4; ++y ) {
+            auto sy = std::min( by * 4 + y, image.height - 1 );
+            auto srcRow = image.pixels + sy * image.rowPitch;
+            auto dstRow = dst->pixels + y * dst->rowPitch + i * 4 * bytesPerPixel;
+
+            for ( size_t x = 0; x < 4; ++x ) {
+                auto sx = std::min( bx * 4 + x, image.width - 1 );
+                memcpy( dstRow + x * bytesPerPixel, srcRow + sx * bytesPerPixel, bytesPerPixel );
+            }
+        }
+    }
+
+    return 0;
+}
+
+HRESULT CVerifier::Sample( const ScratchImage &mipChain, const std::wstring &outFile, SVerifySamples &samples )
+{
+    std::mt19937_64 rng( std::hash<std::wstring>()( outFile ) );
+
+    // Values are compared as stored, so sRGB data isn't decoded on either side
+    auto format = MakeLinear( mipChain.GetMetadata().format );
+
+    for ( size_t index = 0; index < mipChain.GetImageCount(); ++index ) {
+        const auto &image = mipChain.GetImages()[index];
+        size_t blocksWide = ( image.width + 3 ) / 4;
+        size_t blocksHigh = ( image.height + 3 ) / 4;
+        size_t total = blocksWide * blocksHigh;
+
+        auto &strip = samples.strips.emplace_back();
+        strip.imageIndex = index;
+
+        // One block from each of blocksPerMip equal strata spreads the sample over the whole image
+        size_t count = std::min( total, m_blocksPerMip );
+        for ( size_t i = 0; i < count; ++i ) {
+            size_t first = i * total / count;
+            size_t last = ( i + 1 ) * total / count;
+            size_t block = first + rng() % ( last - first );
+            strip.blocks.emplace_back( block % blocksWide, block / blocksWide );
+        }
+
+        ScratchImage source;
+        auto linearImage = image;
+        linearImage.format = format;
+        HRESULT hr = _GatherStrip( linearImage, strip.blocks, format, source );
+        if ( FAILED( hr ) ) {
+            return hr;
+        }
+
+        strip.pSource = std::make_unique<ScratchImage>();
+        hr = Convert( *source.GetImage( 0, 0, 0 ), DXGI_FORMAT_R32G32B32A32_FLOAT, TEX_FILTER_DEFAULT, TEX_THRESHOLD_DEFAULT, *strip.pSource.get() );
+        if ( FAILED( hr ) ) {
+            return hr;
+        }
+    }
+
+    return 0;
+}
+
+HRESULT CVerifier::Verify( const SVerifySamples &samples, const ScratchImage &compressed, const std::wstring &outFile )
+{
+    auto format = MakeLinear( compressed.GetMetadata().format );
+    size_t blockBytes = BitsPerPixel( format ) * 2; // 16 texels per block
+
+    float worstRMSE = 0.0f;
+    size_t worstImage = 0;
+
+    for ( const auto &strip : samples.strips ) {
+        const auto &image = compressed.GetImages()[strip.imageIndex];
+        size_t blocksWide = ( image.width + 3 ) / 4;
+
+        // Copy the sampled blocks into a one block row image and decode just that
+        ScratchImage blocks;
+        HRESULT hr = blocks.Initialize2D( format, strip.blocks.size() * 4, 4, 1, 1 );
+        if ( FAILED( hr ) ) {
+            return hr;
+        }
+
+        auto dst = blocks.GetImage( 0, 0, 0 );
+        for ( size_t i = 0; i < strip.blocks.size(); ++i ) {
+            auto [bx, by] = strip.blocks[i];
+            memcpy( dst->pixels + i * blockBytes, image.pixels + by * image.rowPitch + bx * blockBytes, blockBytes );
+        }
+
+        ScratchImage decoded;
+        hr = Decompress( *dst, DXGI_FORMAT_R32G32B32A32_FLOAT, decoded );
+        if ( FAILED( hr ) ) {
+            std::cerr << "Failed to decompress sampled blocks!" << std::endl;
+            return hr;
+        }
+
+        // Only texels inside the image count, partial edge blocks are padding
+        auto source = strip.pSource->GetImage( 0, 0, 0 );
+        auto result = decoded.GetImage( 0, 0, 0 );
+
+        double sse = 0.0;
+        size_t values = 0;
+        for ( size_t i = 0; i < strip.blocks.size(); ++i ) {
+            auto [bx, by] = strip.blocks[i];
+            size_t width = std::min<size_t>( 4, image.width - bx * 4 );
+            size_t height = std::min<size_t>( 4, image.height - by * 4 );
+
+            for ( size_t y = 0; y < height; ++y ) {
+                auto a = reinterpret_cast<const float *>( source->pixels + y * source->rowPitch ) + i * 16;
+                auto b = reinterpret_cast<const float *>( result->pixels + y * result->rowPitch ) + i * 16;
+                for ( size_t v = 0; v < width * 4; ++v ) {
+                    double d = double( a[v] ) - b[v];
+                    sse += d * d;
+                }
+                values += width * 4;
+            }
+        }
+
+        float rmse = values > 0 ? float( std::sqrt( sse / values ) ) : 0.0f;
+        if ( rmse > worstRMSE ) {
+            worstRMSE = rmse;
+            worstImage = strip.imageIndex;
+        }
+    }
+
+    ++m_checked;
+
+    if ( worstRMSE > m_maxRMSE ) {
+        ++m_flagged;
+        std::wcerr << L"Verification failed: " << outFile << L" image " << worstImage << L" RMSE " << worstRMSE << L" > " << m_maxRMSE << std::endl;
+    }
+
+    return 0;
+}
+
+void CVerifier::PrintReport()
+{
+    std::cerr << "Verified " << m_checked << " textures, " << m_flagged << " above RMSE " << m_maxRMSE << std::endl;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <atomic>
+
+#include "TexUtils.hpp"
+
+// Source texels of the blocks chosen for verification, one strip of blocks per image of the mip chain
+struct SVerifySamples
+{
+    struct SStrip
+    {
+        size_t imageIndex;
+        std::vector<std::pair<size_t, size_t>> blocks;  // block column and row
+        std::unique_ptr<DirectX::ScratchImage> pSource; // 4 * blocks wide, 4 tall, R32G32B32A32_FLOAT
+    };
+
+    std::vector<SStrip> strips;
+};
+
+// Checks compressed output against a sample of its source blocks instead of decoding every mip
+class CVerifier
+{
+public:
+    CVerifier( float maxRMSE = 0.05f, size_t blocksPerMip = 64 ) :
+        m_maxRMSE( maxRMSE ),
+        m_blocksPerMip( blocksPerMip )
+    {
+    }
+
+    // Takes a stratified random sample of blocks per image, every block of images with fewer blocks than
+    // that. The sample is seeded from the output path so reruns check the same blocks.
+    HRESULT Sample( const DirectX::ScratchImage &mipChain, const std::wstring &outFile, SVerifySamples &samples );
+
+    // Decodes only the sampled blocks and flags the texture when any image exceeds the RMSE bound
+    HRESULT Verify( const SVerifySamples &samples, const DirectX::ScratchImage &compressed, const std::wstring &outFile );
+
+    void PrintReport();
+    size_t GetFlagged() const { return m_flagged; }
+
+protected:
+    float m_maxRMSE;
+    size_t m_blocksPerMip;
+    std::atomic<size_t> m_checked = 0;
+    std::atomic<size_t> m_flagged = 0;
+};
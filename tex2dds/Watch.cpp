@@ -0,0 +1,132 @@
+#include "pch.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cwctype>
+
+#include "Watch.hpp"
+
+std::wstring NormalizeWatchPath( const std::filesystem::path &path )
+{
+    std::error_code ec;
+    auto normalized = std::filesystem::weakly_canonical( std::filesystem::absolute( path, ec ), ec ).wstring();
+    if ( ec ) {
+        normalized = path.wstring();
+    }
+
+    std::transform( normalized.begin(), normalized.end(), normalized.begin(), []( wchar_t c ) {
+        return wchar_t( std::towlower( c ) );
+    } );
+
+    return normalized;
+}
+
+CFileWatcher::~CFileWatcher()
+{
+    m_stop = true;
+
+    // Unblocks the pending ReadDirectoryChangesW of every thread
+    for ( auto hDirectory : m_handles ) {
+        CancelIoEx( hDirectory, nullptr );
+    }
+    for ( auto &thread : m_threads ) {
+        thread.join();
+    }
+    for ( auto hDirectory : m_handles ) {
+        CloseHandle( hDirectory );
+    }
+}
+
+HRESULT CFileWatcher::Watch( const std::filesystem::path &directory )
+{
+    HANDLE hDirectory = CreateFileW(
+        directory.wstring().c_str(),
+        FILE_LIST_DIRECTORY,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        nullptr,
+        OPEN_EXISTING,
+        FILE_FLAG_BACKUP_SEMANTICS,
+        nullptr
+    );
+    if ( hDirectory == INVALID_HANDLE_VALUE ) {
+        std::wcerr << "Failed to watch directory: " << directory.wstring() << std::endl;
+        return E_FAIL;
+    }
+
+    m_handles.push_back( hDirectory );
+    m_threads.emplace_back( &CFileWatcher::Run, this, hDirectory, directory );
+
+    return 0;
+}
+
+void CFileWatcher::Run( HANDLE hDirectory, std::filesystem::path directory )
+{
+    alignas( DWORD ) uint8_t buffer[64 * 1024];
+
+    while ( !m_stop ) {
+        DWORD bytes = 0;
+        BOOL ok = ReadDirectoryChangesW(
+            hDirectory,
+            buffer,
+            sizeof( buffer ),
+            FALSE,
+            FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE,
+            &bytes,
+            nullptr,
+            nullptr
+        );
+        if ( !ok ) return;
+
+        // Zero bytes means the buffer overflowed and the changes of this round were lost
+        if ( bytes == 0 ) {
+            {
+                std::lock_guard<std::mutex> lock( m_mutex );
+                m_overflowed = true;
+                ++m_events;
+            }
+            m_changed.notify_all();
+            continue;
+        }
+
+        std::set<std::wstring> changed;
+        for ( size_t offset = 0;; ) {
+            auto info = reinterpret_cast<const FILE_NOTIFY_INFORMATION *>( buffer + offset );
+
+            // Editors commonly save through a temporary file renamed over the original
+            if ( info->Action != FILE_ACTION_REMOVED && info->Action != FILE_ACTION_RENAMED_OLD_NAME ) {
+                std::wstring name( info->FileName, info->FileNameLength / sizeof( wchar_t ) );
+                changed.insert( NormalizeWatchPath( directory / name ) );
+            }
+
+            if ( info->NextEntryOffset == 0 ) break;
+            offset += info->NextEntryOffset;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_pending.insert( changed.begin(), changed.end() );
+            ++m_events;
+        }
+        m_changed.notify_all();
+    }
+}
+
+std::set<std::wstring> CFileWatcher::WaitForChanges( std::chrono::milliseconds debounce, bool &rescan )
+{
+    std::unique_lock<std::mutex> lock( m_mutex );
+
+    m_changed.wait( lock, [&] { return !m_pending.empty() || m_overflowed; } );
+
+    // Coalesce until the directories have been quiet for the whole debounce window
+    for ( ;; ) {
+        auto events = m_events;
+        if ( !m_changed.wait_for( lock, debounce, [&] { return m_events != events; } ) ) break;
+    }
+
+    rescan = m_overflowed;
+    m_overflowed = false;
+
+    std::set<std::wstring> changed;
+    changed.swap( m_pending );
+    return changed;
+}
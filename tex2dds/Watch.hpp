@@ -0,0 +1,41 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <mutex>
+#include <set>
+#include <thread>
+
+// Watches directories for written, created or renamed files with ReadDirectoryChangesW
+class CFileWatcher
+{
+public:
+    CFileWatcher() = default;
+    CFileWatcher( const CFileWatcher & ) = delete;
+    ~CFileWatcher();
+
+    HRESULT Watch( const std::filesystem::path &directory );
+
+    // Blocks until a file changes, then keeps collecting until nothing changed for debounce,
+    // so the several writes of one editor save come back as a single change. Sets rescan when
+    // a change buffer overflowed and any watched file may have changed unreported.
+    std::set<std::wstring> WaitForChanges( std::chrono::milliseconds debounce, bool &rescan );
+
+protected:
+    void Run( HANDLE hDirectory, std::filesystem::path directory );
+
+    std::atomic<bool> m_stop = false;
+    std::vector<HANDLE> m_handles;
+    std::vector<std::thread> m_threads;
+
+    std::mutex m_mutex;
+    std::condition_variable m_changed;
+    std::set<std::wstring> m_pending;
+    bool m_overflowed = false;
+    uint64_t m_events = 0;
+};
+
+// Absolute, case-folded path so watcher events and spec paths compare equal
+std::wstring NormalizeWatchPath( const std::filesystem::path &path );
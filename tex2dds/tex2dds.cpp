@@ -8,149 +8,161 @@
 #include <map>
 #include <sstream>
 #include <future>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <numeric>
+#include <chrono>
 
 #include <wrl\client.h>
 
 #include "TexUtils.hpp"
 #include "CTex2DDS.hpp"
+#include "MipBatch.hpp"
+#include "MemoryGovernor.hpp"
+#include "Concurrency.hpp"
+#include "Shard.hpp"
+#include "Watch.hpp"
+#include "Verify.hpp"
+#include "Tiled.hpp"
+#include "Cache.hpp"
+#include "Journal.hpp"
+#include "Prefetch.hpp"
+#include "Metrics.hpp"
+#include "Pipeline.hpp"
+#include "Benchmark.hpp"
+#include "Pages.hpp"
 
 using namespace DirectX;
 
-HRESULT LoadTextures( CTex2DDS &spec, bool verbose = false )
+// Settings outside the spec that change its output, part of the cache key. AUTO specs are keyed on the
+// backend of their BC7 candidate.
+std::string CacheOptions( CBackendRegistry &backends, CTiledProcessor &tiled, CTex2DDS &spec )
 {
-    std::wcout << spec.GetOutFile() << std::endl;
-    return spec.LoadTextures( verbose );
+    auto options = backends.GetCacheTag( spec.IsAutoFormat() ? DXGI_FORMAT_BC7_UNORM : spec.GetOutputFormat() );
+    if ( !tiled.Accepts( spec ) ) return options;
+    return options + " tiled " + std::to_string( tiled.GetBandRows() );
 }
 
-HRESULT ProcessTextures( ID3D11Device *pDevice, CTex2DDS &spec, bool verbose = false )
+// An AUTO backend keys on an adapter probe before the device exists. Outputs are only stored when the
+// device that wrote them still matches the key.
+bool CacheOptionsHeld( CBackendRegistry &backends, CTiledProcessor &tiled, CTex2DDS &spec, const std::string &options )
 {
-    HRESULT hr;
-
-    std::wcout << spec.GetOutFile() << std::endl;
+    return CacheOptions( backends, tiled, spec ) == options;
+}
 
-    // Load all textures
-    hr = spec.LoadTextures( verbose );
-    if ( FAILED( hr ) ) {
-        std::cerr << "Failed loading textures!" << std::endl;
-        return hr;
+// Compressed large levels held by the small-mip batch are reserved up front
+uint64_t BatchPendingBytes( CMemoryGovernor &governor )
+{
+    uint64_t bytes = 256 << 20;
+    if ( governor.GetBudget() > 0 ) {
+        bytes = std::min( bytes, governor.GetBudget() / 8 );
     }
+    return bytes;
+}
 
-    auto channels = spec.GetChannelCount();
-    auto formatOut = spec.GetOutputFormat();
+// Resident estimate of a job. Block layouts other than linear also hold a column copy of the largest image
+// being compressed, or of a band when tiled, with its compressed column.
+uint64_t EstimateJobMemory( CBackendRegistry &backends, CTiledProcessor &tiled, CTex2DDS &spec, const TexMetadata &predicted )
+{
+    bool isTiled = tiled.Accepts( spec );
+    uint64_t estimate = isTiled ? tiled.EstimateMemory( spec ) : spec.EstimateMemory( predicted );
+    if ( backends.GetLayout() == BLOCK_LAYOUT_LINEAR ) return estimate;
+
+    // BC6H compresses half-float RGBA, the other formats 8-bit RGBA
+    uint64_t rows = isTiled ? std::min<uint64_t>( tiled.GetBandRows(), predicted.height ) : predicted.height;
+    uint64_t texels = uint64_t( predicted.width ) * rows;
+    uint64_t texelBytes = MakeTypeless( predicted.format ) == DXGI_FORMAT_BC6H_TYPELESS ? 8 : 4;
+
+    return estimate + texels * texelBytes + texels * BitsPerPixel( predicted.format ) / 8;
+}
 
+uint64_t EstimateJobMemory( CBackendRegistry &backends, CTiledProcessor &tiled, CTex2DDS &spec )
+{
+    TexMetadata predicted;
+    if ( FAILED( spec.PredictOutput( predicted ) ) ) predicted = {};
+
+    return EstimateJobMemory( backends, tiled, spec, predicted );
+}
 
-    // Split into red, green, blue and alpha
-    std::cout << "Extracting channels..." << std::endl;
-    std::vector<std::unique_ptr<ScratchImage>> slices;
-    slices.reserve( channels );
-    for ( size_t i = 0; i < channels; ++i ) {
-        auto &slice = slices.emplace_back( std::make_unique<ScratchImage>() );
-        hr = ExtractChannel( spec.GetTexture( i ), spec.GetSwizzle( i ), slice );
+// Costs for AssignShard. Every node must compute the same split, so a spec without a cost fails the run
+// instead of counting as weight 1.
+HRESULT EstimateShardCosts( const std::vector<std::unique_ptr<CTex2DDS>> &specs, std::vector<uint64_t> &costs )
+{
+    costs.clear();
+    costs.reserve( specs.size() );
+    for ( const auto &spec : specs ) {
+        uint64_t cost;
+        HRESULT hr = spec->EstimateCost( cost );
         if ( FAILED( hr ) ) {
-            std::cerr << "Failed to split channels!" << std::endl;
+            std::wcerr << "Could not estimate the cost of " << spec->GetOutFile() << " for sharding!" << std::endl;
             return hr;
         }
+        costs.push_back( cost );
     }
-    // Split channels done
+    return 0;
+}
 
+HRESULT ParseFromJSON( nlohmann::json &data, CBackendRegistry &backends, CMemoryGovernor &governor, CConcurrency &concurrency, CVerifier *pVerifier, CTiledProcessor &tiled, CTextureCache &cache, CMetrics &metrics, bool verbose )
+{
+    HRESULT hr;
 
-    // Get slices and combine image
-    std::cout << "Combining channels..." << std::endl;
-    auto pCombinerImage = std::make_unique<ScratchImage>();
-    hr = CombineChannelSlices( slices, formatOut, pCombinerImage, verbose );
-    if ( FAILED( hr ) ) {
-        std::cerr << "Failed to combine channel slices!" << std::endl;
-        return hr;
+    CTex2DDS spec( data );
+    auto start = std::chrono::steady_clock::now();
+
+    std::string cacheKey;
+    auto cacheOptions = CacheOptions( backends, tiled, spec );
+    if ( cache.IsEnabled() && cache.Fetch( spec, cacheOptions, cacheKey ) == S_OK ) {
+        metrics.AddJob( spec, std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count(), true );
+        return 0;
     }
-    // Combine done
 
+    auto job = concurrency.BeginJob( 0 );
 
-    // Here is where we'd do PMA
-    //
-    //
+    auto batchBytes = BatchPendingBytes( governor );
+    governor.ReserveFixed( batchBytes );
+    CSmallMipBatch batch( backends, 16384, batchBytes );
 
+    auto reservation = governor.Reserve( EstimateJobMemory( backends, tiled, spec ) );
 
-    // Generate mipmaps
-    std::cout << "Generating mips..." << std::endl;
-    auto pMipMapImage = std::make_unique<ScratchImage>();
-    hr = GenerateMipMapChain( formatOut, pCombinerImage, pMipMapImage, verbose );
-    if ( FAILED( hr ) ) {
-        std::cerr << "Failed to create mipmaps!" << std::endl;
-        return hr;
+    {
+        CMetrics::CStageTimer timer( metrics, "load", spec.GetOutputPixels() );
+        hr = LoadTextures( tiled, spec, verbose );
     }
-    // Generate mipmaps done
-
-
-    // Compress image
-    std::cout << "Compressing texture..." << std::endl;
-    auto pCompressedImage = std::make_unique<ScratchImage>();
-    hr = CompressImage( pDevice, formatOut, pMipMapImage, pCompressedImage, verbose );
-    if FAILED( hr ) {
-        std::cerr << "Failed to compress texture!" << std::endl;
-        return hr;
+    if ( FAILED( hr ) ) {
+        std::cerr << "Failed loading textures!" << std::endl;
     }
-    // Compress done
-
-    if ( verbose ) {
-        // Decompression sanity check
-        auto pDecompressedImage = std::make_unique<ScratchImage>();
-        hr = Decompress( pCompressedImage->GetImages(), pCompressedImage->GetImageCount(), pCompressedImage->GetMetadata(), pMipMapImage->GetMetadata().format, *pDecompressedImage.get() );
-        if FAILED( hr ) {
-            std::cerr << "Failed to decompress texture for mip testing!" << std::endl;
-            return hr;
-        }
-
-        auto mips = pDecompressedImage->GetMetadata().mipLevels;
-
-        std::cout << "Last decompressed MIP channel values:";
-        for ( int i = 0; i < channels; ++i ) {
-            std::cout << " " << int( pDecompressedImage->GetImage( mips - 1, 0, 0 )->pixels[i] );
+    else {
+        hr = ProcessTextures( batch, backends, pVerifier, tiled, metrics, spec, verbose );
+        if ( FAILED( hr ) ) {
+            std::cerr << "Failed processing textures!" << std::endl;
         }
-        std::cout << std::endl;
-
-        PrintDebugMetadata( "Final", pCompressedImage->GetMetadata() );
-
-        float mse;
-        ComputeMSE( *pCompressedImage->GetImage( 0, 0, 0 ), *pMipMapImage->GetImage( 0, 0, 0 ), mse, nullptr );
-        std::cout << "RMSE = " << std::sqrt( mse / spec.GetChannelCount() ) << std::endl;
-
     }
 
-    std::cout << "Saving texture..." << std::endl;
-    hr = SaveToDDSFile( pCompressedImage->GetImages(), pCompressedImage->GetImageCount(), pCompressedImage->GetMetadata(), DDS_FLAGS_NONE, spec.GetOutFile().c_str() );
-    if FAILED( hr ) {
-        std::cerr << "Failed to save file!" << std::endl;
-        return hr;
+    // Whatever was queued is still saved, the first failure is returned
+    HRESULT hrFlush;
+    {
+        CMetrics::CStageTimer timer( metrics, "flush" );
+        hrFlush = batch.Flush();
+    }
+    if ( FAILED( hrFlush ) ) {
+        std::cerr << "Failed processing textures!" << std::endl;
+        if ( SUCCEEDED( hr ) ) hr = hrFlush;
     }
-
-    if ( verbose ) std::cout << std::endl;
-
-
-    return 0;
-}
-
-HRESULT ParseFromJSON( nlohmann::json &data, ID3D11Device *pDevice, bool verbose )
-{
-    HRESULT hr;
-
-    CTex2DDS spec( data );
-
-    hr = LoadTextures( spec, verbose );
     if ( FAILED( hr ) ) {
-        std::cerr << "Failed loading textures!" << std::endl;
         return hr;
     }
 
-    hr = ProcessTextures( pDevice, spec, verbose );
-    if ( FAILED( hr ) ) {
-        std::cerr << "Failed processing textures!" << std::endl;
-        return hr;
+    if ( !cacheKey.empty() && CacheOptionsHeld( backends, tiled, spec, cacheOptions ) ) {
+        cache.Store( spec, cacheKey );
     }
 
+    metrics.AddJob( spec, std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count(), false );
+
     return 0;
 }
 
-HRESULT ParseFromJSONArray( nlohmann::json &data, ID3D11Device *pDevice, bool verbose )
+HRESULT ParseFromJSONArray( nlohmann::json &data, CBackendRegistry &backends, CMemoryGovernor &governor, CConcurrency &concurrency, CVerifier *pVerifier, CTiledProcessor &tiled, CTextureCache &cache, CJournal *pJournal, CMetrics &metrics, const SShardOptions &shard, size_t prefetchDepth, bool keepGoing, bool verbose )
 {
     HRESULT hr;
 
@@ -168,62 +180,473 @@ HRESULT ParseFromJSONArray( nlohmann::json &data, ID3D11Device *pDevice, bool ve
     }
     std::cerr << std::endl;
 
-    // Load and resize images in SERIAL when verbose=true
-    if ( verbose ) {
-        i = 0;
-        for ( const auto &spec : tex2dds_arr ) {
-            std::cerr << "\rLoading " << ++i << "/" << len << " ";
+    // Pick this shard's jobs, all of them when not sharded
+    std::vector<size_t> jobs( len );
+    std::iota( jobs.begin(), jobs.end(), 0 );
+
+    std::vector<SJobResult> results;
+    if ( shard.IsSharded() ) {
+        std::vector<uint64_t> costs;
+        hr = EstimateShardCosts( tex2dds_arr, costs );
+        if ( FAILED( hr ) ) {
+            return hr;
+        }
+
+        jobs = AssignShard( costs, shard.index, shard.count );
+        std::cerr << "Shard " << shard.index << "/" << shard.count << ": " << jobs.size() << " of " << len << " jobs" << std::endl;
+
+        for ( auto job : jobs ) {
+            auto &result = results.emplace_back();
+            result.index = job;
+            result.cost = costs[job];
+            result.outputs = tex2dds_arr[job]->GetOutputFiles();
+        }
+    }
+
+    int count = int( jobs.size() );
+
+    std::vector<uint64_t> estimates;
+    estimates.reserve( count );
+    for ( auto job : jobs ) {
+        auto &spec = *tex2dds_arr[job].get();
+        estimates.push_back( EstimateJobMemory( backends, tiled, spec ) );
+    }
+
+    auto batchBytes = BatchPendingBytes( governor );
+    governor.ReserveFixed( batchBytes );
+    CSmallMipBatch batch( backends, 16384, batchBytes );
+
+    // Sources of the next jobs are read while earlier ones decode and compress, within their own share of the budget
+    auto prefetchBytes = prefetchDepth > 0 ? BatchPendingBytes( governor ) : 0;
+    governor.ReserveFixed( prefetchBytes );
+    CPrefetcher prefetcher( prefetchBytes );
+
+    // Each worker takes the next job in order, reserves its estimated footprint (blocking until it fits),
+    // then loads and processes it. Workers run in PARALLEL when verbose=false and in SERIAL when verbose=true.
+    size_t workers = verbose ? 1 : concurrency.GetJobWorkers( count );
+    std::atomic<int> next = 0;
+    std::atomic<int> done = 0;
+    std::atomic<HRESULT> result = 0;
+    std::vector<std::string> cacheKeys( count );
+    std::vector<std::string> cacheOptions( count );
+    std::vector<std::string> journalKeys( count );
+
+    // A job counts as done once its outputs are written, failures are kept per job for --keep-going
+    std::vector<std::atomic<bool>> saved( count );
+    std::vector<HRESULT> failures( count, 0 );
+
+    // Without --keep-going the first failure stops every worker. Returns whether the worker should stop.
+    auto fail = [&]( int n, HRESULT hr ) {
+        failures[n] = hr;
+        if ( keepGoing ) return false;
+
+        HRESULT expected = 0;
+        result.compare_exchange_strong( expected, hr );
+        return true;
+    };
+
+    auto worker = [&]( size_t w ) {
+        concurrency.PinWorker( w, workers );
+
+        while ( SUCCEEDED( result.load() ) ) {
+            int n = next++;
+            if ( n >= count ) return;
+
+            auto &spec = *tex2dds_arr[jobs[n]].get();
+            auto start = std::chrono::steady_clock::now();
+            HRESULT hr;
+
+            // Tiled sources are streamed by their own reader and too large to hold
+            int last = prefetchDepth > 0 ? std::min<int>( count, n + 1 + int( prefetchDepth ) ) : n;
+            for ( int ahead = n; ahead < last; ++ahead ) {
+                auto &upcoming = *tex2dds_arr[jobs[ahead]].get();
+                if ( tiled.Accepts( upcoming ) ) continue;
+
+                for ( const auto &file : upcoming.GetSourceFiles() ) {
+                    prefetcher.Prefetch( file );
+                }
+            }
+
+            // Jobs the journal lists with unchanged outputs were completed by an earlier run
+            if ( pJournal ) {
+                if ( FAILED( pJournal->ComputeKey( spec, CacheOptions( backends, tiled, spec ), journalKeys[n] ) ) ) {
+                    journalKeys[n].clear();
+                }
+                else if ( pJournal->IsComplete( spec, journalKeys[n] ) ) {
+                    for ( const auto &file : spec.GetSourceFiles() ) {
+                        prefetcher.Discard( file );
+                    }
+                    saved[n] = true;
+                    std::cerr << "\rProcessed " << ++done << "/" << count << " ";
+                    continue;
+                }
+            }
+
+            // Outputs are journaled as soon as they are written, a job without a key is just not journaled
+            auto onSaved = [&, n]() -> HRESULT {
+                saved[n] = true;
+                if ( !pJournal || journalKeys[n].empty() ) return 0;
+                return pJournal->Record( *tex2dds_arr[jobs[n]].get(), journalKeys[n] );
+            };
+
+            // A hit copies the cached outputs and skips the conversion
+            cacheOptions[n] = CacheOptions( backends, tiled, spec );
+            if ( cache.IsEnabled() && cache.Fetch( spec, cacheOptions[n], cacheKeys[n] ) == S_OK ) {
+                for ( const auto &file : spec.GetSourceFiles() ) {
+                    prefetcher.Discard( file );
+                }
+                hr = onSaved();
+                if ( FAILED( hr ) && fail( n, hr ) ) return;
+                metrics.AddJob( spec, std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count(), true );
+                std::cerr << "\rProcessed " << ++done << "/" << count << " ";
+                continue;
+            }
+
+            auto reservation = governor.Reserve( estimates[n] );
+            auto job = concurrency.BeginJob( count - n - 1 );
+
+            {
+                CMetrics::CStageTimer timer( metrics, "load", spec.GetOutputPixels() );
+                hr = LoadTextures( tiled, spec, verbose, &prefetcher );
+            }
+
+            // Prefetched sources the load didn't take would otherwise hold their budget until the run ends
+            for ( const auto &file : spec.GetSourceFiles() ) {
+                prefetcher.Discard( file );
+            }
 
-            hr = LoadTextures( *spec.get(), verbose );
             if ( FAILED( hr ) ) {
                 std::cerr << "Failed loading textures!" << std::endl;
-                return hr;
+                spec.UnloadTextures();
+                if ( fail( n, hr ) ) return;
+                continue;
             }
+
+            hr = ProcessTextures( batch, backends, pVerifier, tiled, metrics, spec, verbose, onSaved );
+            if ( FAILED( hr ) ) {
+                std::cerr << "Failed processing textures!" << std::endl;
+                spec.UnloadTextures();
+                if ( fail( n, hr ) ) return;
+                continue;
+            }
+
+            spec.UnloadTextures();
+            metrics.AddJob( spec, std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count(), false );
+            std::cerr << "\rProcessed " << ++done << "/" << count << " ";
         }
-    }
+    };
 
-    // Load and resize images in PARALLEL when verbose=false
+    if ( workers == 1 ) {
+        worker( 0 );
+    }
     else {
-        std::vector<std::future<HRESULT>> futures;
-        futures.reserve( len );
+        std::vector<std::thread> threads;
+        threads.reserve( workers );
+        for ( size_t w = 0; w < workers; ++w ) {
+            threads.emplace_back( worker, w );
+        }
+        for ( auto &thread : threads ) {
+            thread.join();
+        }
+    }
+
+    // Compress whatever small mips are still queued and save their textures, also after a failure stopped the workers
+    {
+        CMetrics::CStageTimer timer( metrics, "flush" );
+        hr = batch.Flush();
+    }
+    if ( FAILED( hr ) ) {
+        std::cerr << "Failed processing textures!" << std::endl;
+    }
+    std::cerr << std::endl;
+    prefetcher.PrintReport();
+    if ( pJournal ) pJournal->PrintReport();
+
+    // A job whose outputs were never written failed, also when its error surfaced through another job's batch flush
+    // Jobs no worker took after a failure stopped the run are aborted
+    HRESULT firstFailure = result.load();
+    int started = std::min( next.load(), count );
+    size_t failed = 0;
+    for ( int n = 0; n < count; ++n ) {
+        if ( saved[n] ) continue;
+
+        if ( SUCCEEDED( failures[n] ) ) failures[n] = n < started ? E_FAIL : E_ABORT;
+        if ( SUCCEEDED( firstFailure ) ) firstFailure = failures[n];
+        if ( failed++ == 0 ) std::cerr << "Failed jobs:" << std::endl;
+        std::wcerr << "    " << tex2dds_arr[jobs[n]]->GetOutFile() << std::endl;
+    }
+    if ( failed > 0 ) {
+        std::cerr << failed << " of " << count << " jobs failed" << std::endl;
+    }
+
+    for ( int n = 0; n < count; ++n ) {
+        if ( saved[n] && !cacheKeys[n].empty() && CacheOptionsHeld( backends, tiled, *tex2dds_arr[jobs[n]].get(), cacheOptions[n] ) ) {
+            cache.Store( *tex2dds_arr[jobs[n]].get(), cacheKeys[n] );
+        }
+    }
+    if ( shard.IsSharded() ) {
+        for ( int n = 0; n < count; ++n ) {
+            results[n].hr = saved[n] ? 0 : failures[n];
+        }
+
+        hr = WriteShardManifest( shard, len, results );
+        if ( FAILED( hr ) ) {
+            return hr;
+        }
+    }
+
+    return firstFailure;
+}
+
+// Predicts the outputs and resident memory of a run from source headers, without decoding or writing anything.
+// Workers take jobs in order, so at most one worker's worth of consecutive jobs is resident at a time.
+HRESULT PlanTextures( nlohmann::json &data, CBackendRegistry &backends, CMemoryGovernor &governor, CConcurrency &concurrency, CTiledProcessor &tiled, const SShardOptions &shard, size_t prefetchDepth, bool verbose )
+{
+    std::vector<std::unique_ptr<CTex2DDS>> specs;
+    for ( const auto &row : data ) {
+        specs.emplace_back( std::make_unique<CTex2DDS>( row ) );
+    }
+
+    std::vector<size_t> jobs( specs.size() );
+    std::iota( jobs.begin(), jobs.end(), 0 );
+
+    if ( shard.IsSharded() ) {
+        std::vector<uint64_t> costs;
+        HRESULT hr = EstimateShardCosts( specs, costs );
+        if ( FAILED( hr ) ) {
+            return hr;
+        }
+        jobs = AssignShard( costs, shard.index, shard.count );
+    }
+
+    nlohmann::json plan;
+    auto &planJobs = plan["jobs"] = nlohmann::json::array();
 
-        for ( const auto &spec : tex2dds_arr ) {
-            futures.emplace_back( std::async( std::launch::async, [&] {
-                return LoadTextures( *spec.get(), verbose );
-            } ) );
+    std::vector<uint64_t> estimates;
+    estimates.reserve( jobs.size() );
+    uint64_t outputBytes = 0;
+    uint64_t cost = 0;
+
+    for ( auto job : jobs ) {
+        auto &spec = *specs[job].get();
+
+        TexMetadata metadata;
+        HRESULT hr = spec.PredictOutput( metadata );
+        if ( FAILED( hr ) ) {
+            std::wcerr << "Failed to read source headers: " << spec.GetOutFile() << std::endl;
+            return hr;
         }
 
-        i = 0;
-        for ( auto &f : futures ) {
-            hr = f.get();
+        // Header plus every level of every array item, or the padded pages of every level
+        size_t bytes = 0;
+        if ( spec.IsPaged() ) {
+            std::vector<SPageLevel> levels;
+            bytes = ComputePageLevels( metadata, spec.GetPages(), levels ) * ComputePageBytes( metadata.format, spec.GetPages() );
+        }
+        else {
+            hr = EncodeDDSHeader( metadata, DDS_FLAGS_NONE, nullptr, 0, bytes );
             if ( FAILED( hr ) ) {
-                std::cerr << "Failed loading textures!" << std::endl;
+                std::cerr << "Failed to predict DDS header!" << std::endl;
                 return hr;
             }
-            std::cerr << "\rLoaded " << ++i << "/" << len << " ";
+            for ( size_t mip = 0; mip < metadata.mipLevels; ++mip ) {
+                size_t rowPitch, slicePitch;
+                hr = ComputePitch( metadata.format, std::max<size_t>( metadata.width >> mip, 1 ), std::max<size_t>( metadata.height >> mip, 1 ), rowPitch, slicePitch );
+                if ( FAILED( hr ) ) return hr;
+                bytes += slicePitch * metadata.arraySize;
+            }
+        }
+
+        bool isTiled = tiled.Accepts( spec );
+        estimates.push_back( EstimateJobMemory( backends, tiled, spec, metadata ) );
+        outputBytes += bytes;
+        cost += spec.EstimateCost( metadata );
+
+        planJobs.push_back( {
+            { "output", std::filesystem::path( spec.GetOutFile() ).string() },
+            { "format", spec.GetFormatName() },
+            { "width", metadata.width },
+            { "height", metadata.height },
+            { "array_size", metadata.arraySize },
+            { "mip_levels", metadata.mipLevels },
+            { "output_bytes", bytes },
+            { "peak_memory_bytes", estimates.back() },
+            { "tiled", isTiled },
+            { "cost", spec.EstimateCost( metadata ) }
+        } );
+
+        if ( verbose ) {
+            std::wcerr << spec.GetOutFile() << L": " << bytes << L" bytes, " << estimates.back() << L" bytes resident" << std::endl;
         }
     }
-    std::cerr << std::endl;
 
-    // Perform actual processing
-    i = 0;
-    for ( const auto &spec : tex2dds_arr ) {
-        std::cerr << "\rProcessing " << ++i << "/" << len << " ";
+    // Same fixed reservations as ParseFromJSONArray
+    uint64_t fixed = BatchPendingBytes( governor );
+    if ( prefetchDepth > 0 ) fixed += BatchPendingBytes( governor );
+
+    size_t workers = verbose ? 1 : concurrency.GetJobWorkers( jobs.size() );
+    uint64_t largest = 0;
+    uint64_t window = 0;
+    uint64_t resident = 0;
+    for ( size_t n = 0; n < estimates.size(); ++n ) {
+        window += estimates[n];
+        if ( n >= workers ) window -= estimates[n - workers];
+        resident = std::max( resident, window );
+        largest = std::max( largest, estimates[n] );
+    }
+
+    // The governor holds jobs back to the budget, but an oversized one still runs alone
+    auto budget = governor.GetBudget();
+    if ( budget > 0 ) {
+        resident = std::min( resident, std::max( budget > fixed ? budget - fixed : 0, largest ) );
+    }
+
+    plan["batch"] = {
+        { "jobs", jobs.size() },
+        { "workers", workers },
+        { "output_bytes", outputBytes },
+        { "largest_job_memory_bytes", largest },
+        { "peak_memory_bytes", fixed + resident },
+        { "cost", cost }
+    };
+
+    std::cout << plan.dump( 4 ) << std::endl;
 
-        hr = ProcessTextures( pDevice, *spec.get(), verbose );
+    return 0;
+}
+
+// Keeps the specs parsed and reconverts the ones reading a source file whenever it is saved
+HRESULT WatchTextures( nlohmann::json &data, CBackendRegistry &backends, CConcurrency &concurrency, CVerifier *pVerifier, CTiledProcessor &tiled, CTextureCache &cache, CMetrics &metrics, bool verbose )
+{
+    std::vector<std::unique_ptr<CTex2DDS>> specs;
+    if ( data.is_array() ) {
+        for ( const auto &row : data ) {
+            specs.emplace_back( std::make_unique<CTex2DDS>( row ) );
+        }
+    }
+    else {
+        specs.emplace_back( std::make_unique<CTex2DDS>( data ) );
+    }
+
+    // Source file -> specs reading it
+    std::map<std::wstring, std::vector<size_t>> dependents;
+    std::set<std::wstring> directories;
+    for ( size_t i = 0; i < specs.size(); ++i ) {
+        for ( const auto &file : specs[i]->GetSourceFiles() ) {
+            auto path = NormalizeWatchPath( file );
+            dependents[path].push_back( i );
+            directories.insert( std::filesystem::path( path ).parent_path().wstring() );
+        }
+    }
+
+    CFileWatcher watcher;
+    for ( const auto &directory : directories ) {
+        HRESULT hr = watcher.Watch( directory );
         if ( FAILED( hr ) ) {
-            std::cerr << "Failed processing textures!" << std::endl;
             return hr;
         }
     }
-    std::cerr << std::endl;
 
-    return 0;
+    std::cerr << "Watching " << dependents.size() << " files in " << directories.size() << " directories..." << std::endl;
+
+    for ( ;; ) {
+        bool rescan = false;
+        auto changed = watcher.WaitForChanges( std::chrono::milliseconds( 200 ), rescan );
+
+        // Lost notifications could be any watched file, so every spec is requeued
+        std::set<size_t> affected;
+        if ( rescan ) {
+            std::cerr << "Change notifications overflowed, reconverting every spec" << std::endl;
+            for ( size_t i = 0; i < specs.size(); ++i ) affected.insert( i );
+        }
+        for ( const auto &file : changed ) {
+            auto it = dependents.find( file );
+            if ( it != dependents.end() ) {
+                affected.insert( it->second.begin(), it->second.end() );
+            }
+        }
+        if ( affected.empty() ) continue;
+
+        auto start = std::chrono::steady_clock::now();
+        size_t converted = 0;
+
+        CSmallMipBatch batch( backends );
+        std::map<size_t, std::pair<std::string, std::string>> cacheKeys;
+        size_t queued = affected.size();
+        for ( auto i : affected ) {
+            auto &spec = *specs[i].get();
+            auto job = concurrency.BeginJob( --queued );
+
+            // Reverting a source to an earlier version hits the cache
+            std::string cacheKey;
+            auto cacheOptions = CacheOptions( backends, tiled, spec );
+            if ( cache.IsEnabled() && cache.Fetch( spec, cacheOptions, cacheKey ) == S_OK ) {
+                ++converted;
+                continue;
+            }
+
+            // A failed conversion is reported and retried on the next save
+            HRESULT hr = LoadTextures( tiled, spec, verbose );
+            if ( SUCCEEDED( hr ) ) {
+                hr = ProcessTextures( batch, backends, pVerifier, tiled, metrics, spec, verbose );
+            }
+            spec.UnloadTextures();
+
+            if ( FAILED( hr ) ) {
+                std::wcerr << "Failed to convert: " << spec.GetOutFile() << std::endl;
+                continue;
+            }
+            ++converted;
+
+            if ( !cacheKey.empty() ) {
+                cacheKeys[i] = { cacheKey, cacheOptions };
+            }
+        }
+
+        HRESULT hr = batch.Flush();
+        if ( FAILED( hr ) ) {
+            std::cerr << "Failed processing textures!" << std::endl;
+        }
+        else {
+            for ( const auto &[i, entry] : cacheKeys ) {
+                if ( CacheOptionsHeld( backends, tiled, *specs[i].get(), entry.second ) ) {
+                    cache.Store( *specs[i].get(), entry.first );
+                }
+            }
+        }
+
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::steady_clock::now() - start );
+        std::cerr << "Reconverted " << converted << "/" << affected.size() << " specs in " << elapsed.count() << " ms" << std::endl;
+    }
 }
 
 int main( int argc, char *argv[] )
 {
+    // The tool prints the library's progress, in-process hosts don't get it unless they ask
+    SetProgressStreams( &std::cout, &std::wcout );
+
     bool verbose = false;
+    uint64_t maxMemory = 0;
+    size_t threads = 0;
+    bool affinity = false;
+    SShardOptions shard;
+    bool watch = false;
+    bool verify = false;
+    float verifyMaxRMSE = 0.05f;
+    size_t tileAbove = 16384;
+    size_t tileRows = 128;
+    std::string cacheDir;
+    size_t prefetchDepth = 4;
+    std::string metricsPath;
+    std::string prometheusPath;
+    std::vector<std::string> mergeManifests;
+    BACKEND_KIND backend = BACKEND_DEFAULT;
+    bool plan = false;
+    bool keepGoing = false;
+    std::string journalPath;
+    bool resume = false;
+    BLOCK_LAYOUT blockLayout = BLOCK_LAYOUT_LINEAR;
+    bool benchmark = false;
 
     std::vector<std::string> arguments;
     arguments.reserve( argc );
@@ -236,6 +659,117 @@ int main( int argc, char *argv[] )
             verbose = true;
             std::cerr << "WARNING! Verbose logging enabled, disabling parallel processing!" << std::endl;
         }
+        else if ( arguments[i] == "--threads" && i + 1 < arguments.size() ) {
+            threads = std::strtoul( arguments[++i].c_str(), nullptr, 10 );
+            if ( threads == 0 ) {
+                std::cerr << "Invalid --threads value: " << arguments[i] << std::endl;
+                return E_INVALIDARG;
+            }
+        }
+        else if ( arguments[i] == "--affinity" ) {
+            affinity = true;
+        }
+        else if ( arguments[i] == "--watch" ) {
+            watch = true;
+        }
+        else if ( arguments[i] == "--plan" ) {
+            plan = true;
+        }
+        else if ( arguments[i] == "--keep-going" ) {
+            keepGoing = true;
+        }
+        else if ( arguments[i] == "--journal" && i + 1 < arguments.size() ) {
+            journalPath = arguments[++i];
+        }
+        else if ( arguments[i] == "--resume" ) {
+            resume = true;
+        }
+        else if ( arguments[i] == "--verify" ) {
+            verify = true;
+        }
+        else if ( arguments[i] == "--verify-max-rmse" && i + 1 < arguments.size() ) {
+            verify = true;
+            verifyMaxRMSE = std::strtof( arguments[++i].c_str(), nullptr );
+            if ( verifyMaxRMSE <= 0.0f ) {
+                std::cerr << "Invalid --verify-max-rmse value: " << arguments[i] << std::endl;
+                return E_INVALIDARG;
+            }
+        }
+        else if ( arguments[i] == "--tile-above" && i + 1 < arguments.size() ) {
+            // 0 disables tiling
+            tileAbove = std::strtoul( arguments[++i].c_str(), nullptr, 10 );
+        }
+        else if ( arguments[i] == "--tile-rows" && i + 1 < arguments.size() ) {
+            tileRows = std::strtoul( arguments[++i].c_str(), nullptr, 10 );
+            if ( tileRows == 0 ) {
+                std::cerr << "Invalid --tile-rows value: " << arguments[i] << std::endl;
+                return E_INVALIDARG;
+            }
+        }
+        else if ( arguments[i] == "--prefetch" && i + 1 < arguments.size() ) {
+            // Jobs ahead whose sources are read early, 0 disables
+            prefetchDepth = std::strtoul( arguments[++i].c_str(), nullptr, 10 );
+        }
+        else if ( arguments[i] == "--metrics" && i + 1 < arguments.size() ) {
+            metricsPath = arguments[++i];
+        }
+        else if ( arguments[i] == "--metrics-prom" && i + 1 < arguments.size() ) {
+            prometheusPath = arguments[++i];
+        }
+        else if ( arguments[i] == "--cache-dir" && i + 1 < arguments.size() ) {
+            cacheDir = arguments[++i];
+        }
+        else if ( arguments[i] == "--shard" && i + 1 < arguments.size() ) {
+            if ( !ParseShard( arguments[++i], shard ) ) {
+                std::cerr << "Invalid --shard value, expected i/N with 0 <= i < N: " << arguments[i] << std::endl;
+                return E_INVALIDARG;
+            }
+        }
+        else if ( arguments[i] == "--manifest" && i + 1 < arguments.size() ) {
+            shard.manifest = arguments[++i];
+        }
+        else if ( arguments[i] == "--merge" ) {
+            // Every following argument is a shard manifest
+            mergeManifests.assign( arguments.begin() + i + 1, arguments.end() );
+            break;
+        }
+        else if ( arguments[i] == "--backend" && i + 1 < arguments.size() ) {
+            if ( !ParseBackend( arguments[++i], backend ) ) {
+                std::cerr << "Invalid --backend value, expected cpu, gpu or auto: " << arguments[i] << std::endl;
+                return E_INVALIDARG;
+            }
+        }
+        else if ( arguments[i] == "--block-layout" && i + 1 < arguments.size() ) {
+            if ( !ParseBlockLayout( arguments[++i], blockLayout ) ) {
+                std::cerr << "Invalid --block-layout value, expected linear, tiled or morton: " << arguments[i] << std::endl;
+                return E_INVALIDARG;
+            }
+        }
+        else if ( arguments[i] == "--benchmark" ) {
+            benchmark = true;
+        }
+        else if ( arguments[i] == "--max-memory" && i + 1 < arguments.size() ) {
+            maxMemory = ParseByteSize( arguments[++i] );
+            if ( maxMemory == 0 ) {
+                std::cerr << "Invalid --max-memory value: " << arguments[i] << std::endl;
+                return E_INVALIDARG;
+            }
+        }
+    }
+
+    if ( resume && journalPath.empty() ) {
+        std::cerr << "--resume needs a --journal to resume from!" << std::endl;
+        return E_INVALIDARG;
+    }
+
+    if ( !mergeManifests.empty() ) {
+        try {
+            return MergeShardManifests( mergeManifests );
+        }
+        catch ( const std::exception &e ) {
+            std::cerr << "Error parsing manifest: " << e.what() << std::endl;
+            exit( -1 );
+        }
     }
 
     HRESULT hr = CoInitializeEx( nullptr, COINIT_MULTITHREADED );
@@ -244,26 +778,93 @@ int main( int argc, char *argv[] )
         return hr;
     }
 
-    Microsoft::WRL::ComPtr<ID3D11Device> pDevice;
-    CreateDevice( 0, pDevice.GetAddressOf() );
+    // Synthetic images only, nothing is read from stdin
+    if ( benchmark ) {
+        return BenchmarkBlockLayouts( verbose );
+    }
+
+    // The GPU device is only created once a BC6H/BC7 texture is compressed
+    CBackendRegistry backends( backend, blockLayout );
 
     std::istreambuf_iterator<char> begin( std::cin ), end;
     std::string input( begin, end );
 
+    CMemoryGovernor governor( maxMemory );
+    CConcurrency concurrency( threads, affinity );
+
+    CVerifier verifier( verifyMaxRMSE );
+    CVerifier *pVerifier = verify ? &verifier : nullptr;
+
+    CTiledProcessor tiled( backends, tileAbove, tileRows );
+
+    // --cache-dir, or TEX2DDS_CACHE_DIR so CI agents and developers share one store without changing scripts
+    if ( cacheDir.empty() ) {
+        auto env = std::getenv( "TEX2DDS_CACHE_DIR" );
+        if ( env ) cacheDir = env;
+    }
+    CTextureCache cache( std::filesystem::path( cacheDir ).wstring() );
+
+    // Entries share the cache key, so a journal is only valid for the same tool build and sources
+    CJournal journal( std::filesystem::path( journalPath ).wstring(), cache );
+    CJournal *pJournal = nullptr;
+    if ( !journalPath.empty() && !plan ) {
+        hr = journal.Open( resume );
+        if ( FAILED( hr ) ) {
+            return hr;
+        }
+        pJournal = &journal;
+    }
+
+    CMetrics metrics;
+
     try {
         auto data = nlohmann::json::parse( input );
 
+        // A single spec is a one-job array when sharding, so exactly one shard converts it
+        if ( ( shard.IsSharded() || plan || pJournal ) && data.is_object() ) {
+            data = nlohmann::json::array( { data } );
+        }
+
+        // Nothing is decoded, written or fetched from the cache
+        if ( plan ) {
+            return PlanTextures( data, backends, governor, concurrency, tiled, shard, prefetchDepth, verbose );
+        }
+
         if ( data.is_object() ) {
-            return ParseFromJSON( data, pDevice.Get(), verbose );
+            hr = ParseFromJSON( data, backends, governor, concurrency, pVerifier, tiled, cache, metrics, verbose );
         }
 
         else if ( data.is_array() ) {
-            return ParseFromJSONArray( data, pDevice.Get(), verbose );
+            hr = ParseFromJSONArray( data, backends, governor, concurrency, pVerifier, tiled, cache, pJournal, metrics, shard, prefetchDepth, keepGoing, verbose );
+        }
+
+        // Runs until the process is stopped
+        if ( watch ) {
+            governor.PrintReport();
+            hr = WatchTextures( data, backends, concurrency, pVerifier, tiled, cache, metrics, verbose );
         }
     }
     catch ( const std::exception &e ) {
         std::cerr << "Error parsing json: " << e.what() << std::endl;
         exit( -1 );
     }
+
+    governor.PrintReport();
+    cache.PrintReport();
+
+    if ( !metricsPath.empty() || !prometheusPath.empty() ) {
+        metrics.SetCacheStats( cache.GetHits(), cache.GetMisses() );
+        metrics.Write( metricsPath, prometheusPath );
+    }
+
+    // Textures above the error bound are still written, but the run fails
+    if ( pVerifier ) {
+        verifier.PrintReport();
+        if ( SUCCEEDED( hr ) && verifier.GetFlagged() > 0 ) {
+            hr = E_FAIL;
+        }
+    }
+
+    return hr;
     
 }
\ No newline at end of file